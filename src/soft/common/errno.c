@@ -44,5 +44,6 @@ char * errno_mess_table[] = {
    [EPERM   +1] = "Operation not permitted",
    [ERANGE  +1] = "Math result not representable",
    [ESRCH   +1] = "No such thread or Process",
+   [ETIMEDOUT +1] = "Timer expired",
    [EROFS   +1] = "Read-only file system"
 };
@@ -36,7 +36,7 @@
 #ifdef _KERNEL_     /* _KERNEL_ is defined at the beginning of kernel/klibc.h  */
 #   define errno    *thread_errno(ThreadCurrent)    /* gets errno from the tls of ThreadCurrent */
 #else
-#   define errno    (__usermem.ptls->tls_errno)     /* gets errno of the current running thread */
+#   define errno    (__tls()->tls_errno)            /* gets errno of the current running thread */
 #endif
 
 /**
@@ -88,6 +88,7 @@ enum errno_code {
     // Signals / processes
     EINTR,        ///< Interrupted funct call (https://man7.org/linux/man-pages/man7/signal.7.html)
     ESRCH,        ///< No such process
+    ETIMEDOUT,    ///< Timer expired (timed wait or timed lock)
 
     // Unimplemented features
     ENOSYS        ///< Function not implemented
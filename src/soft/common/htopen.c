@@ -22,12 +22,14 @@
 #ifdef _KERNEL_                                     // if it is for the kernel
 #   include <kernel/klibc.h>
 #   define PAGE_SIZE    4096
+#   define HTO_MAXSIZE  (PAGE_SIZE<<PAGE_ORDER_MAX) // kmalloc() gives contiguous pages beyond
 #   define MALLOC       kmalloc                     // allocates in the slab allocator
 #   define STRDUP       kstrdup                     // allocates a new key (when it is a string)
 #   define FREE(k)      kfree(k)                    // free a key (when it is a string)
 #   define PRINT(...)   kprintf(__VA_ARGS__) 
 #   define MALLOC_P(l)  
 #else                                               // if it is for the user
+#   define HTO_MAXSIZE  4096                        // FIXME should be PAGE_SIZE for this version
 #   define MALLOC       malloc                      // allocates in the libc's memory  allocator
 #   define STRDUP       strdup                      // allocates a new key (when it is a string)
 #   define FREE(k)      free(k)                     // free a key (when it is a string)
@@ -160,7 +162,7 @@ hto_t * hto_create (unsigned nb, int type)          // type: 0 key "char *" ; 1
 {
     nb = largest_prime (nb);                        // the number of entries must be a prime
     size_t s = sizeof(hto_t)+nb*sizeof(hto_slot_t); // header part + bucket part
-    if (s > 4096) return NULL;                      // FIXME should be PAGE_SIZE for this version
+    if (s > HTO_MAXSIZE) return NULL;               // too big for the allocator
     hto_t *ht = MALLOC(s);                          // allocate the hash table
     if (ht) {                                       // if alloc is a success    
         for (int i = 0; i < nb; i++) {              // for each slot
@@ -279,7 +281,8 @@ void * hto_del (hto_t *ht, void *key)               // see comment in htopen.h
         if (current_key == NULL) return NULL;       // key not found, thus return NULL
         if (keycmp (ht, key, current_key)==0) {     // key found
             void * old_val = ht->bucket[h].val;     // if the user want to free the old val
-            FREE(ht->bucket[h].key);                // we must free the key, if it exists
+            if (ht->type == 0)                      // a string key has been duplicated
+                FREE(ht->bucket[h].key);            // we must free the key, if it exists
             ht->bucket[h].key = KEYFREED;           // the slot is now FREED
             ht->bucket[h].val = NULL;               // just to clean the slot
             ht->freed++;                            // one more freed slot
@@ -0,0 +1,130 @@
+/*------------------------------------------------------------------------------------------------*\
+   _     ___    __
+  | |__ /'v'\  / /      \date 2025-04-23
+  | / /(     )/ _ \     Copyright (c) 2021 Sorbonne University
+  |_\_\ x___x \___/     SPDX-License-Identifier: MIT
+
+  \file     common/ring.h
+  \author   Franck Wajsburt
+  \brief    Lock-free ring buffer of bytes for a single producer and a single consumer (SPSC)
+
+  This file contains inline functions, thus it can be used by the kernel and by the user library.
+  - The producer only writes the head and the consumer only writes the tail, thus they do not need
+    any lock, even if they run on different CPUs, or if the producer is an ISR.
+  - head and tail are free-running counters, they are never reduced modulo the size, thus:
+      * head - tail is the number of bytes in the ring, even if the counters have wrapped,
+      * the ring is empty when head == tail and full when head - tail == size,
+        all the bytes of data[] are usable (there is no lost cell to tell full from empty)
+      * the size must be a power of 2, the position of a counter in data[] is counter & mask.
+  - The functions push or pop as many bytes as possible in a single call (bulk transfer), there is
+    a single barrier per call and not per byte:
+      * the producer writes the bytes then the head, there is a write barrier between them,
+      * the consumer reads the head then the bytes, there is a read barrier between them,
+        and it reads the bytes then writes the tail, there is a full barrier between them.
+  - If there are several producers (resp. consumers), they must be serialized by the caller.
+
+     tail & mask          head & mask
+         v                    v
+    .----------------------------------------.
+    |    |XXXXXXXXXXXXXXXXXXXX|              |   data[size]   X are bytes to pop
+    '----------------------------------------'
+
+\*------------------------------------------------------------------------------------------------*/
+
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <hal/cpu/atomic.h>
+
+/**
+ * \brief   SPSC ring buffer, data[] is given by the user of the ring (thus without allocation)
+ */
+typedef struct ring_s {
+    volatile unsigned head;     ///< number of pushed bytes since ring_init(), written by producer
+    volatile unsigned tail;     ///< number of popped bytes since ring_init(), written by consumer
+    unsigned mask;              ///< size of data[] - 1, the size is a power of 2
+    char *data;                 ///< circular array
+} ring_t;
+
+/**
+ * \brief   Initialize an empty ring
+ * \param   ring    the ring
+ * \param   data    circular array
+ * \param   size    size of data[] in bytes, it must be a power of 2
+ */
+static inline void ring_init (ring_t * ring, char * data, unsigned size) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = size - 1;
+    ring->data = data;
+}
+
+/**
+ * \brief   Give the number of bytes in the ring, the value may be less than the real one
+ *          if the producer pushes meanwhile (resp. greater if the consumer pops meanwhile)
+ * \param   ring    the ring
+ * \return  the number of bytes that can be popped
+ */
+static inline unsigned ring_count (ring_t * ring) {
+    return ring->head - ring->tail;
+}
+
+/**
+ * \brief   Give the number of free bytes in the ring
+ * \param   ring    the ring
+ * \return  the number of bytes that can be pushed
+ */
+static inline unsigned ring_space (ring_t * ring) {
+    return ring->mask + 1 - (ring->head - ring->tail);
+}
+
+/**
+ * \brief   Push as many bytes as possible, called only by the producer
+ * \param   ring    the ring
+ * \param   buf     bytes to push
+ * \param   count   number of bytes in buf
+ * \return  number of bytes pushed, 0 if the ring is full
+ */
+static inline unsigned ring_push (ring_t * ring, const char * buf, unsigned count) {
+    unsigned head = ring->head;                             // private for the producer
+    unsigned space = ring->mask + 1 - (head - ring->tail);  // tail may grow meanwhile, no matter
+    if (count > space)
+        count = space;
+    if (count == 0)
+        return 0;
+    for (unsigned i = 0; i < count; i++)
+        ring->data [(head + i) & ring->mask] = buf [i];
+    atomic_wmb ();                                          // bytes written before the new head
+    ring->head = head + count;                              // publish the bytes
+    return count;
+}
+
+/**
+ * \brief   Pop as many bytes as possible, called only by the consumer
+ * \param   ring    the ring
+ * \param   buf     buffer where the popped bytes are copied
+ * \param   count   size of buf
+ * \return  number of bytes popped, 0 if the ring is empty
+ */
+static inline unsigned ring_pop (ring_t * ring, char * buf, unsigned count) {
+    unsigned tail = ring->tail;                             // private for the consumer
+    unsigned avail = ring->head - tail;                     // head may grow meanwhile, no matter
+    if (count > avail)
+        count = avail;
+    if (count == 0)
+        return 0;
+    atomic_rmb ();                                          // head read before the bytes
+    for (unsigned i = 0; i < count; i++)
+        buf [i] = ring->data [(tail + i) & ring->mask];
+    atomic_mb ();                                           // bytes read before the new tail
+    ring->tail = tail + count;                              // free the room
+    return count;
+}
+
+#endif//_RING_H_
+
+/*------------------------------------------------------------------------------------------------*\
+   Editor config (vim/emacs): tabs are 4 spaces, max line length is 100 characters
+   vim: set ts=4 sw=4 sts=4 et tw=100:
+   -*- mode: c; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil; fill-column: 100 -*-
+\*------------------------------------------------------------------------------------------------*/
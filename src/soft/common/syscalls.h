@@ -31,21 +31,35 @@
 #define SYSCALL_THREAD_EXIT     13
 #define SYSCALL_SCHED_DUMP      14
 #define SYSCALL_THREAD_JOIN     15
-#define SYSCALL_MUTEX_INIT      16
-#define SYSCALL_MUTEX_LOCK      17
-#define SYSCALL_MUTEX_UNLOCK    18
-#define SYSCALL_MUTEX_DESTROY   19
 #define SYSCALL_BARRIER_INIT    20
 #define SYSCALL_BARRIER_WAIT    21
 #define SYSCALL_BARRIER_DESTROY 22
 //-------------------------------------- shellsyscall
 #define SYSCALL_KSHELL          23
+//-------------------------------------- used in ulib/thread.c
+#define SYSCALL_SCHED_SETPARAM  24
+#define SYSCALL_SCHED_GETPARAM  25
+#define SYSCALL_NANOSLEEP       26
+#define SYSCALL_BARRIER_TIMED   28
+#define SYSCALL_FUTEX_WAIT      29
+#define SYSCALL_FUTEX_WAKE      30
+#define SYSCALL_COND_INIT       31
+#define SYSCALL_COND_WAIT       32
+#define SYSCALL_COND_SIGNAL     33
+#define SYSCALL_COND_DESTROY    34
+#define SYSCALL_RWLOCK_INIT     35
+#define SYSCALL_RWLOCK_RDLOCK   36
+#define SYSCALL_RWLOCK_WRLOCK   37
+#define SYSCALL_RWLOCK_UNLOCK   38
+#define SYSCALL_RWLOCK_DESTROY  39
+//-------------------------------------- used in ulib/libc.c
+#define SYSCALL_CLOCK64         40
 //-------------------------------------- maximum number
-#define SYSCALL_NR              32
+#define SYSCALL_NR              64
 
 
 #ifndef __DEPEND__
-#if ((SYSCALL_NR != 16) && (SYSCALL_NR != 32))
+#if ((SYSCALL_NR != 16) && (SYSCALL_NR != 32) && (SYSCALL_NR != 64))
 #error SYSCALL_NR doit être une puissance de 2
 #endif
 #endif
@@ -54,7 +54,8 @@ typedef struct _usermem_s {
     int * uheap_beg;            ///< lowest highest address of the user heap segment
     void (* main_start)(void);  ///< pointer to the start of main thread (see ulib/crt0.c)
     void * main_thread;         ///< address of the main thread (defined in kernel/kinit.c)
-    struct _tls_s * ptls;       ///< pointer to the thread local storage of the current thread
+    int ncpus;                  ///< number of CPUs that run threads (set by the kernel)
+    unsigned clock_freq;        ///< clock() cycles per second (set by the kernel from the DTB)
     struct file_s *o_file[MAX_O_FILE];     ///< open files; 
 } __usermem_t;
 
@@ -64,16 +65,31 @@ extern __usermem_t __usermem;   // user mem space struct (declared kernel.ld ; i
  * \brief thread local storage structure definition.
  *        There is one structure per thread placed at the beginning of each thread's user stack.
  *        For each field, a #define allows to hide the way of these variables are built.
- *        The current structure for the current thread is pointed by _usermem.tls,
- *        the kernel has to update _usermem.tls field at each thread commutation
  *        TODO: we'll have to extend the usage of TLS variables
  */
 typedef struct _tls_s {
     int         tls_errno;      ///< syscall error number
     long long   tls_randseed;   ///< user random seed
+    struct malloc_cache_s * tls_mcache; ///< small free blocks of the thread (see ulib/memory.c)
 } _tls_t;
 
-#define urandseed   (__usermem.ptls->tls_randseed)
+/**
+ * \brief tls of the calling thread, for the user code.
+ *        The user stacks are slots of USTACK_SIZE bytes below __usermem.ustack_beg, the tls is at
+ *        the top of the slot, just below the MAGIC_STACK word (see thread_create()). Thus, the
+ *        slot is found from the address of a local variable, whatever the CPU which runs the
+ *        thread, and even if the thread is moved to another CPU meanwhile.
+ * \return the tls of the thread
+ */
+static inline _tls_t * __tls (void)
+{
+    int here;                                               // a variable in the current stack
+    unsigned slot = ((char *)__usermem.ustack_beg - (char *)&here) / USTACK_SIZE;
+    char *top = (char *)__usermem.ustack_beg - slot * USTACK_SIZE - sizeof(int);
+    return (_tls_t *)top - 1;
+}
+
+#define urandseed   (__tls()->tls_randseed)
 
 #endif//_USERMEM_H_
 
@@ -101,7 +101,7 @@ static errno_t fs1_mount (superblock_t *sb, blockdev_t *bdev)
     if (!vol) return -ENOMEM;                               // return if no memory
     vol->entries = blockio_get (bdev->minor, 0);            // read the disk metadata (first block)
     if (!vol->entries) { kfree (vol); return -EIO; }        // return if impossible to read disk
-    page_set_lock (vol->entries);                           // lock the metada block page
+    blockio_lock (vol->entries);                            // lock the metada block page
 
     vol->entry_count = FS1_MAX_FILES;                       // Maximum number of files
     vol->minor = bdev->minor;                               // block device identifier
@@ -112,7 +112,7 @@ static errno_t fs1_mount (superblock_t *sb, blockdev_t *bdev)
 
     sb->root = fs1_new_inode (sb, 0);                       // inode root of the superblock
     if (!sb->root) {                                        // no more memory space
-        page_clr_lock (vol->entries);                       // unlock the metadata page
+        blockio_unlock (vol->entries);                      // unlock the metadata page
         blockio_release (vol->entries);                     // release the block
         kfree (vol);                                        // volume no longer needed (cleanup)
         return -ENOMEM;                                     // return the error
@@ -130,20 +130,20 @@ static errno_t fs1_unmount (superblock_t *sb)
  * \note Inode reference counting model:
  * 
  * When a new vfs_inode_t is created (e.g., by fs1_new_inode ()), its reference count (refcount) 
- * is set to 1. This 1st reference represents the presence of the inode in memory it is in the VFS.
+ * is set to 1. This 1st reference is the one of the creator, and the inode is put in the VFS inode
+ * cache, thus there is a single vfs_inode_t per file.
  *
  * When an inode is actively used (for example by lookup, open, or other operations),
  * the function vfs_inode_get() must be called to increment the refcount.
  * Each user must hold its own reference to the inode while it uses it.
  *
- * Therefore, after fs1_lookup() creates a new inode and calls vfs_inode_get(),
- * the refcount becomes 2:
- *   - One reference for the inode being stored in memory (created).
- *   - One reference for the active usage by the lookup (or open).
+ * Therefore, fs1_lookup() returns an inode with a reference for its caller:
+ *   - either the cached one found by vfs_inode_lookup(), which gets a reference,
+ *   - or a new one created with the reference of the creator.
  *
  * When the user is finished (e.g., after vfs_close()), it must call vfs_inode_release(),
  * decrementing the refcount.
- * When the refcount reaches zero, the inode is automatically freed from memory.
+ * When the refcount reaches zero, the inode stays in the inode cache until it is evicted.
  *
  * This model ensures safe sharing and lifetime management of inodes,
  * without shortcuts or hidden dependencies.
@@ -157,15 +157,9 @@ static vfs_inode_t *fs1_lookup (superblock_t *sb, vfs_inode_t *dir, const char *
         char *curname = vol->entries[i].name;               // get the current name
         if (strncmp (name, curname, FS1_NAME_LEN) == 0) {   // check if name is found
             vfs_inode_t *inode = vfs_inode_lookup (sb, i);  // if yes lookup the vfs_inode
-            if (inode) {                                    // if found
-                vfs_inode_get (inode);                      // incrément it
+            if (inode)                                      // if found, it is referenced
                 return inode;                               // return it
-            }
-            inode = fs1_new_inode (sb, i);                  // if not found create it refcount <- 1
-            if (inode) {                                    // if success 
-                vfs_inode_get (inode);                      // then refcount <- 2
-            }
-            return inode;
+            return fs1_new_inode (sb, i);                   // if not found create it refcount <- 1
         }
     }
     return NULL;
@@ -184,22 +178,40 @@ static errno_t fs1_read (vfs_inode_t *inode, void *buffer, unsigned offset, unsi
 
     unsigned minor = inode->sb->bdev->minor; // see header of fs/vfs.h to get an explanation
 
-    for (unsigned lba = start_lba; lba <= end_lba; lba++) {
-        void *page = blockio_get (minor, lba);
-        if (!page) return copied ? copied : -EIO;
+    for (unsigned lba = start_lba; lba <= end_lba; ) {
+        void *pages[BLOCKIO_MAX_COUNT];                     // get several blocks at once, thus
+        unsigned count = end_lba - lba + 1;                 // they are read in a single transfer
+        if (count > BLOCKIO_MAX_COUNT) count = BLOCKIO_MAX_COUNT;
+        if (blockio_getn (minor, lba, count, pages) != 0) return copied ? copied : -EIO;
 
-        unsigned page_offset = (lba == start_lba) ? lba_offset : 0;
-        unsigned to_copy = BLOCK_SIZE - page_offset;
-        if (to_copy > size - copied) to_copy = size - copied;
+        for (unsigned i = 0; i < count; i++, lba++) {
+            unsigned page_offset = (lba == start_lba) ? lba_offset : 0;
+            unsigned to_copy = BLOCK_SIZE - page_offset;
+            if (to_copy > size - copied) to_copy = size - copied;
 
-        memcpy ((char *)buffer + copied, (char *)page + page_offset, to_copy);
-        copied += to_copy;
+            memcpy ((char *)buffer + copied, (char *)pages[i] + page_offset, to_copy);
+            copied += to_copy;
 
-        blockio_release (page);
+            blockio_release (pages[i]);
+        }
     }
     return copied;
 }
 
+static errno_t fs1_readahead (vfs_inode_t *inode, unsigned offset, unsigned size)
+{
+    fs1_inode_t *ent = inode->data;
+    if (offset >= ent->size) return SUCCESS;
+    if (offset + size > ent->size) size = ent->size - offset;
+    if (size == 0) return SUCCESS;
+
+    unsigned start_lba = ent->lba + offset / BLOCK_SIZE;
+    unsigned end_lba   = ent->lba + (offset + size - 1) / BLOCK_SIZE;
+
+    unsigned minor = inode->sb->bdev->minor;
+    return blockio_readahead (minor, start_lba, end_lba - start_lba + 1);
+}
+
 static errno_t fs1_write (vfs_inode_t *inode, const void *buffer, unsigned offset, unsigned size)
 {
     (void)inode;
@@ -283,6 +295,7 @@ vfs_fs_type_t fs1_ops = {
     .unmount  = fs1_unmount ,   // not used with fs1
     .lookup   = fs1_lookup  ,
     .read     = fs1_read    ,
+    .readahead= fs1_readahead,
     .write    = fs1_write   ,   // not used with fs1
     .create   = fs1_create  ,   // not used with fs1
     .mkdir    = fs1_mkdir   ,   // not used with fs1
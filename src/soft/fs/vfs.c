@@ -65,11 +65,23 @@ void vfs_test(void)
 
 hto_t *Vfs_icache;                                          ///< inode cache
 list_t Vfs_icache_lru;                                      ///< list of not referenced inode 
+hto_t *Vfs_dcache;                                          ///< dentry cache
+list_t Vfs_dcache_lru;                                      ///< all dentries, the most recent first
 
 static int vfs_icache_init (size_t nbentries);              // defined bellow
+static int vfs_dcache_init (size_t nbentries);              // defined bellow
+static void vfs_icache_add_root (superblock_t *sb);         // defined bellow
+static void vfs_dcache_purge (superblock_t *sb);            // defined bellow
+static errno_t vfs_icache_purge (superblock_t *sb);         // defined bellow
 errno_t vfs_init (void)
 {
-    errno_t err = vfs_filesystem_register (&fs1_ops);       // Register the filesystem type first
+    errno_t err = vfs_dcache_init (512);                    // before the first vfs_resolve()
+    if (err != SUCCESS) return err;
+
+    err = vfs_icache_init (512);                            // 509 inodes (must be < 4KiB)
+    if (err != SUCCESS) return err;
+
+    err = vfs_filesystem_register (&fs1_ops);               // Register the filesystem type first
     if (err != SUCCESS && err != -EEXIST) return err;
 
     superblock_t *sb = vfs_superblock_alloc ();             // Create a new superblock
@@ -80,9 +92,6 @@ errno_t vfs_init (void)
 
     err = vfs_mount ("/", sb, bdev, &fs1_ops);              // root '/' fs --> create root inode
     if (err != 0) { kfree (sb); return err; }
-
-    err = vfs_icache_init (512);                            // 509 inodes (must be < 4KiB)
-    if (err != 0) { kfree (sb); return err; }
     
     INFO ("vfs_init: '/' (fs1) successfully mounted on block device 0");
     return SUCCESS;
@@ -220,6 +229,7 @@ static errno_t vfs_mount_register (const char *path, vfs_inode_t *inode, superbl
     vfs_mount_path_set (id, kstrdup(path));                 // register path 
     vfs_mount_inode_set(id, inode);                         // register mnt point inode in parent sb
     vfs_mount_sb_set   (id, sb);                            // register superblock
+    vfs_icache_add_root (sb);                               // its inodes are cached from now
     return id;                                              // success
 }
 
@@ -265,6 +275,7 @@ errno_t vfs_kern_mount (superblock_t *sb, blockdev_t *bdev, const vfs_fs_type_t
 errno_t vfs_kern_unmount (superblock_t *sb)
 {
     if (!sb || !sb->ops || !sb->ops->mount) return -EINVAL; // check arguments validity
+    if (sb->bdev) blockio_sync_bdev (sb->bdev->minor);      // nothing left in the cache to write
     return sb->ops->unmount (sb);                           // Call the fs-specific mount function
 }
 
@@ -284,7 +295,13 @@ errno_t vfs_mount (const char *path, superblock_t *sb, blockdev_t *bdev, const v
 
 errno_t vfs_umount (const char *path)
 {
-    superblock_t *sb = vfs_mount_unregister (path);         // unregister from the Vfs_mount_table
+    mnt_id_t id = vfs_mount_lookup (path);
+    if (id < 0) return -ENOENT;                             // path is not a mount point
+    superblock_t *sb = vfs_mount_sb_get (id);
+    vfs_dcache_purge (sb);                                  // the dentries hold inode references
+    errno_t err = vfs_icache_purge (sb);                    // its mount id will be reused
+    if (err < 0) return err;                                // some of its files are still used
+    sb = vfs_mount_unregister (path);                       // unregister from the Vfs_mount_table
     return vfs_kern_unmount (sb);                           // Call the fs-specific mount function
 }
 
@@ -324,6 +341,8 @@ superblock_t *vfs_mount_resolve (const char *path)
 
 //---------------------------------------------------------------------------- lookup / open / close
 
+static vfs_inode_t *vfs_dentry_resolve (vfs_inode_t *dir, const char *name); // defined bellow
+
 vfs_inode_t *vfs_resolve (vfs_inode_t *base, const char *path)
 {
     ASSERT(V,"base %p path %s", base, path);
@@ -332,7 +351,7 @@ vfs_inode_t *vfs_resolve (vfs_inode_t *base, const char *path)
     superblock_t *sb;
     vfs_inode_t *inode;
 
-    char *path_copy = kmalloc(PAGE_SIZE);                   // allocate temporary buffer
+    char *path_copy = kmalloc_nozero(PAGE_SIZE);            // allocate temporary buffer
     strncpy (path_copy, path, PAGE_SIZE);                   // duplicate path
     path_copy[PAGE_SIZE - 1] = '\0';                        // ensure null-termination
 
@@ -349,18 +368,23 @@ vfs_inode_t *vfs_resolve (vfs_inode_t *base, const char *path)
         sb = base->sb;
         inode = base;
     }
+    vfs_inode_get (inode);                                  // the current inode is referenced
     VAR(%d\n,count);
     for (int i = 0; i < count; ++i) {
         if (parts[i][0] == '\0' || strcmp(parts[i], ".") == 0) continue;  // skip empty or "."
 
-        inode = sb->ops->lookup(sb, inode, parts[i]);       // lookup next component in real FS
+        vfs_inode_t *next = vfs_dentry_resolve (inode, parts[i]);   // dcache, else real FS
+        vfs_inode_release (inode);                          // the directory is no longer used
+        inode = next;
         if (!inode) goto resolve_fail;
 
         vfs_mount_foreach_id(id) {                          // Check if this inode is a mount point
             superblock_t *mnt_sb = vfs_mount_sb_get(id);    // retrieve superblock from mount table
             if (mnt_sb && vfs_mount_inode_get(id) == inode){// match found: inode is a mount root
                 sb = mnt_sb;                                // switch to mounted filesystem
+                vfs_inode_release (inode);                  // the mount point is hidden
                 inode = sb->root;                           // reset to its root
+                vfs_inode_get (inode);
                 break;
             }
         }
@@ -379,9 +403,11 @@ vfs_file_t *vfs_open (vfs_inode_t *base, const char *path)
     if (!inode) return NULL;
     vfs_file_t *file = kmalloc (sizeof(vfs_file_t));        // allocate a new file 
     if (!file) { vfs_inode_release (inode); return NULL; }  
-    vfs_inode_get (inode);                                  // increase refcount because of the file
-    file->inode = inode;                                    // iniatialize file
+    file->inode = inode;                                    // it has the reference of vfs_resolve
     file->offset = 0;                                       // start file access from the beginning
+    file->ra_next = 0;                                      // a first read at 0 is sequential
+    file->ra_window = 0;                                    // nothing read ahead yet
+    file->ra_end = 0;
     return file;                                            // at last, return the new file
 }
 
@@ -406,8 +432,61 @@ vfs_file_t *vfs_opendir (vfs_inode_t *base, const char *path)
     return NULL;
 }
 
+vfs_inode_t *vfs_create (vfs_inode_t *dir, const char *name, mode_t mode)
+{
+    if (!dir || !name || !dir->sb->ops->create) return NULL;
+    vfs_inode_t *inode = dir->sb->ops->create (dir, name, mode);
+    if (inode) vfs_dentry_create (dir, name, inode);        // replaces the negative dentry
+    return inode;
+}
+
+vfs_inode_t *vfs_mkdir (vfs_inode_t *dir, const char *name, mode_t mode)
+{
+    if (!dir || !name || !dir->sb->ops->mkdir) return NULL;
+    vfs_inode_t *inode = dir->sb->ops->mkdir (dir, name, mode);
+    if (inode) vfs_dentry_create (dir, name, inode);        // replaces the negative dentry
+    return inode;
+}
+
+errno_t vfs_unlink (vfs_inode_t *dir, const char *name)
+{
+    if (!dir || !name || !dir->sb->ops->unlink) return -EINVAL;
+    errno_t err = dir->sb->ops->unlink (dir, name);
+    if (err == SUCCESS) vfs_dentry_create (dir, name, NULL);// replaces the positive dentry
+    return err;
+}
+
 //-------------------------------------------------------------------- read / write / seek / readdir
 
+/**
+ * \brief   Adapt the read-ahead window of a file after a read, then read ahead if needed
+ *          A read starting where the previous one stopped is sequential, then the window doubles
+ *          from VFS_RA_MIN to VFS_RA_MAX and the bytes following the read up to the window
+ *          that are not yet read ahead are asked to the real fs. Otherwise, the window is closed.
+ * \param   file    the file just read
+ * \param   start   offset of the read, the file offset is already the end of the read
+ * \return  nothing
+ */
+static void vfs_readahead (vfs_file_t *file, unsigned start)
+{
+    vfs_inode_t *inode = file->inode;
+    if (start != file->ra_next) {                                     // random access
+        file->ra_window = 0;                                          // no more read-ahead
+        file->ra_end = 0;
+    } else {                                                          // sequential access
+        file->ra_window = (file->ra_window) ? 2 * file->ra_window : VFS_RA_MIN;
+        if (file->ra_window > VFS_RA_MAX) file->ra_window = VFS_RA_MAX;
+        unsigned from = (file->ra_end > file->offset) ? file->ra_end : file->offset;
+        unsigned to = file->offset + file->ra_window;                 // end of the window
+        if (to > inode->size) to = inode->size;                       // not beyond end of file
+        if ((from < to) && inode->sb->ops->readahead) {               // something new to read
+            inode->sb->ops->readahead (inode, from, to - from);
+            file->ra_end = to;
+        }
+    }
+    file->ra_next = file->offset;                                     // for the next read
+}
+
 errno_t vfs_read (vfs_file_t *file, void *buffer, size_t size)
 {
     if (!file || !buffer || !size) return -EINVAL;                    // check arguments validity
@@ -417,6 +496,7 @@ errno_t vfs_read (vfs_file_t *file, void *buffer, size_t size)
     int ret = inode->sb->ops->read(inode, buffer, file->offset, size);// Perform the read
     if (ret < 0) return ret;
     file->offset += ret;                                              // Advance the file offset
+    vfs_readahead (file, file->offset - ret);                         // prepare the next read
     return ret;
 }
 
@@ -484,99 +564,365 @@ errno_t vfs_setattr (vfs_inode_t *inode, const struct stat *statbuf)
 // dentry API
 //--------------------------------------------------------------------------------------------------
 
-vfs_dentry_t *vfs_dentry_lookup (vfs_dentry_t *parent, const char *name)
+#define INO_KEY(mnt_id,ino) ((void *)((unsigned long)(((mnt_id << 28)| (ino & 0x0FFFFFFF)) + 1)))
+#define INODE_KEY(inode)    INO_KEY((inode)->sb->mnt_id,(inode)->ino)
+
+#define VFS_DKEY_MAX    64                                  ///< max dentry key length with its 0
+#define VFS_DKEY_DIR    9                                   ///< length of "<dir key>/" in a key
+
+static size_t Vfs_dcache_count;                             ///< number of cached dentries
+static size_t Vfs_dcache_max;                               ///< beyond, the LRU ones are destroyed
+static spinlock_t Vfs_dcache_lock;                          ///< protects Vfs_dcache and its LRU
+
+/**
+ * \brief Initialize dcache
+ * \param nbentries size of the hash table, 3/4 of it can be used to keep the probing short
+ * \return SUCCESS or -ENOMEM, if there is not enough memory
+ */
+static int vfs_dcache_init (size_t nbentries)
 {
-    (void)parent;
-    (void)name;
-    return NULL;
+    Vfs_dcache = hto_create (nbentries, 0);                     // keys are strings
+    if (!Vfs_dcache) return -ENOMEM;                            // impossible to create dcache
+    list_init (&Vfs_dcache_lru);                                // no dentry yet
+    Vfs_dcache_count = 0;
+    Vfs_dcache_max = nbentries - nbentries / 4;
+    return SUCCESS;
 }
 
-vfs_dentry_t *vfs_dentry_create (vfs_dentry_t *parent, const char *name, vfs_inode_t *inode)
+/**
+ * \brief Build the dcache key of a name in a directory: the key of the directory inode
+ *        (mount id and ino) in VFS_DKEY_DIR-1 hex digits, a '/', then the name.
+ * \param key  buffer of VFS_DKEY_MAX chars
+ * \param dir  directory inode
+ * \param name entry name
+ * \return 1 on success, 0 if the name is too long to be cached
+ */
+static int vfs_dentry_key (char *key, vfs_inode_t *dir, const char *name)
 {
-    (void)parent;
-    (void)name;
-    (void)inode;
-    return NULL;
+    int len = strlen (name);
+    if (len >= VFS_DKEY_MAX - VFS_DKEY_DIR) return 0;           // no room for the name
+    unsigned dkey = (unsigned long) INODE_KEY (dir);
+    for (int i = VFS_DKEY_DIR - 2; i >= 0; i--, dkey >>= 4)     // fixed length, thus "12/3" and
+        key[i] = "0123456789abcdef"[dkey & 0xF];                // "1/23" cannot be the same key
+    key[VFS_DKEY_DIR - 1] = '/';
+    memcpy (key + VFS_DKEY_DIR, name, len + 1);                 // with the ending 0
+    return 1;
+}
+
+/**
+ * \brief Find a dentry in the dcache, it becomes the most recently used one.
+ *        Vfs_dcache_lock is held.
+ * \param key dcache key built by vfs_dentry_key()
+ * \return the dentry or NULL if the key is not cached
+ */
+static vfs_dentry_t *vfs_dcache_find (char *key)
+{
+    vfs_dentry_t *dentry = hto_get (Vfs_dcache, key);
+    if (dentry) {
+        list_unlink (&dentry->lru);                             // move it to the head of the lru
+        list_addfirst (&Vfs_dcache_lru, &dentry->lru);
+    }
+    return dentry;
+}
+
+/**
+ * \brief Release the inode of a dentry and free it, the dentry is no longer in the dcache
+ * \param dentry the dentry
+ */
+static void vfs_dentry_free (vfs_dentry_t *dentry)
+{
+    if (dentry->inode)                                          // not a negative dentry
+        vfs_inode_release (dentry->inode);
+    kfree (dentry);
+}
+
+/**
+ * \brief Remove a dentry from the dcache, Vfs_dcache_lock is held.
+ * \param dentry the dentry
+ */
+static void vfs_dcache_remove (vfs_dentry_t *dentry)
+{
+    hto_del (Vfs_dcache, dentry->key);
+    list_unlink (&dentry->lru);
+    Vfs_dcache_count--;
+}
+
+/**
+ * \brief Insert a dentry into the dcache, its key must not be there. If the cache is full,
+ *        the least recently used dentries are destroyed to make room. Vfs_dcache_lock is held.
+ * \param dentry the new dentry
+ */
+static void vfs_dcache_insert (vfs_dentry_t *dentry)
+{
+    while ((Vfs_dcache_count >= Vfs_dcache_max)                 // too many dentries
+    ||     (hto_set (Vfs_dcache, dentry->key, dentry) < 0)) {   // or the hash table is full
+        list_t *victim = list_last (&Vfs_dcache_lru);           // then the lru is destroyed
+        PANIC_IF (!victim, "dcache full: no dentry to reclaim");
+        vfs_dentry_t *lru = list_item (victim, vfs_dentry_t, lru);
+        vfs_dcache_remove (lru);
+        vfs_dentry_free (lru);
+    }
+    list_addfirst (&Vfs_dcache_lru, &dentry->lru);              // the most recently used
+    Vfs_dcache_count++;
+}
+
+/**
+ * \brief Resolve a name in a directory with the dcache, the real fs lookup() is called on a miss
+ *        only, then its result is cached, even if the name does not exist (negative dentry).
+ * \param dir  directory inode
+ * \param name entry name
+ * \return the inode with a reference for the caller, or NULL if the name does not exist
+ */
+static vfs_inode_t *vfs_dentry_resolve (vfs_inode_t *dir, const char *name)
+{
+    char key[VFS_DKEY_MAX];
+    vfs_inode_t *inode;
+    if (vfs_dentry_key (key, dir, name)) {
+        spin_lock (&Vfs_dcache_lock);                           // !--! critical section
+        vfs_dentry_t *dentry = vfs_dcache_find (key);
+        if (dentry) {                                           // hit, the real fs is not called
+            inode = dentry->inode;                              // NULL for a negative dentry
+            if (inode) vfs_inode_get (inode);                   // before the dentry is destroyed
+            spin_unlock (&Vfs_dcache_lock);                     // !--! end of critical section
+            return inode;
+        }
+        spin_unlock (&Vfs_dcache_lock);                         // !--! end of critical section
+    }
+    superblock_t *sb = dir->sb;
+    inode = sb->ops->lookup (sb, dir, name);                    // miss, lookup in the real fs
+    vfs_dentry_create (dir, name, inode);                       // for the next time, if possible
+    return inode;
+}
+
+vfs_dentry_t *vfs_dentry_lookup (vfs_inode_t *dir, const char *name)
+{
+    char key[VFS_DKEY_MAX];
+    if (!dir || !name || !vfs_dentry_key (key, dir, name)) return NULL;
+    spin_lock (&Vfs_dcache_lock);                               // !--! critical section
+    vfs_dentry_t *dentry = vfs_dcache_find (key);
+    spin_unlock (&Vfs_dcache_lock);                             // !--! end of critical section
+    return dentry;
+}
+
+vfs_dentry_t *vfs_dentry_create (vfs_inode_t *dir, const char *name, vfs_inode_t *inode)
+{
+    char key[VFS_DKEY_MAX];
+    if (!dir || !name || !vfs_dentry_key (key, dir, name)) return NULL;
+    int len = strlen (key) + 1;                                 // key with its ending 0
+    vfs_dentry_t *dentry = kmalloc_nozero (sizeof (vfs_dentry_t) + len);
+    if (!dentry) return NULL;
+    dentry->inode = inode;
+    dentry->dir = dir;
+    dentry->name = dentry->key + VFS_DKEY_DIR;                  // the name is the end of the key
+    memcpy (dentry->key, key, len);
+    if (inode) vfs_inode_get (inode);                           // the dentry keeps its inode
+
+    spin_lock (&Vfs_dcache_lock);                               // !--! critical section
+    vfs_dentry_t *old = hto_get (Vfs_dcache, key);              // created meanwhile or outdated
+    if (old) vfs_dcache_remove (old);                           // it is replaced
+    vfs_dcache_insert (dentry);
+    spin_unlock (&Vfs_dcache_lock);                             // !--! end of critical section
+    if (old) vfs_dentry_free (old);
+    return dentry;
 }
 
 void vfs_dentry_destroy (vfs_dentry_t *dentry)
 {
-    (void)dentry;
+    if (!dentry) return;
+    spin_lock (&Vfs_dcache_lock);                               // !--! critical section
+    vfs_dcache_remove (dentry);
+    spin_unlock (&Vfs_dcache_lock);                             // !--! end of critical section
+    vfs_dentry_free (dentry);
+}
+
+/**
+ * \brief Get the mount id of the directory of a dentry from its key, since the directory inode
+ *        is not referenced by the dentry and it may be evicted.
+ * \param dentry the dentry
+ * \return the mount id of its directory
+ */
+static mnt_id_t vfs_dentry_mnt_id (vfs_dentry_t *dentry)
+{
+    unsigned dkey = 0;
+    for (int i = 0; i < VFS_DKEY_DIR - 1; i++) {                // the hex digits of INODE_KEY(dir)
+        char c = dentry->key[i];
+        dkey = (dkey << 4) | ((c <= '9') ? c - '0' : c - 'a' + 10);
+    }
+    return (dkey - 1) >> 28;                                    // see INO_KEY()
+}
+
+/**
+ * \brief Destroy all the dentries of a file system, those of its directories (negative ones too)
+ *        and those of its inodes, for vfs_umount() before its mount id is reused.
+ * \param sb the superblock of the file system, still registered
+ */
+static void vfs_dcache_purge (superblock_t *sb)
+{
+    list_t purged;                                              // dentries removed from the dcache
+    list_init (&purged);
+    spin_lock (&Vfs_dcache_lock);                               // !--! critical section
+    list_foreach (&Vfs_dcache_lru, item) {                      // all the dentries are in the lru
+        vfs_dentry_t *dentry = list_item (item, vfs_dentry_t, lru);
+        if ((vfs_dentry_mnt_id (dentry) != sb->mnt_id)          // not in a directory of sb
+        &&  (!dentry->inode || (dentry->inode->sb != sb)))      // nor an inode of sb
+            continue;
+        vfs_dcache_remove (dentry);
+        list_addlast (&purged, &dentry->lru);
+    }
+    spin_unlock (&Vfs_dcache_lock);                             // !--! end of critical section
+    list_t *first;
+    while ((first = list_getfirst (&purged)) != NULL)           // their inodes are released
+        vfs_dentry_free (list_item (first, vfs_dentry_t, lru));
 }
 
 //--------------------------------------------------------------------------------------------------
 // inode API
 //--------------------------------------------------------------------------------------------------
 
-#define INO_KEY(mnt_id,ino) ((void *)((unsigned long)((mnt_id << 28)| (ino & 0x0FFFFFFF))))
-#define INODE_KEY(inode)    INO_KEY((inode)->sb->mnt_id,(inode)->ino)
+static size_t Vfs_icache_count;                             ///< number of cached inodes
+static size_t Vfs_icache_max;                               ///< beyond, the LRU inodes are evicted
+static spinlock_t Vfs_icache_lock;                          ///< protects Vfs_icache and its LRU
 
 /**
  * \brief Initialize icache
- * \param nbentries maximum number of working inodes
+ *        An inode of a registered superblock is in the icache from its creation to its eviction,
+ *        thus each file has a single vfs_inode. When its refcount becomes 0, it stays in the
+ *        icache, in the LRU list, until it is used again or evicted to make room.
+ * \param nbentries size of the hash table, 3/4 of it can be used to keep the probing short
  * \return SUCCESS or -ENOMEM, if there is not enough memory
- * FIXME improve comments
  */
 static int vfs_icache_init (size_t nbentries) 
 {
     Vfs_icache = hto_create (nbentries, 1);                     // max inodes 
     if (!Vfs_icache) return -ENOMEM;                            // impossible to create icache
     list_init (&Vfs_icache_lru);                                // initialize releasable inode list
+    Vfs_icache_count = 0;
+    Vfs_icache_max = nbentries - nbentries / 4;
     return SUCCESS;                                             // success
 }
     
 /**
  * \brief Evict a VFS inode and release all associated resources.
  *        This function must only be called for inodes with refcount == 0,
- *        and after they have been removed from the inode cache.
- *        It releases:
- *        - the filesystem-specific data (via fs->destroy_inode),
+ *        it removes them from the inode cache and the LRU list, then it releases:
+ *        - the filesystem-specific data (via fs->evict),
  *        - the file mapping if any (e.g. directory entries, page cache),
  *        - and the inode structure itself.
+ *        Vfs_icache_lock is held.
  * \param inode Pointer to the vfs_inode_t to destroy.
+ */
 static void vfs_icache_evict (vfs_inode_t *inode)
 {
-    if (!inode) return;
     PANIC_IF (inode->refcount, "inode still referenced");
     hto_del (Vfs_icache, INODE_KEY(inode)); 
-    inode->sb->ops->evict (inode);                          // Call the fs-specific destroy fun
-    if (inode->mapping)                                     // Destroy file mapping if present
-        vfs_mapping_destroy (inode);                // To be implemented
-    // TODO: release associated dentries when dentry cache is implemented
-    // Free the inode itself
-    kfree(inode);
+    list_unlink (&inode->list);                                 // from the LRU list
+    Vfs_icache_count--;
+    if (inode->sb->ops->evict)
+        inode->sb->ops->evict (inode);                          // Call the fs-specific evict fun
+    if (inode->mapping)                                         // Destroy file mapping if present
+        vfs_mapping_destroy (inode);                            // To be implemented
+    kfree (inode);                                              // Free the inode itself
 }
- */
 
 /**
  * \brief Insert an inode into the global VFS inode cache.
  *        If the cache is full, this function evicts the oldest unused inode (refcount == 0) 
- *        from the LRU list to make space. The victim is removed from the cache and is eviscted
- *        with vfs_inode_evict(). The given inode is inserted or the system panics.
- * \param inode Pointer to the vfs_inode_t to insert.
-static void vfs_icache_insert(vfs_inode_t *inode)
+ *        from the LRU list to make space, with vfs_icache_evict(). If all the cached inodes
+ *        are used, the hash table grows or the system panics. Vfs_icache_lock is held.
+ * \param inode Pointer to the vfs_inode_t to insert, its key must not be in the cache.
+ */
+static void vfs_icache_insert (vfs_inode_t *inode)
 {
     void *key = INODE_KEY(inode);
-    while (hto_set (Vfs_icache, key, inode) < 0) {              // try to insert the inode
-        list_t *victim = list_getlast (&Vfs_icache_lru);        // if no space, get the lru
-        PANIC_IF (!victim, "icache full: no evictable inode");  // too much file/dir openened
-        list_unlink (victim);                                   // unlink victim from the lru list
-        vfs_inode_t *inode = list_item(victim,vfs_inode_t,list);// retreive inode from list pointer
-        vfs_icache_evict (inode);                               // remove that inode from icache 
+    while ((Vfs_icache_count >= Vfs_icache_max)                 // too many inodes
+    ||     (hto_set (Vfs_icache, key, inode) < 0)) {            // or the hash table is full
+        list_t *victim = list_last (&Vfs_icache_lru);           // if no space, get the lru
+        if (victim) {
+            vfs_icache_evict (list_item (victim, vfs_inode_t, list));
+            continue;
+        }
+        PANIC_IF (!hto_rehash (&Vfs_icache, 200),               // all inodes are used
+            "icache full: no evictable inode");                 // too much file/dir openened
+        Vfs_icache_max *= 2;
     }
+    Vfs_icache_count++;
 }
- */
 
 /**
- * \brief Lookup an inode in the VFS inode cache.
+ * \brief Lookup an inode in the VFS inode cache, it gets a reference. Vfs_icache_lock is held.
  * \param sb  Pointer to the superblock where the inode should belong.
  * \param ino Index of the inode to search for.
  * \return Pointer to the vfs_inode_t if found, NULL otherwise.
-static vfs_inode_t *vfs_icache_lookup(superblock_t *sb, ino_t ino)
+ */
+static vfs_inode_t *vfs_icache_lookup (superblock_t *sb, ino_t ino)
 {
-    return hto_get (Vfs_icache, INO_KEY(sb->mnt_id, ino));         
+    vfs_inode_t *inode = hto_get (Vfs_icache, INO_KEY(sb->mnt_id, ino));
+    if (inode && (atomic_fetch_add ((int *)&inode->refcount, 1) == 0))
+        list_unlink (&inode->list);                             // used again, thus not evictable
+    return inode;
 }
+
+/**
+ * \brief Insert the root inode of a superblock into the icache, when the superblock is
+ *        registered, because its mount id is not known when its root inode is created.
+ * \param sb  Pointer to the registered superblock.
  */
+static void vfs_icache_add_root (superblock_t *sb)
+{
+    spin_lock (&Vfs_icache_lock);                               // !--! critical section
+    if (hto_get (Vfs_icache, INODE_KEY(sb->root)) == NULL)
+        vfs_icache_insert (sb->root);
+    spin_unlock (&Vfs_icache_lock);                             // !--! end of critical section
+}
+
+/**
+ * \brief hto_foreach() callbacks of vfs_icache_purge(), the first one counts the used inodes of
+ *        the superblock (its root is used by the superblock itself), the second one removes all
+ *        its inodes from the icache. Vfs_icache_lock is held.
+ */
+struct vfs_icache_purge_s {
+    superblock_t *sb;                                       ///< superblock to purge
+    int busy;                                               ///< number of used inodes
+};
+
+static void vfs_icache_busy (hto_t *ht, unsigned pos, void *key, void *val, void *data)
+{
+    struct vfs_icache_purge_s *purge = data;
+    vfs_inode_t *inode = val;
+    if ((inode->sb == purge->sb) && (inode->refcount > ((inode == purge->sb->root) ? 1 : 0)))
+        purge->busy++;
+}
+
+static void vfs_icache_remove (hto_t *ht, unsigned pos, void *key, void *val, void *data)
+{
+    struct vfs_icache_purge_s *purge = data;
+    vfs_inode_t *inode = val;
+    if (inode->sb != purge->sb) return;
+    if (inode->refcount == 0) {                             // in the LRU list
+        vfs_icache_evict (inode);
+    } else {                                                // the root, it is no longer cached
+        hto_del (ht, key);                                  // thus its last release frees it
+        Vfs_icache_count--;
+    }
+}
+
+/**
+ * \brief Remove all the inodes of a superblock from the icache, for vfs_umount() before its mount
+ *        id is reused. Its dentries must have been destroyed before, since they hold references.
+ * \param sb the superblock, still registered
+ * \return SUCCESS, or -EBUSY if some of its inodes are still used (opened files), then the icache
+ *         is not changed.
+ */
+static errno_t vfs_icache_purge (superblock_t *sb)
+{
+    struct vfs_icache_purge_s purge = { .sb = sb, .busy = 0 };
+    spin_lock (&Vfs_icache_lock);                           // !--! critical section
+    hto_foreach (Vfs_icache, vfs_icache_busy, &purge);
+    if (purge.busy == 0)
+        hto_foreach (Vfs_icache, vfs_icache_remove, &purge);
+    spin_unlock (&Vfs_icache_lock);                         // !--! end of critical section
+    return (purge.busy) ? -EBUSY : SUCCESS;
+}
 
 vfs_inode_t *vfs_inode_create (superblock_t *sb, ino_t ino, size_t size, mode_t mode, void *data)
 {
@@ -592,25 +938,53 @@ vfs_inode_t *vfs_inode_create (superblock_t *sb, ino_t ino, size_t size, mode_t
     inode->mapping = NULL;
     inode->dentries = NULL;
     list_init (&inode->list);
+    if (sb->mnt_id < 0)                                     // unregistered superblock, no mnt_id
+        return inode;                                       // thus it cannot be cached
+
+    spin_lock (&Vfs_icache_lock);                           // !--! critical section
+    vfs_inode_t *cached = vfs_icache_lookup (sb, ino);      // created meanwhile by another CPU
+    if (cached == NULL)
+        vfs_icache_insert (inode);
+    spin_unlock (&Vfs_icache_lock);                         // !--! end of critical section
+    if (cached) {                                           // a single inode per file
+        kfree (inode);
+        inode = cached;
+    }
     return inode;
 }
 
 vfs_inode_t *vfs_inode_lookup (superblock_t *sb, ino_t ino) 
 {
-    return NULL;
+    if (sb->mnt_id < 0) return NULL;                        // unregistered superblock
+    spin_lock (&Vfs_icache_lock);                           // !--! critical section
+    vfs_inode_t *inode = vfs_icache_lookup (sb, ino);
+    spin_unlock (&Vfs_icache_lock);                         // !--! end of critical section
+    return inode;
 }
 
-void vfs_inode_get (vfs_inode_t *inode)                     // FIXME : should be atomic
+void vfs_inode_get (vfs_inode_t *inode)
 {
-    inode->refcount++;                                      // there is another reference
+    atomic_fetch_add ((int *)&inode->refcount, 1);          // there is another reference
 }
 
 void vfs_inode_release(vfs_inode_t *inode)
 {
     if (!inode) return;
-    PANIC_IF (inode->refcount == 0, "refcount already 0");
-    if (--(inode->refcount) == 0)                           // decrement ref nb, if 0 then
-        list_addfirst (&Vfs_icache_lru, &inode->list);      // add inode to the releasable inodes
+    for (;;) {                                              // not the last reference: lock free
+        int refcount = inode->refcount;
+        PANIC_IF (refcount == 0, "refcount already 0");
+        if (refcount == 1) break;
+        if (atomic_cas ((int *)&inode->refcount, refcount, refcount - 1) == refcount) return;
+    }
+    spin_lock (&Vfs_icache_lock);                           // !--! critical section
+    int refcount = atomic_fetch_add ((int *)&inode->refcount, -1); // decrement ref nb
+    if (refcount == 1) {                                    // if it was the last one, then
+        if (hto_get (Vfs_icache, INODE_KEY(inode)) == inode)// add inode to the releasable inodes
+            list_addfirst (&Vfs_icache_lru, &inode->list);
+        else                                                // not cached (unregistered sb),
+            kfree (inode);                                  // thus no longer used at all
+    }
+    spin_unlock (&Vfs_icache_lock);                         // !--! end of critical section
 }
 
 /*------------------------------------------------------------------------------------------------*\
@@ -89,12 +89,17 @@ typedef struct superblock_s {
 
 /**
  * \brief VFS Directory Entry (dentry) structure.
- *        Associates a name (component of a path) to a vfs_inode_t.
+ *        Associates a name (component of a path) in a directory to a vfs_inode_t.
+ *        The dentries are in the dentry cache, a hash table keyed by (directory, name),
+ *        thus a path already resolved is resolved again without calling the real fs.
+ *        A negative dentry (inode == NULL) tells that the name does not exist.
  */
 typedef struct vfs_dentry_s {
-    struct vfs_inode_s  *inode;         ///< Associated inode
-    struct vfs_dentry_s *parent;        ///< Parent dentry
-    char name[];                        ///< Flexible array member for the entry name
+    struct vfs_inode_s  *inode;         ///< Associated inode (referenced), NULL if negative
+    struct vfs_inode_s  *dir;           ///< Parent directory inode (not referenced, may be evicted)
+    list_t              lru;            ///< element of the dentry cache LRU list
+    char                *name;          ///< Entry name, it is the end of key[]
+    char key[];                         ///< Flexible array member for "<dir key>/<name>"
 } vfs_dentry_t;
 
 /**
@@ -110,9 +115,11 @@ typedef struct vfs_dentry_s {
  *        A VFS inode stores metadata about a file or directory,
  *        such as its size, type, permissions, and a pointer to the real
  *        filesystem-specific inode structure.
- * \note  Each vfs_inode_t starts with refcount = 1 when created.
+ * \note  Each vfs_inode_t starts with refcount = 1 when created, that is the creator's reference.
  *        vfs_inode_get () must be called to hold an additional reference for active usage.
- *        vfs_inode_release () decrements the refcount, freeing the inode when it reaches zero.
+ *        vfs_inode_release () decrements the refcount, when it reaches zero, the inode stays in
+ *        the inode cache (icache) until it is used again or evicted to make room.
+ *        There is a single vfs_inode_t per file, thus the icache is looked up before to create one.
  */
 typedef struct vfs_inode_s {
     superblock_t *sb;                   ///< Filesystem this inode belongs to
@@ -137,9 +144,15 @@ typedef struct vfs_inode_s {
 typedef struct vfs_file_s {
     vfs_inode_t *inode;                 ///< vfs inode of the open file 
     unsigned offset;                    ///< current offset read/write position in file or directory
+    unsigned ra_next;                   ///< offset following the last read (sequential if equal)
+    unsigned ra_window;                 ///< read-ahead window size in bytes (0 if random access)
+    unsigned ra_end;                    ///< offset following the last byte already read ahead
     void *data;                         ///< Optional opaque pointer for FS-specific state
 } vfs_file_t;
 
+#define VFS_RA_MIN  (2*PAGE_SIZE)       ///< first read-ahead window of a sequential reader
+#define VFS_RA_MAX  (8*PAGE_SIZE)       ///< the window doubles at each sequential read up to MAX
+
 /**
  * \brief Represents a single entry in a directory listing.
  *        This structure describes a file or subdirectory inside a directory,
@@ -200,9 +213,10 @@ superblock_t *vfs_superblock_alloc (void);
 errno_t vfs_mount (const char *path, superblock_t *sb, blockdev_t *bdev, const vfs_fs_type_t *ops);
 
 /**
- * \brief Unmount a filesystem from its block device.
+ * \brief Unmount a filesystem from its block device, its dentries and inodes are purged from
+ *        the caches before its mount id can be reused.
  * \param path  path name of the file system to unmount.
- * \return 0 on success, or a negative error code.
+ * \return 0 on success, -EBUSY if some of its files are still used, or a negative error code.
  */
 errno_t vfs_umount (const char *path);
 
@@ -242,10 +256,10 @@ superblock_t *vfs_mount_resolve (const char *path);
 /**
  * \brief Resolve a relative path within a filesystem, starting from a directory inode.
  *        This function splits the path into components and resolves each of them
- *        using the filesystem's `lookup()` operation.
+ *        in the dentry cache, the filesystem's `lookup()` operation is called on a miss only.
  * \param dir  The starting directory inode.
  * \param path A relative path (e.g., "foo/bar/baz").
- * \return Pointer to the resolved inode, or NULL on failure.
+ * \return Pointer to the resolved inode with a reference for the caller, or NULL on failure.
  */
 vfs_inode_t *vfs_resolve (vfs_inode_t *dir, const char *path);
 
@@ -276,6 +290,26 @@ vfs_file_t *vfs_opendir (vfs_inode_t *base, const char *path);
 */
 void vfs_closedir (vfs_file_t *dir);
 
+/**
+ * \brief Create a regular file (resp. a directory) in a directory with the real fs create()
+ *        (resp. mkdir()) operation, the negative dentry of the name is replaced.
+ * \param dir  Parent directory inode.
+ * \param name Name of the new entry.
+ * \param mode Permission and type of the new entry.
+ * \return the new inode with a reference for the caller, or NULL on failure.
+ */
+vfs_inode_t *vfs_create (vfs_inode_t *dir, const char *name, mode_t mode);
+vfs_inode_t *vfs_mkdir (vfs_inode_t *dir, const char *name, mode_t mode);
+
+/**
+ * \brief Remove a name from a directory with the real fs unlink() operation,
+ *        the positive dentry of the name is replaced by a negative one.
+ * \param dir  Parent directory inode.
+ * \param name Name of the entry to remove.
+ * \return 0 on success, or a negative error code.
+ */
+errno_t vfs_unlink (vfs_inode_t *dir, const char *name);
+
 //-------------------------------------------------------------------- read / write / seek / readdir
 
 /**
@@ -348,6 +382,7 @@ errno_t vfs_setattr (vfs_inode_t *inode, const struct stat *statbuf);
  *  unmount   Unmount the filesystem and release its resources.
  *  lookup    Lookup a file or directory name in a parent directory.
  *  read      Read data from a file stored in the real file system.
+ *  readahead Start reading file data that will be probably read soon (optional).
  *  write     Write data to a file stored in the filesystem.
  *  create    Create a new regular file in the directory.
  *  mkdir     Create a new directory.
@@ -409,6 +444,17 @@ struct vfs_fs_type_s {
      */
     errno_t (*read)(vfs_inode_t *inode, void *buffer, unsigned offset, unsigned size);
 
+    /**
+     * \brief  Start reading file data into the block cache without waiting for them.
+     *         It is called by vfs_read() for sequential readers, it may be NULL.
+     * \param  inode  Pointer to the VFS inode representing the file.
+     * \param  offset Offset in bytes from the beginning of the file.
+     * \param  size   Number of bytes to read ahead.
+     * \return 0 on success, or a negative error code.
+     * \note   fs1 : fs1_readahead
+     */
+    errno_t (*readahead)(vfs_inode_t *inode, unsigned offset, unsigned size);
+
     /**
      * \brief  Write data to a file stored in the filesystem.
      * \param  inode  Pointer to the VFS inode representing the file.
@@ -491,24 +537,30 @@ struct vfs_fs_type_s {
 //--------------------------------------------------------------------------------------------------
 
 /**
- * \brief Lookup a dentry by name in a directory.
- * \param parent Parent directory dentry.
+ * \brief Lookup a dentry by name in a directory, in the dentry cache only.
+ *        The dentry found becomes the most recently used one.
+ * \param dir    Parent directory inode.
  * \param name   Name of the file or directory.
- * \return Pointer to the vfs_dentry_t if found, NULL otherwise.
+ * \return Pointer to the vfs_dentry_t if found (its inode is NULL if it is a negative dentry),
+ *         NULL if the name is not in the cache.
  */
-vfs_dentry_t *vfs_dentry_lookup (vfs_dentry_t *parent, const char *name);
-
-/**
- * \brief Create a new dentry under a parent directory.
- * \param parent Parent directory dentry.
- * \param name   Nam:e of the new entry.
- * \param inode  Associated inode.
- * \return Pointer to the newly created vfs_dentry_t.
+vfs_dentry_t *vfs_dentry_lookup (vfs_inode_t *dir, const char *name);
+
+/**
+ * \brief Create a new dentry under a parent directory and put it in the dentry cache.
+ *        If the cache is full, the least recently used dentries are destroyed.
+ * \param dir    Parent directory inode.
+ * \param name   Name of the new entry.
+ * \param inode  Associated inode, it gets a reference, or NULL for a negative dentry.
+ * \return Pointer to the newly created vfs_dentry_t, or NULL if there is no memory or if the name
+ *         is too long to be cached.
+ * \note  A real fs operation which creates (resp. removes) a name must replace its negative
+ *        (resp. positive) dentry, as vfs_create(), vfs_mkdir() and vfs_unlink() do.
  */
-vfs_dentry_t *vfs_dentry_create (vfs_dentry_t *parent, const char *name, vfs_inode_t *inode);
+vfs_dentry_t *vfs_dentry_create (vfs_inode_t *dir, const char *name, vfs_inode_t *inode);
 
 /**
- * \brief Destroy a dentry and free its resources.
+ * \brief Destroy a dentry, remove it from the dentry cache and release its inode.
  * \param dentry Pointer to the dentry to destroy.
  */
 void vfs_dentry_destroy (vfs_dentry_t *dentry);
@@ -518,13 +570,15 @@ void vfs_dentry_destroy (vfs_dentry_t *dentry);
 //--------------------------------------------------------------------------------------------------
 
 /**
- * \brief Creater and initialize the given inode
+ * \brief Creater and initialize the given inode, then put it in the inode cache
  * \param sb    Pointer to the superblock where the inode should belong.
  * \param ino   Index of the inode to search for.
  * \param size  file size
  * \param mode  file mode : permission and type
  * \param data  file private data (depends on real file system)
- * \return Pointer to the newly created vfs_inode_t.
+ * \return Pointer to the newly created vfs_inode_t with a reference for the caller, or the cached
+ *         one if it has been created meanwhile by another CPU, NULL if there is no memory.
+ * \note  The inodes of an unregistered superblock (vfs_kern_mount()) are not cached.
  */
 vfs_inode_t *vfs_inode_create (superblock_t *sb, ino_t ino, size_t size, mode_t mode, void *data);
 
@@ -532,18 +586,20 @@ vfs_inode_t *vfs_inode_create (superblock_t *sb, ino_t ino, size_t size, mode_t
  * \brief Lookup an inode in the VFS inode cache.
  * \param sb  Pointer to the superblock where the inode should belong.
  * \param ino Index of the inode to search for.
- * \return Pointer to the vfs_inode_t if found, NULL otherwise.
+ * \return Pointer to the vfs_inode_t with a reference for the caller if found, NULL otherwise.
  */
 vfs_inode_t *vfs_inode_lookup (superblock_t *sb, ino_t ino);
 
 /**
  * \brief Increment the reference count of an inode.
- * \param inode Pointer to the inode whose reference count is incremented.
+ * \param inode Pointer to the inode whose reference count is incremented, the caller must
+ *        already hold a reference (otherwise, it gets the inode with vfs_inode_lookup()).
  */
 void vfs_inode_get (vfs_inode_t *inode);
 
 /**
- * \brief Decrement the reference count of an inode and free it if it reaches zero.
+ * \brief Decrement the reference count of an inode, if it reaches zero, the inode becomes
+ *        evictable from the inode cache (it is freed at once if it is not cached).
  * \param inode Pointer to the inode whose reference count is decremented.
  */
 void vfs_inode_release (vfs_inode_t *inode);
@@ -17,18 +17,26 @@
  * Same as for the IRQs and some drivers, the function here
  * are marked extern because they need to be implemented at some
  * point by a platform-specific file
+ * The atomic_*() functions are implemented twice, by atomic.S for the kernel and by cpu_user.S
+ * for the user (ulib), the locks are for the kernel only.
+ * All the atomic operations are full barriers, the memory accesses are not moved across them
+ * (a sync before and after the ll/sc loop on MIPS, the aq and rl bits on RISC-V).
  */
 
 /**
  * It's a simple word, but it is forbidden to read it directly to not copy it in cache
+ * It is 0 when it is free, thus a zeroed structure has free locks. By default, it is a ticket lock
+ * (16 MSB next ticket, 16 LSB ticket served), fair and with a backoff proportional to the number
+ * of waiting CPUs, it is a test-and-set lock if atomic.S is compiled with -DSPINLOCK_TAS.
  */
 typedef unsigned spinlock_t;
 
 /** 
  * \brief   get the lock, block until success
  * \param   lock blocking function until lock is free 
+ * \return  number of polls of the lock before getting it, thus 0 without contention
  */
-extern void spin_lock (spinlock_t * lock);
+extern unsigned spin_lock (spinlock_t * lock);
 
 /** 
  * \brief   release the lock 
@@ -36,6 +44,28 @@ extern void spin_lock (spinlock_t * lock);
  */
 extern void spin_unlock (spinlock_t * lock);
 
+/**
+ * \brief   contention statistics of a lock, updated by spin_lock_stat() while the lock is held
+ */
+typedef struct spinstat_s {
+    unsigned    acquired;       ///< number of acquisitions
+    unsigned    contended;      ///< number of acquisitions which had to wait
+    unsigned    polls;          ///< total number of polls while waiting
+} spinstat_t;
+
+/**
+ * \brief   same as spin_lock() but the contention is counted in stat, which is protected by lock
+ * \param   lock the lock
+ * \param   stat its statistics
+ */
+static inline void spin_lock_stat (spinlock_t * lock, spinstat_t * stat)
+{
+    unsigned polls = spin_lock (lock);
+    stat->acquired++;
+    stat->contended += (polls != 0);
+    stat->polls += polls;
+}
+
 /** 
  * \brief   add a value to the pointed value, block until success
  * \param   counter pointer to change
@@ -44,4 +74,63 @@ extern void spin_unlock (spinlock_t * lock);
  */
 extern int atomic_add (int * counter, int val);
 
+/**
+ * \brief   compare and swap, the pointed value is replaced by new only if it is equal to old
+ * \param   var pointer to the value
+ * \param   old expected value
+ * \param   new value to store
+ * \return  the value read, thus the swap is done iff the returned value is old
+ */
+extern int atomic_cas (int * var, int old, int new);
+
+/**
+ * \brief   exchange the pointed value with a new value, block until success
+ * \param   var pointer to the value
+ * \param   new value to store
+ * \return  the previous value
+ */
+extern int atomic_xchg (int * var, int new);
+
+/**
+ * \brief   add a value to the pointed value, block until success
+ * \param   var pointer to the value
+ * \param   val value to add
+ * \return  the previous value (atomic_add() returns the new one)
+ */
+extern int atomic_fetch_add (int * var, int val);
+
+/**
+ * \brief   bitwise and of the pointed value with a mask, block until success
+ * \param   var pointer to the value
+ * \param   mask bits to keep
+ * \return  the previous value
+ */
+extern int atomic_fetch_and (int * var, int mask);
+
+/**
+ * \brief   bitwise or of the pointed value with a mask, block until success
+ * \param   var pointer to the value
+ * \param   mask bits to set
+ * \return  the previous value
+ */
+extern int atomic_fetch_or (int * var, int mask);
+
+/**
+ * \brief   memory barrier, the accesses before are done before the accesses after
+ *          (sync on MIPS, fence rw,rw on RISC-V)
+ */
+extern void atomic_mb (void);
+
+/**
+ * \brief   read memory barrier, the reads before are done before the reads after
+ *          (sync on MIPS, fence r,r on RISC-V)
+ */
+extern void atomic_rmb (void);
+
+/**
+ * \brief   write memory barrier, the writes before are done before the writes after
+ *          (sync on MIPS, fence w,w on RISC-V), e.g. to publish a structure after its filling
+ */
+extern void atomic_wmb (void);
+
 #endif
\ No newline at end of file
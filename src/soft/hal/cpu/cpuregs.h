@@ -23,9 +23,17 @@
  */
 extern unsigned clock (void);
 
+#define NCPUS_MAX   8   ///< maximum number of CPUs (almo1-mips can have up to 8 CPUs)
+
 /** \brief  cpu identifier
  *  \return the current cpu identifier from 0 to NCPUS-1
  */
 extern unsigned cpuid (void);
 
+/** \brief  count leading zeros
+ *  \param  x a 32 bits word
+ *  \return the number of 0 bits above the most significant 1 of x, 32 if x is 0
+ */
+extern unsigned clz (unsigned x);
+
 #endif
@@ -27,4 +27,10 @@ extern void irq_enable (void);
  */
 extern unsigned irq_disable (void);
 
+/**
+ * \brief   put the CPU in a low power state until an IRQ, the IRQ is handled then IRQ are disabled
+ *          It is used by the scheduler when there is no READY thread, instead of a busy loop
+ */
+extern void irq_wait (void);
+
 #endif
@@ -58,6 +58,8 @@ void kdump (unsigned reg_tab[])
     int nl = 0;
     int cause = (KPanicRegsVal[0] >> 2) & 0xF;
 
+    tty_sync ();                                        // the IRQ will not be handled anymore
+
     kprintf ("\n[%d] <%p> KERNEL PANIC: %s\n\n",
             KPanicRegsVal[KPANIC_COUNT],                // TSC Time Stamp Counter
             KPanicRegsVal[KPANIC_EPC],                  // faulty instruction address
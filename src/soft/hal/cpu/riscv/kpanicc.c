@@ -63,6 +63,8 @@ void kdump (unsigned cause, unsigned reg_tab[])
 {
     int nl = 0;
 
+    tty_sync ();                                        // the IRQ will not be handled anymore
+
     kprintf ("\n[%d] <%p> KERNEL PANIC: %s\n\n",
             0,                                          // FIXME: TSC Time Stamp Counter
             KPanicRegsVal[KPANIC_MEPC],                 // faulty instruction address
@@ -27,4 +27,14 @@ void thread_context_init (int context[], void * bootstrap, void * stack_pointer)
     context[TH_CONTEXT_MSTATUS] = (3 << 11) | (1 << 3);
     context[TH_CONTEXT_RA] = (int)bootstrap;        // goto thread_bootstrap
     context[TH_CONTEXT_SP] = (int)stack_pointer;    // stack beginning 
+}
+
+void kthread_context_init (int context[], void * bootstrap, void * stack_pointer)
+{
+    /**
+     * All threads run in M-mode, thus a kernel thread has the same mstatus as a user thread
+     */
+    context[TH_CONTEXT_MSTATUS] = (3 << 11) | (1 << 3);
+    context[TH_CONTEXT_RA] = (int)bootstrap;        // goto thread_bootstrap
+    context[TH_CONTEXT_SP] = (int)stack_pointer;    // stack beginning 
 }
\ No newline at end of file
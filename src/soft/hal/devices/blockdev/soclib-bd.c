@@ -45,6 +45,99 @@ struct soclib_bd_regs_s {
     unsigned block_size;	///< (R) size of a PHYSICAL block in bytes (typically 512)
 };
 
+/**
+ * Driver private data, pointed by bdev->driver_data
+ * The controller has only one set of registers, thus one transfer at a time. The thread which
+ * owns the device sleeps (thread_wait()) until the ISR tells it the transfer is done
+ * (thread_notify()), meanwhile the other threads may run. The other threads that want the device
+ * are waiting in the wait list. The owner gives the device directly to the first waiting thread
+ * when its transfer is over, owner and wait are protected by lock since the threads may run on
+ * several CPUs.
+ */
+struct soclib_bd_data_s {
+    spinlock_t lock;            ///< protects owner and wait
+    list_t   wait;              ///< threads waiting for the device to be free
+    thread_t owner;             ///< thread whose transfer is in progress (NULL if free)
+    volatile int done;          ///< set by the ISR at the end of the transfer
+    volatile int status;        ///< status read by the ISR at the end of the transfer
+};
+
+/**
+ * \brief   Event triggered by the ISR at the end of a transfer, it wakes up the owner up
+ * \param   arg     the block device
+ * \param   status  the status read by the ISR (that acknowledges the IRQ)
+ * \return  nothing
+ */
+static void soclib_bd_wakeup (void *arg, int status)
+{
+    struct soclib_bd_data_s *data = ((blockdev_t *)arg)->driver_data;
+    if (data->owner == NULL) return;            // spurious IRQ, nobody is waiting for it
+    data->status = status;                      // transfer status for the owner
+    data->done = 1;                             // the transfer is done
+    thread_notify (data->owner);                // the owner becomes READY
+}
+
+/**
+ * \brief   Start a transfer and wait for its end
+ *          If the scheduler is running (thread_may_wait()), the current thread sleeps until
+ *          the IRQ, else (during kinit) the status register is polled with IRQ disabled.
+ * \param   bdev    the blockdev device
+ * \param   op      BD_READ or BD_WRITE
+ * \param   lba     the logical block address in the disk
+ * \param   buf     the buffer in memory
+ * \param   count   the number of logical blocks to move
+ * \return  the last status of the device
+ */
+static int soclib_bd_transfer (blockdev_t *bdev, enum bdops_e op, unsigned lba, void *buf,
+                               unsigned count)
+{
+    volatile struct soclib_bd_regs_s *regs = (struct soclib_bd_regs_s *) bdev->base;
+    struct soclib_bd_data_s *data = bdev->driver_data;
+    int status;
+
+    if (!thread_may_wait ()) {                  // no scheduler yet, thus polling
+        regs->irq_enable = 0;                   // no IRQ wanted
+        regs->buffer = buf;                     // address in memory
+        regs->pba = lba * bdev->ppb;            // address in disk (physical block address)
+        regs->count = count * bdev->ppb;        // number of physical blocks to move
+        regs->op = op;                          // at last command, the transfer is starting
+        for (status = regs->status;             // read status once, returns automatically to IDLE
+            status == BD_BUSY;                  // then while is BUSY
+            delay (100), status = regs->status);// wait about 100 cycles and read status again
+        return status;
+    }
+
+    spin_lock (&data->lock);                    // exclusive with the other CPUs
+    if (data->owner) {                          // device used by another thread
+        thread_addlast (&data->wait, ThreadCurrent);
+        while (data->owner != ThreadCurrent) {  // the thread may be notified for another reason
+            spin_unlock (&data->lock);          // (e.g. the block cache flusher), then it is
+            thread_wait ();                     // still in the wait list, till the owner gives it
+            spin_lock (&data->lock);
+        }
+    } else {
+        data->owner = ThreadCurrent;            // the current thread owns the device
+    }
+    spin_unlock (&data->lock);
+    data->done = 0;                             // transfer not done
+
+    regs->irq_enable = 1;                       // the end of transfer raises the IRQ
+    regs->buffer = buf;                         // address in memory
+    regs->pba = lba * bdev->ppb;                // address in disk (physical block address)
+    regs->count = count * bdev->ppb;            // number of physical blocks to move
+    regs->op = op;                              // at last command, the transfer is starting
+    while (!data->done)                         // IRQ disabled in kernel, thus no race here
+        thread_wait_io ();                      // other threads run during the transfer
+    status = data->status;                      // status given by the ISR
+
+    spin_lock (&data->lock);
+    list_t *item = list_getfirst (&data->wait); // first waiting thread, if any
+    data->owner = (item) ? thread_item (item) : NULL; // it owns the device, else it is free
+    if (item) thread_notify (data->owner);      // becomes READY with the device
+    spin_unlock (&data->lock);
+    return status;
+}
+
 /**
  * \brief   Initialize the Soclib block device
  * \param   bdev       The block device 
@@ -62,6 +155,10 @@ static void soclib_bd_init (blockdev_t *bdev, unsigned minor, unsigned base, uns
     bdev->block_size = block_size;              // LOGICAL block size (e.g. 4096)
     bdev->ppb = block_size / regs->block_size;  // nb of physical blocks per logical blocks
     bdev->blocks  = regs->size / bdev->ppb;     // disk size in LOGICAL blocks
+    struct soclib_bd_data_s *data = kmalloc (sizeof (struct soclib_bd_data_s));
+    list_init (&data->wait);                    // no thread waiting for the device
+    bdev->driver_data = data;                   // lock, owner, done and status are 0
+    bdev->ops->blockdev_set_event (bdev, soclib_bd_wakeup, bdev); // ISR wakes the owner up
 }
 
 /**
@@ -76,21 +173,11 @@ static int soclib_bd_read (blockdev_t *bdev, unsigned lba, void *buf, unsigned c
 {
     if (!buf || !bdev || ((lba+count) >= bdev->blocks)) 
         return errno = -EINVAL; // wrong parameters
-    volatile struct soclib_bd_regs_s *regs = (struct soclib_bd_regs_s *) bdev->base;
-    regs->buffer = buf;                         // destination address in memory
-    regs->pba = lba * bdev->ppb;                // source address in disk (physical block address)
-    regs->count = count * bdev->ppb;            // number of physical blocks to move
-    regs->op = BD_READ;                         // at last command, the transfer is starting
-    dcache_buf_invalidate (buf, count);         // if there are cached lines dst buffer, forget them
-// --------------- FIXME -------------- polling wait status not busy, this part is temporaty
-    int status;
-    for (status = regs->status;                 // read status once, returns automatically to IDLE
-        status == BD_BUSY;                      // then while is BUSY
-        delay (100), status = regs->status);    // wait about 100 cycles and read status again
+    int status = soclib_bd_transfer (bdev, BD_READ, lba, buf, count);
+    dcache_buf_invalidate (buf, count * bdev->block_size); // forget cached lines of dst buffer
     if (status != BD_READ_SUCCESS) {            // check the last status read
         return errno = -EIO; 
     }
-// --------------- FIXME -------------- end of part to change
     return 0;
 }
 
@@ -105,20 +192,10 @@ static int soclib_bd_read (blockdev_t *bdev, unsigned lba, void *buf, unsigned c
 static int soclib_bd_write (blockdev_t *bdev, unsigned lba, void *buf, unsigned count)
 {
     if (!buf || !bdev || ((lba+count) >= bdev->blocks)) return -EINVAL; // wrong parameters
-    volatile struct soclib_bd_regs_s *regs = (struct soclib_bd_regs_s *) bdev->base;
-    regs->buffer = buf;                         // source address in memory
-    regs->pba = lba * bdev->ppb;                // destination address in disk (physical block addr)
-    regs->count = count * bdev->ppb;            // number of physical blocks to move
-    regs->op = BD_WRITE;                        // at last command, the transfer is starting
-// --------------- FIXME -------------- polling wait status not busy, this part is temporaty
-    int status;
-    for (status = regs->status;                 // read status once, returns automatically to IDLE
-        status == BD_BUSY;                      // then while is BUSY
-        delay (100), status = regs->status);    // wait about 100 cycles and read status again
+    int status = soclib_bd_transfer (bdev, BD_WRITE, lba, buf, count);
     if (status != BD_WRITE_SUCCESS) {           // check the last status read
         return errno = -EIO; 
     }
-// --------------- FIXME -------------- end of part to change
     return 0;
 }
 
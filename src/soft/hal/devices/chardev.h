@@ -44,10 +44,13 @@ struct chardev_ops_s {
      * \param   chardev     the chardev device
      * \param   buf     the buffer to write to the chardev
      * \param   count   the number of bytes to write
+     * \param   wait    1 if the thread may sleep while the output is full (write() syscall),
+     *                  0 for the kernel writers (kprintf() may be called by an ISR, under a
+     *                  spinlock or by kmalloc()), then the device is polled to make room
      * \return  number onf bytes actually written
      * \note    almo1-mips : soclib_tty_write
     */
-    int (*chardev_write)(chardev_t *chardev, char *buf, unsigned count);
+    int (*chardev_write)(chardev_t *chardev, char *buf, unsigned count, int wait);
 
     /**
      * \brief   Generic function that reads from the chardev device
@@ -58,6 +61,14 @@ struct chardev_ops_s {
      * \note    almo1-mips : soclib_tty_read
      */
     int (*chardev_read)(chardev_t *chardev, char *buf, unsigned count);
+
+    /**
+     * \brief   Generic function that sends the buffered output chars by polling the device,
+     *          then the next writes are synchronous, used when the IRQ cannot be handled anymore
+     * \param   chardev     the chardev device
+     * \note    NULL if the output is not buffered (almo1-mips)
+     */
+    void (*chardev_sync)(chardev_t *chardev);
 };
 
 #endif
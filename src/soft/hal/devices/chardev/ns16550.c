@@ -15,10 +15,10 @@
 /**
  * \brief   NS16550 UART initialization
  *          The procedure is the following:
- *              * Init the baudrate through de DLAB registers 
+ *              * Init the baudrate through de DLAB registers
  *              * Configure register: 8bits word, no parity check, 1 stop bit
- *              * Enable interrupts
- *              * Disable FIFO
+ *              * Enable the data ready interrupt, the THR empty one is enabled by the writes
+ *              * Enable and clear the FIFOs, the RX interrupt is raised at each char
  * \param   cdev   the char device
  * \param   minor  Minor device number (instance number)
  * \param   base   the base NS16550 MMIO address
@@ -30,9 +30,11 @@ static void ns16550_init (chardev_t *cdev, unsigned minor, unsigned base, unsign
     cdev->minor     = minor;
     cdev->base      = base;
     cdev->baudrate  = baudrate;
-    
-    struct fifo_s *fifo = kmalloc (sizeof(struct fifo_s));
-    cdev->driver_data = (void*) fifo;
+
+    struct ns16550_data_s *data = kmalloc (sizeof(struct ns16550_data_s));
+    fifo_init (&data->rx);
+    fifo_init (&data->tx);
+    cdev->driver_data = (void*) data;
 
     volatile struct ns16550_general_regs_s *gregs =
         (struct ns16550_general_regs_s *) base;
@@ -54,73 +56,131 @@ static void ns16550_init (chardev_t *cdev, unsigned minor, unsigned base, unsign
     gregs->lcr = NS16550_WORD_LENGTH_8;
 
     /**
-     * Enable only the interrupt that tells us we receive a character
-     * TODO: in the future, we could also manage de THR Empty interrupt
+     * Enable only the interrupt that tells us we receive a character,
+     * the THR empty interrupt is enabled only while there are chars to send
      */
-    gregs->ier = NS16550_INT_DATA_READY; 
-    
-    /* Disable hardware FIFO */
-    gregs->fcr = 0;
+    gregs->ier = NS16550_INT_DATA_READY;
+
+    /* Enable hardware FIFO, the RX trigger level is 1 char */
+    gregs->fcr = NS16550_FCR_ENABLE | NS16550_FCR_CLEAR_RX | NS16550_FCR_CLEAR_TX;
 }
 
 /**
  * \brief   Read a buffer from the NS16550 UART
  * \param   cdev the chardev device corresponding to the NS16550
  * \param   buf the buf to fill
- * \param   count number of bytes to read from the UART
+ * \param   count number of bytes to read from the UART, it waits until at least one char is
+ *          read, then all the available chars are read (count at most)
  * \return  number of bytes read
  */
 static int ns16550_read (chardev_t *cdev, char *buf, unsigned count)
 {
-    int res = 0;
+    struct ns16550_data_s *data = (struct ns16550_data_s *) cdev->driver_data;
+    return fifo_read (&data->rx, buf, count);           // return the number of char read
+}
+
+/**
+ * \brief   Send the buffered chars, then the chars of buf, by polling the UART,
+ *          it is serialized with the ISR
+ * \param   cdev the device struct corresponding to the UART
+ * \param   buf the buffer to write after the buffered chars, or NULL
+ * \param   count number of bytes to write
+ */
+static void ns16550_tx_poll (chardev_t *cdev, char *buf, unsigned count)
+{
+    volatile struct ns16550_general_regs_s *regs =
+        (struct ns16550_general_regs_s *) cdev->base;   // access the registers
+    struct ns16550_data_s *data = (struct ns16550_data_s *) cdev->driver_data;
     char c;
 
-    struct fifo_s *fifo = (struct fifo_s *) cdev->driver_data;
+    spin_lock (&data->txlock);                          // a single consumer of the tx fifo
+    while (fifo_dev_pop (&data->tx, &c, 1)) {
+        while ((regs->lsr & NS16550_LSR_THR_EMPTY) == 0);   // wait for the transmitter
+        regs->hr = c;
+    }
     while (count--) {
-        while (fifo_pull (fifo, &c) == FAILURE) {       // wait for a char from the keyboard
-            thread_yield ();                            // nothing then we yield the processor
-            irq_enable ();                              // get few characters if thread is alone
-            irq_disable ();                             // close enter
-        }
-        *buf++ = c;
-        res++;
+        while ((regs->lsr & NS16550_LSR_THR_EMPTY) == 0);   // wait for the transmitter
+        regs->hr = *buf++;
     }
-    return res;                                         // return the number of char read
+    spin_unlock (&data->txlock);
 }
 
 /**
- * \brief   Write in the UART
+ * \brief   Write in the UART, the chars are put in the tx fifo, then sent by the ISR when the
+ *          THR is empty, thus the writer waits only if the fifo is full and if it is allowed to
+ *          (wait). A kernel writer, or any writer before the first thread, makes room by polling
+ *          the UART instead, and after ns16550_sync() all the chars are sent by polling.
  * \param   cdev the device struct corresponding to the UART
  * \param   buf the buffer to write
  * \param   count number of bytes to write
+ * \param   wait 1 if the writer may sleep while the fifo is full (write() syscall only)
  * \return  number of bytes written
  */
-static int ns16550_write (chardev_t *cdev, char *buf, unsigned count)
+static int ns16550_write (chardev_t *cdev, char *buf, unsigned count, int wait)
 {
-    int res = 0;                                        // nb of written char
-    volatile struct ns16550_general_regs_s *regs = 
+    volatile struct ns16550_general_regs_s *regs =
         (struct ns16550_general_regs_s *) cdev->base;   // access the registers
-    
-    while (count--) {                                   // while there are chars
-        regs->hr = *buf;                                // send the char to TTY
-        res++;                                          // nb of written char
-        buf++;		                                    // but is the next base in buffer
+    struct ns16550_data_s *data = (struct ns16550_data_s *) cdev->driver_data;
+    unsigned res = 0;                                   // nb of written char
+
+    if (data->sync) {                                   // the IRQ is not handled anymore
+        ns16550_tx_poll (cdev, buf, count);
+        return count;
+    }
+    while (res < count) {                               // while there are chars
+        unsigned n = fifo_write (&data->tx, buf + res, count - res, wait);
+        res += n;                                       // nb of written char
+        if (n) {                                        // the ISR sends the chars, the ring is
+            atomic_mb ();                               // written before the IRQ is enabled
+            regs->ier = NS16550_INT_DATA_READY | NS16550_INT_THR_EMPTY;
+        } else                                          // the fifo is full and the writer
+            ns16550_tx_poll (cdev, NULL, 0);            // must not wait, thus it makes room
     }
     return res;
 }
 
+/**
+ * \brief   Send the buffered chars by polling, then the writes are synchronous
+ * \param   cdev the device struct corresponding to the UART
+ */
+static void ns16550_sync (chardev_t *cdev)
+{
+    struct ns16550_data_s *data = (struct ns16550_data_s *) cdev->driver_data;
+    data->sync = 1;
+    ns16550_tx_poll (cdev, NULL, 0);
+}
+
 struct chardev_ops_s NS16550Ops = {
     .chardev_init = ns16550_init,
     .chardev_read = ns16550_read,
-    .chardev_write = ns16550_write
+    .chardev_write = ns16550_write,
+    .chardev_sync = ns16550_sync
 };
 
 void ns16550_isr (unsigned irq, chardev_t *cdev)
 {
-    volatile struct ns16550_general_regs_s *regs = 
+    volatile struct ns16550_general_regs_s *regs =
         (struct ns16550_general_regs_s *) cdev->base;
-    
-    struct fifo_s *fifo = (struct fifo_s *) cdev->driver_data;
-    char c = regs->hr;
-    fifo_push (fifo, c);
+    struct ns16550_data_s *data = (struct ns16550_data_s *) cdev->driver_data;
+    char buf[NS16550_FIFO_DEPTH];                       // burst of chars received or to send
+    unsigned count = 0;
+
+    while ((regs->lsr & NS16550_LSR_DATA_READY) && (count < sizeof(buf)))
+        buf[count++] = regs->hr;
+    if (count)
+        fifo_dev_push (&data->rx, buf, count);          // a single wake up for the burst
+
+    if (regs->lsr & NS16550_LSR_THR_EMPTY) {            // the hardware tx FIFO is empty
+        spin_lock (&data->txlock);                      // a single consumer of the tx fifo
+        count = fifo_dev_pop (&data->tx, buf, sizeof(buf));
+        for (unsigned i = 0; i < count; i++)            // fill the hardware tx FIFO
+            regs->hr = buf[i];
+        if (count == 0) {                               // nothing to send, thus no more IRQ
+            regs->ier = NS16550_INT_DATA_READY;
+            atomic_mb ();                               // but a writer may have pushed chars
+            if (ring_count (&data->tx.ring))            // and seen the IRQ still enabled
+                regs->ier = NS16550_INT_DATA_READY | NS16550_INT_THR_EMPTY;
+        }
+        spin_unlock (&data->txlock);
+    }
 }
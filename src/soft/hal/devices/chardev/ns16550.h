@@ -42,6 +42,16 @@
                                     
 #define NS16550_ENABLE_DLAB         128
 
+/* FCR Register values */
+#define NS16550_FCR_ENABLE          1
+#define NS16550_FCR_CLEAR_RX        2
+#define NS16550_FCR_CLEAR_TX        4
+#define NS16550_FIFO_DEPTH          16
+
+/* LSR Register values */
+#define NS16550_LSR_DATA_READY      1
+#define NS16550_LSR_THR_EMPTY       32
+
 /** \brief NS16550 general purpose register map, accessible when LCR.DLAB = 0 */
 struct ns16550_general_regs_s {
     unsigned char hr;           ///< Transmission/Reception character
@@ -63,10 +73,22 @@ struct ns16550_dlab_regs_s {
     unsigned char psd;          ///< Prescaler Division Factor
 } __attribute__((packed));
 
+/**
+ * \brief NS16550 driver data (cdev->driver_data), the software fifos
+ *        The ISR is the producer of rx and the consumer of tx. The consumer of tx can also be
+ *        ns16550_tx_poll() when the writes cannot wait for the IRQ, txlock serializes them.
+ */
+struct ns16550_data_s {
+    struct fifo_s rx;           ///< received chars, read by the threads
+    struct fifo_s tx;           ///< chars to send, written by the threads
+    spinlock_t txlock;          ///< serializes the consumers of tx
+    int sync;                   ///< 1 when the writes are synchronous (after chardev_sync)
+};
+
 /**
  * \brief   Interrupt Service Routine for NS16550 UART
- *          The ISR push received character into the software fifo
- *          (cdev->fifo)
+ *          The ISR push the received characters into the software rx fifo
+ *          and it sends the chars of the tx fifo when the THR is empty
  * \param   irq the irq linked to this ISR
  * \param   cdev the device linked to this ISR
  */
@@ -26,6 +26,16 @@ struct soclib_tty_regs_s {
     int unused;         ///< no yet used
 };
 
+/**
+ * \brief Soclib TTY driver data (cdev->driver_data)
+ *        The ISR is the producer of rx, txlock keeps the chars of a write together when threads
+ *        of several CPUs write the same TTY.
+ */
+struct soclib_tty_data_s {
+    struct fifo_s rx;   ///< chars received, waiting for a read
+    spinlock_t txlock;  ///< a single writer at a time
+};
+
 /**
  * \brief   Init the soclib tty device
  * \param   cdev  soclib device
@@ -41,8 +51,9 @@ static void soclib_tty_init (chardev_t *cdev, unsigned minor, unsigned base, uns
     cdev->base      = base;
     cdev->baudrate  = baudrate;
 
-    struct fifo_s *fifo = kmalloc (sizeof(struct fifo_s));
-    cdev->driver_data = (void*) fifo;
+    struct soclib_tty_data_s *data = kmalloc (sizeof(struct soclib_tty_data_s));
+    fifo_init (&data->rx);
+    cdev->driver_data = (void*) data;
 }
 
 /**
@@ -50,53 +61,47 @@ static void soclib_tty_init (chardev_t *cdev, unsigned minor, unsigned base, uns
  * \param   cdev the chardev device corresponding to the soclib tty
  * \param   buf the buf to fill
  * \param   count number of bytes to read from the tty
- *          it is a blocking function if count > 0 until count char is read
+ *          it is a blocking function if count > 0 until at least one char is read, then all
+ *          the available chars are read (count at most),
  *          if count == 0, it is a non-blocking function to read a single char
  * \return  if count > 0 then number of read bytes, else SUCCESS or FAILURE
  * FIXME    FIFO is not is the right place, it must be in the upper layer!
  */
 static int soclib_tty_read (chardev_t *cdev, char *buf, unsigned count)
 {
-    struct fifo_s *fifo = (struct fifo_s *) cdev->driver_data;
+    struct soclib_tty_data_s *data = (struct soclib_tty_data_s *) cdev->driver_data;
+    struct fifo_s *fifo = &data->rx;
 
     // blocking behavior
-    if (count) {
-        int res = 0;                                    // nb of read char
-        char c;                                         // char read
-        while (count--) {
-            while (fifo_pull (fifo, &c) == FAILURE) {   // wait for a char from the keyboard
-                thread_yield ();                        // nothing then we yield the processor
-                irq_enable ();                          // get few characters if thread is alone
-                irq_disable ();                         // close enter
-            }
-            *buf++ = c;
-            res++;
-        }
-        return res;                                     // return the number of char read
-    }         
+    if (count)
+        return fifo_read (fifo, buf, count);            // return the number of char read
     // non-blocking behavior
     return fifo_pull (fifo, buf);                       // return SUCCESS or FAILURE
 }
 
 /**
- * \brief   Write in the TTY
+ * \brief   Write in the TTY, the soclib TTY takes a char at each write in its register and it has
+ *          no TX IRQ, thus the output is not buffered and there is no need to wait between chars
  * \param   cdev the device struct corresponding to the tty
  * \param   buf the buffer to write
  * \param   count number of bytes to write
+ * \param   wait not used, the writer never waits
  * \return  number of bytes written
  */
-static int soclib_tty_write (chardev_t *cdev, char *buf, unsigned count)
+static int soclib_tty_write (chardev_t *cdev, char *buf, unsigned count, int wait)
 {
     int res = 0;                                        // nb of written char
     struct soclib_tty_regs_s *regs = 
         (struct soclib_tty_regs_s *) cdev->base;        // access the registers
+    struct soclib_tty_data_s *data = (struct soclib_tty_data_s *) cdev->driver_data;
 
+    spin_lock (&data->txlock);                          // the chars are not mixed with others
     while (count--) {                                   // while there are chars
         regs->write = *buf;                             // send the char to TTY
-        delay (150);
         res++;                                          // nb of written char
         buf++;		                                    // but is the next address in buffer
     }
+    spin_unlock (&data->txlock);
     return res;
 }
 
@@ -111,9 +116,14 @@ void soclib_tty_isr (unsigned irq, chardev_t *cdev)
     struct soclib_tty_regs_s *regs = 
         (struct soclib_tty_regs_s *) cdev->base;
     
-    struct fifo_s *fifo = (struct fifo_s *) cdev->driver_data;
-    char c = regs->read;
-    fifo_push (fifo, c);
+    struct soclib_tty_data_s *data = (struct soclib_tty_data_s *) cdev->driver_data;
+    struct fifo_s *fifo = &data->rx;
+    char buf[16];                                       // burst of chars received
+    unsigned count = 0;
+    do {                                                // the IRQ tells there is at least one
+        buf[count++] = regs->read;
+    } while (regs->status && (count < sizeof(buf)));
+    fifo_dev_push (fifo, buf, count);                   // a single wake up for the burst
 }
 
 /*------------------------------------------------------------------------------------------------*\
@@ -22,6 +22,7 @@ typedef struct dma_s {
     unsigned base;                  ///< DMA device base address
     unsigned minor;                 ///< device identifier MINOR number
     struct dma_ops_s *ops;          ///< driver-specific operations
+    void * driver_data;             ///< private pointer for driver specific info
 } dma_t;
 
 /** 
@@ -25,6 +25,15 @@ struct soclib_dma_regs_s {
     int unused[3];      ///< unused addresses
 };
 
+/**
+ * Driver private data, pointed by dma->driver_data
+ * The device has only one set of registers, thus one copy at a time, lock serializes the copies
+ * asked by threads running on several CPUs.
+ */
+struct soclib_dma_data_s {
+    spinlock_t lock;    ///< held during a copy
+};
+
 /**
  * \brief   Initialize the Soclib DMA device
  * \param   dma     The dma device 
@@ -37,6 +46,7 @@ static void soclib_dma_init (dma_t *dma, unsigned minor, unsigned base)
     dma->base    = base;
     dma->minor   = minor;
     dma->ops     = &SoclibDMAOps;
+    dma->driver_data = kmalloc (sizeof (struct soclib_dma_data_s));
 }
 
 /**
@@ -52,10 +62,13 @@ static void *soclib_dma_memcpy (dma_t *dma, int *dst, int *src, unsigned n)
     dcache_buf_invalidate (dst, n);             // cached lines of dst buffer are obsolet
     volatile struct soclib_dma_regs_s *regs = 
         (struct soclib_dma_regs_s *) dma->base;
+    struct soclib_dma_data_s *data = dma->driver_data;
+    spin_lock (&data->lock);                    // a single copy at a time
     regs->dest = dst;                           // destination address
     regs->src = src;                            // source address
     regs->len = n;                              // at last number of byte
     while (regs->len) delay (100);
+    spin_unlock (&data->lock);
     return dst;
 }
 
@@ -15,6 +15,8 @@
 
 struct timeri_ops_s;
 
+#define TIMER_DELAY_MIN 100         ///< minimum delay of a one-shot IRQ (for a date already passed)
+
 /** \brief Structure describing what to do when we receive a timer interrupt */
 struct timer_event_s {
     void (*f)(void *arg);           ///< function triggered
@@ -25,7 +27,7 @@ struct timer_event_s {
 typedef struct timer_s {
     unsigned base;                  ///< timer's base address
     unsigned minor;                 ///< device identifier MINOR number
-    unsigned period;                ///< number of ticks between two events
+    unsigned period;                ///< number of ticks between two events, 0 for one-shot
     struct timer_event_s event;     ///< event triggered each nticks
     struct timer_ops_s *ops;        ///< driver-specific operations
 } timer_t;
@@ -48,11 +50,21 @@ struct timer_ops_s {
      * \brief   Generic function that allows the kernel to set the number of ticks
      *          after which we want an interrupt
      * \param   timer the timer device
-     * \param   tick  the number of ticks
+     * \param   tick  the number of ticks, 0 to stop the interrupts (periodic or one-shot)
      * \note    almo1-mips : soclib_timer_set_tick
     */
     void (*timer_set_tick)(timer_t *timer, unsigned tick);
 
+    /**
+     * \brief   Generic function that programs a single interrupt at an absolute date, then the
+     *          timer is in one-shot mode, it raises no more interrupt until the next call.
+     *          A date already passed raises the interrupt TIMER_DELAY_MIN cycles later.
+     * \param   timer    the timer device
+     * \param   deadline the date in cycles (comparable to clock())
+     * \note    almo1-mips : soclib_timer_set_deadline
+    */
+    void (*timer_set_deadline)(timer_t *timer, unsigned deadline);
+
     /**
      * \brief   Generic function that sets the event that will be triggered after a timer
      *          interrupt
@@ -11,21 +11,59 @@
 \*------------------------------------------------------------------------------------------------*/
 
 #include <hal/devices/timer/clint-timer.h>
+#include <hal/cpu/cpuregs.h>
+
+/**
+ * \brief   Set the CLINT comparator to mtime + delay, or to the maximum value if delay is 0
+ *          mtime and mtimecmp are 64 bits registers, read and written in two parts
+ * \param   timer timer device
+ * \param   delay number of ticks from now, 0 for never
+ * \return  nothing
+ */
+static void clint_timer_set_cmp (timer_t *timer, unsigned delay)
+{
+    volatile unsigned *mtime = (unsigned *) (timer->base + CLINT_MTIME_OFFSET);
+    volatile unsigned *mtimecmp = (unsigned *) (timer->base + CLINT_MTIMECMP_OFFSET);
+    unsigned lo, hi;
+    do {                                        // mtime must not change between the two reads
+        hi = mtime[1];
+        lo = mtime[0];
+    } while (hi != mtime[1]);
+    unsigned long long cmp = (delay) ? (((unsigned long long) hi << 32) | lo) + delay : ~0ULL;
+    mtimecmp[1] = 0xFFFFFFFF;                   // no IRQ while the low part changes
+    mtimecmp[0] = (unsigned) cmp;
+    mtimecmp[1] = (unsigned) (cmp >> 32);
+}
 
 /**
  * \brief   Set the number of ticks between two CLINT timer interrupts 
  * \param   timer timer device
- * \param   tick number of ticks
+ * \param   tick number of ticks, 0 to stop the interrupts
  * \return  nothing
  */
 static void clint_timer_set_tick (timer_t *timer, unsigned tick)
 {
     // We have to options: either set mtimecmp, or reset mtime
-    *(unsigned*) (timer->base + CLINT_MTIMECMP_OFFSET) =
-        (*(unsigned*) (timer->base + CLINT_MTIME_OFFSET)) + tick;
+    clint_timer_set_cmp (timer, tick);
     timer->period = tick;
 }
 
+/**
+ * \brief   Program a single CLINT timer interrupt at a given date
+ *          mtime does not count the cycles, thus the delay in cycles is approximate
+ * \param   timer timer device
+ * \param   deadline date in cycles
+ * \return  nothing
+ */
+static void clint_timer_set_deadline (timer_t *timer, unsigned deadline)
+{
+    int delay = deadline - clock ();
+    if (delay < TIMER_DELAY_MIN)                // already passed or too close
+        delay = TIMER_DELAY_MIN;
+    clint_timer_set_cmp (timer, delay);
+    timer->period = 0;                          // one-shot mode
+}
+
 /**
  * \brief   CLINT timer initialization 
  * \param   timer   timer device to initialize
@@ -59,12 +97,13 @@ static void clint_timer_set_event (timer_t *timer, void (*f)(void *arg), void *a
 struct timer_ops_s ClintTimerOps = {
     .timer_init = clint_timer_init,
     .timer_set_event = clint_timer_set_event,
-    .timer_set_tick = clint_timer_set_tick
+    .timer_set_tick = clint_timer_set_tick,
+    .timer_set_deadline = clint_timer_set_deadline
 };
 
 void clint_timer_isr (unsigned irq, timer_t *timer)
 {
-    /* Reset timer */
+    /* Reset timer, or lower the IRQ in one-shot mode */
     timer->ops->timer_set_tick (timer, timer->period);
 
     /* If a function is available, trigger the event */
@@ -29,7 +29,27 @@ struct soclib_timer_regs_s {
 static void soclib_timer_set_tick (timer_t *timer, unsigned tick)
 {
     struct soclib_timer_regs_s *regs = (struct soclib_timer_regs_s *) timer->base;
+    timer->period = tick;                     // periodic mode
     regs->period = tick;
+    regs->mode = (tick) ? 3 : 0;              // timer ON with IRQ only if (tick != 0)
+}
+
+/**
+ * \brief   Program a single soclib timer interrupt at a given date
+ *          The soclib timer is periodic, thus its ISR stops it after the interrupt
+ * \param   timer timer device
+ * \param   deadline date in cycles
+ * \return  nothing
+ */
+static void soclib_timer_set_deadline (timer_t *timer, unsigned deadline)
+{
+    struct soclib_timer_regs_s *regs = (struct soclib_timer_regs_s *) timer->base;
+    int delay = deadline - clock ();          // the timer counts the cycles from now
+    if (delay < TIMER_DELAY_MIN)              // already passed or too close
+        delay = TIMER_DELAY_MIN;
+    timer->period = 0;                        // one-shot mode
+    regs->period = delay;
+    regs->mode = 3;                           // timer ON with IRQ
 }
 
 /**
@@ -48,9 +68,7 @@ static void soclib_timer_init (timer_t *timer, unsigned minor, unsigned base, un
 
     struct soclib_timer_regs_s *regs = (struct soclib_timer_regs_s *) timer->base;
     regs->resetirq = 1;                       // to be sure there won't be a IRQ when timer start
-    soclib_timer_set_tick (timer, tick);      // next period
-
-    regs->mode = (tick) ? 3 : 0;              // timer ON with IRQ only if (tick != 0)
+    soclib_timer_set_tick (timer, tick);      // next period, none if (tick == 0)
 }
 
 /**
@@ -69,7 +87,8 @@ static void soclib_timer_set_event (timer_t *timer, void (*f)(void *arg), void *
 struct timer_ops_s SoclibTimerOps = {
     .timer_init = soclib_timer_init,
     .timer_set_event = soclib_timer_set_event,
-    .timer_set_tick = soclib_timer_set_tick
+    .timer_set_tick = soclib_timer_set_tick,
+    .timer_set_deadline = soclib_timer_set_deadline
 };
 
 void soclib_timer_isr (unsigned irq, timer_t *timer)
@@ -77,7 +96,9 @@ void soclib_timer_isr (unsigned irq, timer_t *timer)
     struct soclib_timer_regs_s *regs = 
         (struct soclib_timer_regs_s *) timer->base;
     regs->resetirq = 1;                     // IRQ acknoledgement to lower the interrupt signal
-    
+    if (timer->period == 0)                 // one-shot mode, thus no more IRQ
+        regs->mode = 0;
+
     if (timer->event.f)
         timer->event.f (timer->event.arg);
 }
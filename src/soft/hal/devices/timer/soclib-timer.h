@@ -29,6 +29,7 @@ extern void soclib_timer_isr (unsigned irq, timer_t *timer);
  * \brief See hal/device/timer.h for the function signature
  * .timer_init      : initialize the timer device
  * .timer_set_tick  : allow the kernel to set the number of ticks
+ * .timer_set_deadline : allow the kernel to ask for a single interrupt at a given date
  * .timer_set_event : set the event that will be triggered after a timer
  */
 extern struct timer_ops_s SoclibTimerOps;
@@ -25,6 +25,8 @@
 #include <external/libfdt/libfdt.h>
 #include <kernel/klibc.h>
 
+#define SOC_CLOCK_FREQ  50000000    // cycles per second if the cpu node has no clock-frequency
+
 /**
  * \brief   Get the base address of a FDT device node (reg property)
  *          TODO: take in account the cells attribute of a node
@@ -141,7 +143,9 @@ static int soc_timer_init (void *fdt, unsigned tick)
             (void (*)(void *)) tick_event, (void *) 0);
         //  (void (*)(void *)) thread_yield, (void *) 0);
 
-        icu->ops->icu_unmask (icu, irq);
+        device_t *icudev = dev_get (ICU_DEV, dev->minor);  // timer n interrupts CPU n
+        icu_t *icu_cpu = (icudev) ? (icu_t *)icudev->data : icu;
+        icu_cpu->ops->icu_unmask (icu_cpu, irq);
         register_interrupt (irq, (isr_t) soclib_timer_isr, timer);
 
         timer_off = fdt_node_offset_by_compatible (fdt, timer_off, "soclib,timer");
@@ -245,6 +249,14 @@ int soc_init (void *fdt, int tick)
     return 0;
 }
 
+unsigned soc_clock_freq (void *fdt)
+{
+    int cpu_off = fdt_node_offset_by_prop_value (fdt, -1, "device_type", "cpu", sizeof("cpu"));
+    const unsigned *freq = (cpu_off < 0) ? NULL
+                         : fdt_getprop (fdt, cpu_off, "clock-frequency", NULL);
+    return (freq) ? fdt32_to_cpu (*freq) : SOC_CLOCK_FREQ;
+}
+
 /**
  * \brief   This function calls the ISR of the highest priority IRQ
  *          It is called by the irq_handler routine when a CPU is interrupted by an IRQ
@@ -22,6 +22,8 @@
 
 #include <external/libfdt/libfdt.h>
 
+#define SOC_CLOCK_FREQ  50000000    // cycles per second if the cpu node has no clock-frequency
+
 /**
  * \brief   Get the base address of a FDT device node (reg property)
  *          TODO: take in account the cells attribute of a node
@@ -138,7 +140,7 @@ static int soc_timer_init(void *fdt, unsigned tick)
         struct timer_s *timer = timer_alloc();
         ClintTimerOps.timer_init(timer, addr, tick);
         timer->ops->timer_set_event(timer,
-            (void (*)(void *)) thread_yield, (void *) 0);
+            (void (*)(void *)) tick_event, (void *) 0);
 
         timer_off = fdt_node_offset_by_compatible(fdt, timer_off, "sifive,clint0");
     }
@@ -174,6 +176,14 @@ int soc_init(void *fdt, int tick)
     return 0;
 }
 
+unsigned soc_clock_freq(void *fdt)
+{
+    int cpu_off = fdt_node_offset_by_prop_value(fdt, -1, "device_type", "cpu", sizeof("cpu"));
+    const uint32_t *freq = (cpu_off < 0) ? NULL
+                         : fdt_getprop(fdt, cpu_off, "clock-frequency", NULL);
+    return (freq) ? fdt32_to_cpu(*freq) : SOC_CLOCK_FREQ;
+}
+
 /**
  * \brief   This function calls the ISR of the highest priority IRQ
  *          It is called by the irq_handler routine when a CPU is interrupted by an IRQ
@@ -24,4 +24,13 @@
  */
 extern int soc_init (void *fdt, int tick);
 
+/**
+ * \brief     Get the frequency of the cycle counter of the CPUs (clock())
+ *            It is the clock-frequency property of the first cpu node of the device tree,
+ *            or SOC_CLOCK_FREQ (see soc.c) if the device tree does not give it
+ * \param     fdt is the pointer to the flattened device tree
+ * \return    the number of cycles per second
+ */
+extern unsigned soc_clock_freq (void *fdt);
+
 #endif
@@ -8,85 +8,757 @@
   \author   Franck Wajsburt
   \brief    Block I/O cache and access layer for disk devices.
 
+  Block cache
+
+    * A cached block is a page allocated by kmalloc(PAGE_SIZE) or kmalloc_pages_split(), its
+      identity (bdev, lba), its reference counter and its flags (dirty, lock, valid) are in its
+      Page[] descriptor.
+    * Each cached page has a small buffer head (blockio_buf_t) which chains it in:
+      * BlockioHash[BLOCKIO_HASH(bdev,lba)] to find it from (bdev,lba) in blockio_get()
+      * BlockioLru when its reference counter is 0, the most recently released is first
+    * A block page is never freed when it is released, it stays in the cache until
+      kmalloc() needs a page and there is no more free page. Then kmalloc() calls
+      blockio_reclaim() which frees the least recently used clean and unlocked pages.
+      kmalloc() never sleeps, thus the dirty pages are not written there, blockio_reclaim()
+      wakes the flusher thread up to write them back, then they can be evicted later.
+    * A block is hashed before being read and it is valid once read, since the read may put the
+      thread in WAIT state, the other threads asking for the same block wait for it to be valid.
+      They are chained in the waiters list of its buffer head and notified at the end of the read,
+      whether it succeeded or failed.
+
+  Write-back
+
+    * blockio_release() never writes, a dirty page stays dirty in the cache. blockio_dirty()
+      records the tick of the first modification since the last write-back.
+    * The BlockioFlusher kernel thread is notified every BLOCKIO_FLUSH_PERIOD ticks by
+      blockio_tick(), it writes back the pages dirty for at least BLOCKIO_DIRTY_AGE ticks.
+      blockio_tick() is the function of the BlockioTimer kernel timer, started by the first
+      blockio_dirty() and restarted by the flusher as long as there are dirty pages, thus the
+      ticks of the cache are counted only when they are needed.
+      The writes are queued in batches, thus sorted and merged as the other requests.
+    * blockio_sync_bdev() and blockio_sync_all() write back all dirty pages at once, for unmount.
+
+  Request queue
+
+    * The transfers are not asked directly to the driver, they are blockio_req_t requests added
+      to the BlockioQueue[bdev] of their device, sorted by increasing lba.
+    * The first thread that waits for a request while the device is not busy becomes the
+      dispatcher, it serves the pending requests until the queue is empty, in C-SCAN order:
+      from the first request at or after the head position up to the end of the disk, then
+      from the lowest lba again. The other threads add their requests during the transfers.
+    * The following requests of the same direction, with adjacent lba and contiguous buffers, are
+      merged in a single transfer of at most BLOCKIO_MAX_COUNT blocks.
+    * blockio_getn() queues all the missing blocks of a range before waiting. The pages of
+      adjacent missing blocks are taken contiguous by kmalloc_pages_split() when there is a free
+      block large enough, thus their reads are merged in a single transfer.
+    * blockio_readahead() queues asynchronous requests, nobody waits for them. The page is held
+      by the request and becomes valid at the end of the transfer, as for a usual read. The
+      reader never serves the queue itself, it sets the bit of the device in BlockioStart and
+      notifies the flusher thread, which serves the queue if nobody does it, then it returns.
+
+  Locking
+
+    * BlockioLock protects the hash buckets, the LRU list, the request queues, the flusher flags
+      and the block fields of the page descriptors (flags, refcount and lba share one word).
+    * It is released while the driver transfers the blocks and while a thread waits, and also
+      while the pages are allocated, since kmalloc() may call blockio_reclaim() which takes it.
+      Thus a missing block is hashed only if no other thread has hashed it meanwhile.
+
 \*------------------------------------------------------------------------------------------------*/
 
 #include <kernel/kblockio.h>
 #include <kernel/klibc.h>
 
-void *blockio_get (unsigned bdev, unsigned lba) 
+#define BLOCKIO_HASH_SIZE   128                             // number of buckets (power of 2)
+#define BLOCKIO_HASH(bdev,lba) (((bdev)*31+(lba))&(BLOCKIO_HASH_SIZE-1))
+
+typedef struct blockio_buf_s {
+    list_t hlist;                                           // chained in its BlockioHash[] bucket
+    list_t lru;                                             // chained in BlockioLru if refcount==0
+    void * page;                                            // page containing the block
+    unsigned dirtied;                                       // tick of the first write if dirty
+    unsigned pass;                                          // last blockio_writeback() pass of it
+    list_t waiters;                                         // threads waiting for the end of read
+} blockio_buf_t;
+
+typedef struct blockio_waiter_s {
+    list_t   list;                                          // chained in the waiters of the buffer
+    thread_t thread;                                        // thread to notify
+    int      woken;                                         // set at the end of the read
+} blockio_waiter_t;
+
+static list_t BlockioHash[BLOCKIO_HASH_SIZE];               // buckets of cached blocks
+static list_t BlockioLru;                                   // unreferenced blocks, LRU is the last
+
+#define BLOCKIO_MAX_BDEV    16                              // bdev is 4 bits in the page descriptor
+
+typedef struct blockio_req_s {
+    list_t   list;                                          // chained in the pending list
+    unsigned lba;                                           // logical block address
+    void *   buf;                                           // one block in memory
+    int      write;                                         // 1 to write the disk, 0 to read it
+    int      async;                                         // nobody waits, freed at the end
+    int      done;                                          // set once the transfer is over
+    int      status;                                        // 0 on success, -EIO on failure
+    thread_t thread;                                        // thread waiting for the end
+} blockio_req_t;
+
+typedef struct blockio_queue_s {
+    list_t   pending;                                       // requests not started, sorted by lba
+    unsigned head;                                          // lba after the last transfer (C-SCAN)
+    int      busy;                                          // a thread is dispatching the requests
+} blockio_queue_t;
+
+static blockio_queue_t BlockioQueue[BLOCKIO_MAX_BDEV];      // one request queue per block device
+
+static spinlock_t BlockioLock;                              // protects the cache and the queues
+static unsigned BlockioTicks;                               // ticks counted by blockio_tick()
+static ktimer_t BlockioTimer;                               // calls blockio_tick() once
+static thread_t BlockioFlusher;                             // write-back and read-ahead thread
+static int      BlockioFlush;                               // set by blockio_tick() for the flusher
+static int      BlockioPressure;                            // set by blockio_reclaim() (idem)
+static unsigned BlockioStart;                               // bit d: queue d to dispatch (flusher)
+
+//--------------------------------------------------------------------------------------------------
+// Block cache internal functions
+//--------------------------------------------------------------------------------------------------
+
+/**
+ * \brief   find the buffer head of the cached block (bdev,lba), BlockioLock must be held
+ * \param   bdev    block device minor number
+ * \param   lba     logical block address
+ * \return  the buffer head or NULL if the block is not in cache
+ */
+static blockio_buf_t *blockio_lookup (unsigned bdev, unsigned lba)
 {
-    blockdev_t *dev = blockdev_get (bdev);
+    unsigned b, l;
+    list_foreach (&BlockioHash[BLOCKIO_HASH(bdev,lba)], item) { // browse the bucket
+        blockio_buf_t *buf = list_item (item, blockio_buf_t, hlist);
+        page_get_lba (buf->page, &b, &l);                   // identity is in the page descriptor
+        if ((b == bdev) && (l == lba))                      // found it
+            return buf;
+    }
+    return NULL;                                            // not cached
+}
 
-#if 0
-VAR(%p\t\n,dev->base);
-VAR(%d\t\n,dev->blocks);
-VAR(%d\n,dev->block_size);
-VAR(%d\t\n,dev->ppb);
-VAR(%p\n,dev->event.fn);
-VAR(%p\n,dev->event.arg);
-#endif
-        
-    if (!dev || !dev->ops || !dev->ops->blockdev_read) return NULL;
+/**
+ * \brief   find the buffer head of a cached page, BlockioLock must be held
+ * \param   page    page returned by blockio_get()
+ * \return  the buffer head, panic if the page is not in the cache
+ */
+static blockio_buf_t *blockio_buf (void *page)
+{
+    unsigned bdev, lba;
+    page_get_lba (page, &bdev, &lba);                       // get the identity of the page
+    blockio_buf_t *buf = blockio_lookup (bdev, lba);        // then its buffer head
+    PANIC_IF (!buf || (buf->page != page), "page %p is not a cached block\n", page);
+    return buf;
+}
 
-    void *page = kmalloc (PAGE_SIZE);
-    if (!page) return NULL;
-    page_set_lba (page, bdev, lba);
-    page_set_block (page);
-    page_inc_refcount (page);
-    page_set_valid (page);
+/**
+ * \brief   allocate and hash the pages of count adjacent blocks missing in the cache
+ *          The pages are taken contiguous when there is a free block large enough, thus the reads
+ *          of the blocks are merged in a single transfer, else they are allocated one by one.
+ *          BlockioLock is held by the caller but released during the allocation, thus another
+ *          thread may hash one of the blocks meanwhile, then the pages from this one are freed.
+ *          Each hashed page is referenced once and not yet valid, the caller has to queue its read.
+ * \param   bdev    block device minor number
+ * \param   lba     logical block address of the first block
+ * \param   count   number of blocks, none of them is in the cache
+ * \param   bufs    array of count pointers, filled in with the buffer heads
+ * \return  the number of blocks hashed from lba, may be 0
+ */
+static unsigned blockio_alloc (unsigned bdev, unsigned lba, unsigned count, blockio_buf_t *bufs[])
+{
+    spin_unlock (&BlockioLock);                             // kmalloc() may call blockio_reclaim()
+    char *pages = (count > 1) ? kmalloc_pages_split (count) : NULL; // overwritten by the reads
+    for (unsigned i = 0; i < count; i++) {
+        blockio_buf_t *buf = kmalloc (sizeof (blockio_buf_t));
+        void *page = (pages) ? pages + i * PAGE_SIZE : kmalloc_nozero (PAGE_SIZE);
+        page_set_block (page);                              // reset the page descriptor
+        page_set_lba (page, bdev, lba+i);                   // identity of the cached block
+        page_inc_refcount (page);                           // the caller is the first user
+        buf->page = page;
+        list_init (&buf->waiters);                          // nobody waits for the read yet
+        bufs[i] = buf;
+    }
+    spin_lock (&BlockioLock);
 
-    if (dev->ops->blockdev_read (dev, lba, page, 1) != 0) { 
-        kfree (page);
-        return NULL;
+    unsigned hashed = 0;
+    for (unsigned i = 0; i < count; i++) {
+        if ((hashed == i) && !blockio_lookup (bdev, lba+i)) { // still missing, hashed before the
+            list_addfirst (&BlockioHash[BLOCKIO_HASH(bdev,lba+i)], &bufs[i]->hlist); // read, thus
+            hashed++;                                       // the other threads wait for it
+        } else {                                            // hashed by another thread meanwhile
+            kfree (bufs[i]->page);                          // or after such a block
+            kfree (bufs[i]);
+        }
     }
-    return page;
+    return hashed;
 }
 
-int blockio_release (void *page)
+//--------------------------------------------------------------------------------------------------
+// Request queue internal functions
+//--------------------------------------------------------------------------------------------------
+
+/**
+ * \brief   add a request in the pending list of its device, after those with the same lba
+ *          BlockioLock must be held, as for all the request queue functions
+ * \param   bdev    block device minor number
+ * \param   req     request with lba, buf and write already set
+ * \return  nothing
+ */
+static void blockio_queue_add (unsigned bdev, blockio_req_t *req)
 {
-    int err = 0;
-    if (page_get_refcount (page) == 1) {
-        err = blockio_sync (page);
+    blockio_queue_t *queue = &BlockioQueue[bdev];
+    req->done = 0;                                          // not yet transfered
+    req->async = 0;                                         // blockio_readahead() sets it after
+    req->thread = ThreadCurrent;                            // who has to be notified (if any)
+    list_foreach_rev (&queue->pending, item) {              // from the highest lba
+        if (list_item (item, blockio_req_t, list)->lba <= req->lba) {
+            list_addnext (item, &req->list);                // after the last lower or equal
+            return;
+        }
+    }
+    list_addfirst (&queue->pending, &req->list);            // the lowest lba
+}
+
+/**
+ * \brief   elect the next request to start with the C-SCAN policy
+ * \param   queue   non empty request queue
+ * \return  the first request at or after the head position, else the lowest one
+ */
+static blockio_req_t *blockio_queue_elect (blockio_queue_t *queue)
+{
+    list_foreach (&queue->pending, item) {                  // by increasing lba
+        blockio_req_t *req = list_item (item, blockio_req_t, list);
+        if (req->lba >= queue->head)                        // still in the way of the head
+            return req;
+    }
+    return list_item (list_first (&queue->pending), blockio_req_t, list); // restart from 0
+}
+
+/**
+ * \brief   end of the read of a block, the page becomes valid or it is unhashed if the read failed,
+ *          then the threads waiting for it are notified, they check which one it is
+ * \param   buf     buffer head of the block
+ * \param   status  status of the read request
+ * \return  nothing
+ */
+static void blockio_read_end (blockio_buf_t *buf, int status)
+{
+    if (status == 0)                                        // the read succeeded
+        page_set_valid (buf->page);                         // data are those of the disk
+    else
+        list_unlink (&buf->hlist);                          // not in cache anymore
+    list_t *item;
+    while ((item = list_getfirst (&buf->waiters)) != NULL) {
+        blockio_waiter_t *waiter = list_item (item, blockio_waiter_t, list);
+        waiter->woken = 1;                                  // set before the notify, since
+        thread_notify (waiter->thread);                     // a notify may be spurious
+    }
+}
+
+/**
+ * \brief   end of a read-ahead request, the page becomes valid and is left in the cache
+ *          If the read failed, the page is unhashed, the threads that wait for it are told.
+ * \param   req     the request allocated by blockio_readahead()
+ * \return  nothing
+ */
+static void blockio_readahead_end (blockio_req_t *req)
+{
+    blockio_buf_t *buf = blockio_buf (req->buf);            // hashed by blockio_readahead()
+    blockio_read_end (buf, req->status);
+    if (page_dec_refcount (buf->page) == 0) {               // the reference of the read-ahead
+        if (req->status == 0)                               // nobody asked for it yet
+            list_addfirst (&BlockioLru, &buf->lru);         // then it may be evicted
+        else {
+            kfree (buf->page);
+            kfree (buf);
+        }
+    }
+    kfree (req);
+}
+
+/**
+ * \brief   serve all pending requests of a device, merging the adjacent ones
+ *          The driver may put the current thread in WAIT state during the transfer, then the other
+ *          threads can add requests, they will be served before leaving.
+ *          BlockioLock is released during the transfers, the driver has its own lock.
+ * \param   dev     block device
+ * \param   queue   its request queue
+ * \return  nothing
+ */
+static void blockio_queue_dispatch (blockdev_t *dev, blockio_queue_t *queue)
+{
+    queue->busy = 1;                                        // other threads only add requests
+    while (!list_isempty (&queue->pending)) {
+        blockio_req_t *first = blockio_queue_elect (queue);
+        blockio_req_t *last = first;
+        unsigned count = 1;
+        while (!list_islast (&queue->pending, &last->list) && (count < BLOCKIO_MAX_COUNT)) {
+            blockio_req_t *next = list_item (list_next (&last->list), blockio_req_t, list);
+            if ((next->write != first->write)               // not the same direction
+            ||  (next->lba != first->lba + count)           // or not adjacent on disk
+            ||  (next->buf != (char *)first->buf + count * dev->block_size)) // or not in memory
+                break;                                      // then it cannot be merged
+            last = next;
+            count++;
+        }
+
+        list_t batch;                                       // requests of the transfer
+        list_init (&batch);
+        list_t *item = &first->list;
+        for (unsigned i = 0; i < count; i++) {              // move them out of the pending list
+            list_t *next = item->next;
+            list_addlast (&batch, list_unlink (item));
+            item = next;
+        }
+        queue->head = first->lba + count;                   // next C-SCAN position
+
+        spin_unlock (&BlockioLock);                         // the transfer may sleep
+        int err = (first->write)
+                ? dev->ops->blockdev_write (dev, first->lba, first->buf, count)
+                : dev->ops->blockdev_read (dev, first->lba, first->buf, count);
+        spin_lock (&BlockioLock);
+
+        while ((item = list_getfirst (&batch)) != NULL) {   // tell the requesters it is done
+            blockio_req_t *req = list_item (item, blockio_req_t, list);
+            req->status = (err) ? -EIO : 0;
+            req->done = 1;
+            if (req->async)                                 // read-ahead, nobody waits for it
+                blockio_readahead_end (req);
+            else if (req->thread && (req->thread != ThreadCurrent))
+                thread_notify (req->thread);                // it becomes READY
+        }
     }
+    queue->busy = 0;
+}
+
+/**
+ * \brief   wait for the end of a queued request, dispatch the queue if nobody does it
+ *          BlockioLock is held, it is released while the current thread waits
+ * \param   dev     block device
+ * \param   bdev    its minor number
+ * \param   req     request previously given to blockio_queue_add()
+ * \return  0 on success, -EIO on failure
+ */
+static int blockio_queue_wait (blockdev_t *dev, unsigned bdev, blockio_req_t *req)
+{
+    blockio_queue_t *queue = &BlockioQueue[bdev];
+    if (!req->done && !queue->busy)                         // nobody serves the queue
+        blockio_queue_dispatch (dev, queue);                // then the current thread does it
+    while (!req->done) {                                    // a notify before the wait is not lost
+        spin_unlock (&BlockioLock);
+        thread_wait_io ();                                  // notified by the dispatcher
+        spin_lock (&BlockioLock);
+    }
+    return req->status;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Block cache API
+//--------------------------------------------------------------------------------------------------
+
+void *blockio_get (unsigned bdev, unsigned lba)
+{
+    void *page;
+    return (blockio_getn (bdev, lba, 1, &page) == 0) ? page : NULL;
+}
+
+int blockio_getn (unsigned bdev, unsigned lba, unsigned count, void *pages[])
+{
+    blockdev_t *dev = blockdev_get (bdev);                  // the device is needed for misses
+    if (!dev || !dev->ops || !dev->ops->blockdev_read || !pages || (bdev >= BLOCKIO_MAX_BDEV)
+    ||  (count == 0) || (count > BLOCKIO_MAX_COUNT))
+        return -EINVAL;
+
+    blockio_req_t req[BLOCKIO_MAX_COUNT];                   // read requests of the missing blocks
+    blockio_buf_t *bufs[BLOCKIO_MAX_COUNT];                 // buffer heads of all the blocks
+    unsigned nreq = 0;
 
-    if (page_dec_refcount (page) == 0) {
-        kfree (page);
+    spin_lock (&BlockioLock);                               // !--! critical section
+    for (unsigned i = 0; i < count; ) {                     // first, take or queue all blocks
+        blockio_buf_t *buf = blockio_lookup (bdev, lba+i);  // is the block already in cache?
+        if (buf) {                                          // yes, cache hit
+            if (page_get_refcount (buf->page) == 0)         // if it was not referenced
+                list_unlink (&buf->lru);                    // then it cannot be evicted anymore
+            page_inc_refcount (buf->page);                  // one more user
+            bufs[i++] = buf;
+            continue;
+        }
+        unsigned miss = 1;                                  // no, cache miss of miss blocks
+        while ((i + miss < count) && !blockio_lookup (bdev, lba+i+miss))
+            miss++;
+        miss = blockio_alloc (bdev, lba+i, miss, &bufs[i]); // contiguous pages if possible
+        for (; miss; miss--, i++) {
+            req[nreq].lba = lba+i;                          // read request for the page
+            req[nreq].buf = bufs[i]->page;
+            req[nreq].write = 0;
+            blockio_queue_add (bdev, &req[nreq++]);         // adjacent ones will be merged
+        }
+    }
+
+    for (unsigned r = 0; r < nreq; r++) {                   // then, wait for the reads
+        blockio_buf_t *buf = bufs[req[r].lba - lba];
+        int status = blockio_queue_wait (dev, bdev, &req[r]); // the first wait starts the transfers
+        blockio_read_end (buf, status);                     // valid or unhashed, waiters notified
+    }
+
+    int err = 0;
+    for (unsigned i = 0; i < count; i++) {                  // at last, check all blocks
+        blockio_buf_t *buf = bufs[i];
+        if (!page_is_valid (buf->page)                      // another thread is reading it
+        &&  (blockio_lookup (bdev, lba+i) == buf)) {        // and it has not failed yet
+            blockio_waiter_t waiter = { .thread = ThreadCurrent, .woken = 0 };
+            list_addlast (&buf->waiters, &waiter.list);     // notified by blockio_read_end()
+            while (!waiter.woken) {                         // a notify before the wait is not lost
+                spin_unlock (&BlockioLock);
+                thread_wait_io ();                          // the reader may have a lower priority
+                spin_lock (&BlockioLock);
+            }
+        }
+        pages[i] = buf->page;
+        if (!page_is_valid (buf->page)) {                   // the read failed, page is unhashed
+            if (page_dec_refcount (buf->page) == 0) {       // last user frees it
+                kfree (buf->page);
+                kfree (buf);
+            }
+            pages[i] = NULL;
+            err = -EIO;
+        }
+    }
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
+    if (err) {                                              // all or nothing
+        for (unsigned i = 0; i < count; i++) {
+            blockio_release (pages[i]);                     // NULL pages are ignored
+            pages[i] = NULL;
+        }
     }
     return err;
 }
 
-int blockio_sync (void *page) 
+int blockio_readahead (unsigned bdev, unsigned lba, unsigned count)
+{
+    blockdev_t *dev = blockdev_get (bdev);
+    if (!dev || !dev->ops || !dev->ops->blockdev_read || (bdev >= BLOCKIO_MAX_BDEV))
+        return -EINVAL;
+    if (count > BLOCKIO_MAX_COUNT) count = BLOCKIO_MAX_COUNT;   // bounded memory usage
+
+    if (lba >= dev->blocks) return 0;
+    if (count > dev->blocks - lba) count = dev->blocks - lba;
+
+    blockio_buf_t *bufs[BLOCKIO_MAX_COUNT];
+    blockio_req_t *reqs[BLOCKIO_MAX_COUNT];
+    spin_lock (&BlockioLock);                               // !--! critical section
+    for (unsigned i = 0; i < count; ) {
+        if (blockio_lookup (bdev, lba+i)) {                 // already cached or being read
+            i++;
+            continue;
+        }
+        unsigned miss = 1;                                  // adjacent missing blocks
+        while ((i + miss < count) && !blockio_lookup (bdev, lba+i+miss))
+            miss++;
+        spin_unlock (&BlockioLock);                         // kmalloc() may call blockio_reclaim()
+        for (unsigned m = 0; m < miss; m++)
+            reqs[m] = kmalloc (sizeof (blockio_req_t));
+        spin_lock (&BlockioLock);
+        unsigned hashed = blockio_alloc (bdev, lba+i, miss, bufs); // held by the requests
+        for (unsigned m = 0; m < miss; m++) {
+            if (m >= hashed) {                              // hashed by another thread meanwhile
+                kfree (reqs[m]);
+                continue;
+            }
+            blockio_req_t *req = reqs[m];
+            req->lba = lba+i;
+            req->buf = bufs[m]->page;
+            req->write = 0;
+            blockio_queue_add (bdev, req);
+            req->async = 1;                                 // freed by blockio_readahead_end()
+            i++;
+        }
+    }
+    if (!BlockioQueue[bdev].busy) {                         // nobody serves the queue
+        if (!BlockioFlusher || !thread_may_wait ()) {       // no thread yet, the driver polls
+            blockio_queue_dispatch (dev, &BlockioQueue[bdev]); // thus the current thread does it
+        } else {
+            BlockioStart |= 1 << bdev;                      // the flusher starts the transfers
+            thread_notify (BlockioFlusher);                 // it becomes READY
+        }
+    }
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
+    return 0;
+}
+
+void blockio_dirty (void *page)
+{
+    spin_lock (&BlockioLock);                               // !--! critical section
+    if (!page_is_dirty (page))                              // first write since the last sync
+        blockio_buf (page)->dirtied = BlockioTicks;         // the age is counted from now
+    page_set_dirty (page);
+    if (!ktimer_pending (&BlockioTimer))                    // the ticks were not counted
+        ktimer_start (&BlockioTimer, cpuid (), clock () + BLOCKIO_FLUSH_PERIOD * KTIMER_TICK);
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
+}
+
+void blockio_lock (void *page)
+{
+    spin_lock (&BlockioLock);                               // the flags share a word with the
+    page_set_lock (page);                                   // refcount, thus a read-modify-write
+    spin_unlock (&BlockioLock);                             // must be exclusive
+}
+
+void blockio_unlock (void *page)
+{
+    spin_lock (&BlockioLock);
+    page_clr_lock (page);
+    spin_unlock (&BlockioLock);
+}
+
+/**
+ * \brief   drop a reference of a cached page, BlockioLock must be held
+ * \param   page    page returned by blockio_get()
+ * \return  nothing
+ */
+static void blockio_put (void *page)
+{
+    if (page_dec_refcount (page) == 0) {                    // no more user, the page stays cached
+        list_addfirst (&BlockioLru, &blockio_buf (page)->lru); // as the most recently used
+    }
+}
+
+int blockio_release (void *page)
 {
     if (!page) return -EINVAL;
 
-    if (!page_is_dirty (page)) return 0;
+    spin_lock (&BlockioLock);                               // !--! critical section
+    blockio_put (page);
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
+    return 0;                                               // a dirty page is written back later
+}
+
+int blockio_sync (void *page)
+{
+    if (!page) return -EINVAL;
 
     unsigned bdev, lba;
+    spin_lock (&BlockioLock);                               // !--! critical section
     page_get_lba (page, &bdev, &lba);
 
     blockdev_t *dev = blockdev_get (bdev);
-    if (!dev || !dev->ops || !dev->ops->blockdev_write) return -EIO;
+    if (!page_is_dirty (page) || !dev || !dev->ops || !dev->ops->blockdev_write) {
+        int err = (page_is_dirty (page)) ? -EIO : 0;
+        spin_unlock (&BlockioLock);                         // !--! end of critical section
+        return err;
+    }
 
-    int err = dev->ops->blockdev_write (dev, lba, page, 1);
-    page_clr_dirty (page);
+    blockio_req_t req = { .lba = lba, .buf = page, .write = 1 };
+    page_clr_dirty (page);                                  // a new write makes it dirty again
+    blockio_queue_add (bdev, &req);
+    int err = blockio_queue_wait (dev, bdev, &req);
+    if (err)                                                // data are not on the disk
+        page_set_dirty (page);
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
 
     return err;
 }
 
-typedef struct { 
-    char     name[24];   // filename 23 bytes + '\0' 
-    unsigned lba;        // logical block position 
-    unsigned size;       // size if bytes 
-} entry_t; 
+/**
+ * \brief   wait for the end of queued write requests, then release their pages
+ *          A page whose write failed is dirty again, it will be written back later.
+ *          BlockioLock is held, it is released during the waits.
+ * \param   req     requests given to blockio_queue_add()
+ * \param   nreq    number of requests
+ * \return  0 on success, -EIO if at least one write failed
+ */
+static int blockio_writeback_wait (blockio_req_t req[], unsigned nreq)
+{
+    int err = 0;
+    for (unsigned r = 0; r < nreq; r++) {
+        unsigned bdev;
+        page_get_lba (req[r].buf, &bdev, NULL);
+        if (blockio_queue_wait (blockdev_get (bdev), bdev, &req[r]) != 0) {
+            page_set_dirty (req[r].buf);                    // data are not on the disk
+            err = -EIO;
+        }
+        blockio_put (req[r].buf);                           // referenced by blockio_writeback()
+    }
+    return err;
+}
+
+/**
+ * \brief   write back the dirty pages of a device, or of all devices, old enough
+ *          Each page is written at most once per call (pass), a page whose write failed is dirty
+ *          again but it is retried only by the next call.
+ * \param   bdev    block device minor number, BLOCKIO_MAX_BDEV for all devices
+ * \param   age     minimum number of ticks since the first modification of the page
+ * \return  0 on success, -EIO if at least one write failed
+ */
+static int blockio_writeback (unsigned bdev, unsigned age)
+{
+    static unsigned passes;                                 // number of passes, 0 is never used
+    blockio_req_t req[BLOCKIO_MAX_COUNT];                   // writes queued together
+    unsigned nreq = 0;
+    unsigned pass = (++passes) ? passes : ++passes;         // identifies the current pass
+    int err = 0;
+
+    spin_lock (&BlockioLock);                               // !--! critical section
+    for (int h = 0; h < BLOCKIO_HASH_SIZE; h++) {           // for all buckets
+        int full = 0;
+        list_foreach (&BlockioHash[h], item) {              // for all cached blocks
+            blockio_buf_t *buf = list_item (item, blockio_buf_t, hlist);
+            unsigned b;
+            page_get_lba (buf->page, &b, NULL);
+            if (!page_is_dirty (buf->page) || !page_is_valid (buf->page))
+                continue;                                   // nothing to write back
+            if (((bdev != BLOCKIO_MAX_BDEV) && (b != bdev)) // not the asked device
+            ||  (BlockioTicks - buf->dirtied < age)         // or modified too recently
+            ||  (buf->pass == pass))                        // or already written in this pass
+                continue;
+            if (page_get_refcount (buf->page) == 0)         // not evicted during the write
+                list_unlink (&buf->lru);
+            page_inc_refcount (buf->page);
+            page_clr_dirty (buf->page);                     // a new write makes it dirty again
+            buf->pass = pass;                               // not retried if the write fails
+            page_get_lba (buf->page, NULL, &req[nreq].lba);
+            req[nreq].buf = buf->page;
+            req[nreq].write = 1;
+            blockio_queue_add (b, &req[nreq]);              // sorted with the others
+            if ((full = (++nreq == BLOCKIO_MAX_COUNT)))     // no more request available
+                break;
+        }
+        if (full) {                                         // the writes may sleep and the bucket
+            err |= blockio_writeback_wait (req, nreq);      // may change meanwhile, thus it is
+            nreq = 0;                                       // browsed again, without the pages
+            h--;                                            // already written in this pass
+        }
+    }
+    err |= blockio_writeback_wait (req, nreq);
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
+    return (err) ? -EIO : 0;
+}
+
+int blockio_sync_bdev (unsigned bdev)
+{
+    if (bdev >= BLOCKIO_MAX_BDEV) return -EINVAL;
+    return blockio_writeback (bdev, 0);                     // whatever their age
+}
+
+int blockio_sync_all (void)
+{
+    return blockio_writeback (BLOCKIO_MAX_BDEV, 0);         // all devices, whatever their age
+}
+
+/**
+ * \brief   tell if there is at least a dirty page in the cache, BlockioLock must be held
+ * \return  1 if there is one, 0 otherwise
+ */
+static int blockio_has_dirty (void)
+{
+    for (int h = 0; h < BLOCKIO_HASH_SIZE; h++) {           // for all buckets
+        list_foreach (&BlockioHash[h], item) {              // for all cached blocks
+            if (page_is_dirty (list_item (item, blockio_buf_t, hlist)->page))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief   write-back and read-ahead kernel thread, it sleeps until it is notified
+ *          - by blockio_readahead(), then it serves the queues of BlockioStart not yet served
+ *          - by blockio_tick(), then it writes back the old dirty pages and it restarts the
+ *            BlockioTimer if there are still dirty pages (too young)
+ *          - by blockio_reclaim(), then it writes back all the dirty pages, whatever their age
+ *          The flags are tested after each wait, since a notification may come during a transfer
+ * \param   arg     not used
+ * \return  never returns
+ */
+static void *blockio_flusher (void *arg)
+{
+    for (;;) {
+        thread_wait ();                                     // till there is something to do
+        spin_lock (&BlockioLock);                           // !--! critical section
+        while (BlockioStart) {                              // read-ahead requests to start
+            unsigned bdev = 31 - clz (BlockioStart);
+            BlockioStart &= ~(1 << bdev);
+            if (!BlockioQueue[bdev].busy)                   // nobody serves the queue yet
+                blockio_queue_dispatch (blockdev_get (bdev), &BlockioQueue[bdev]);
+        }
+        if (!BlockioFlush && !BlockioPressure) {            // not yet the flush period
+            spin_unlock (&BlockioLock);                     // !--! end of critical section
+            continue;
+        }
+        unsigned age = (BlockioPressure) ? 0 : BLOCKIO_DIRTY_AGE; // no more clean page to evict
+        BlockioFlush = BlockioPressure = 0;
+        spin_unlock (&BlockioLock);                         // !--! end of critical section
+        blockio_writeback (BLOCKIO_MAX_BDEV, age);
+        spin_lock (&BlockioLock);                           // !--! critical section
+        if (blockio_has_dirty () && !ktimer_pending (&BlockioTimer))
+            ktimer_start (&BlockioTimer, cpuid (), clock () + BLOCKIO_FLUSH_PERIOD*KTIMER_TICK);
+        spin_unlock (&BlockioLock);                         // !--! end of critical section
+    }
+    return arg;
+}
+
+/**
+ * \brief   function of the BlockioTimer, called by the timer ISR every BLOCKIO_FLUSH_PERIOD ticks
+ *          as long as there are dirty pages, it counts the ticks and wakes the flusher up
+ * \param   arg     not used
+ */
+static void blockio_tick (void *arg)
+{
+    spin_lock (&BlockioLock);                               // !--! critical section
+    BlockioTicks += BLOCKIO_FLUSH_PERIOD;
+    BlockioFlush = 1;                                       // old dirty pages to write back
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
+    if (BlockioFlusher)
+        thread_notify (BlockioFlusher);                     // it becomes READY
+}
+
+unsigned blockio_reclaim (unsigned nbpages)
+{
+    unsigned freed = 0;
+    int dirty = 0;                                          // a dirty page could be evicted
+    spin_lock (&BlockioLock);                               // !--! critical section
+    list_foreach_rev (&BlockioLru, item) {                  // from the least recently used
+        if (freed == nbpages) break;                        // enough pages given back
+        blockio_buf_t *buf = list_item (item, blockio_buf_t, lru);
+        if (page_is_lock (buf->page))                       // must stay in memory
+            continue;
+        if (page_is_dirty (buf->page)) {                    // must be written first, but kmalloc()
+            dirty = 1;                                      // cannot wait for it
+            continue;
+        }
+        list_unlink (&buf->lru);                            // remove it from the LRU list
+        list_unlink (&buf->hlist);                          // and from its bucket
+        kfree (buf->page);                                  // free page goes back to FreeArea[0]
+        kfree (buf);
+        freed++;
+    }
+    if (dirty && (freed < nbpages) && BlockioFlusher) {     // the flusher writes them back now,
+        BlockioPressure = 1;                                // whatever their age, thus they can
+        thread_notify (BlockioFlusher);                     // be evicted by the next reclaim
+    }
+    spin_unlock (&BlockioLock);                             // !--! end of critical section
+    return freed;
+}
 
 void blockio_init (void)
 {
-    entry_t *dir = blockio_get (0, 0);
-    for (int e=0 ; e < 128 && dir[e].name; e++) {
-        if (dir[e].name[0])
-            kprintf ("   [%d]\t(%d)\t%s\n", dir[e].lba, dir[e].size, dir[e].name);
+    for (int h = 0; h < BLOCKIO_HASH_SIZE; h++)             // all buckets are empty
+        list_init (&BlockioHash[h]);
+    list_init (&BlockioLru);                                // as the LRU list
+    ktimer_setup (&BlockioTimer, blockio_tick, NULL);       // started by blockio_dirty()
+    for (int d = 0; d < BLOCKIO_MAX_BDEV; d++) {            // no pending request
+        list_init (&BlockioQueue[d].pending);
+        BlockioQueue[d].head = 0;
+        BlockioQueue[d].busy = 0;
     }
+    if (!BlockioFlusher)                                    // the write-back kernel thread
+        kthread_create (&BlockioFlusher, (int)blockio_flusher, 0, 0);
 }
+
 /*------------------------------------------------------------------------------------------------*\
    Editor config (vim/emacs): tabs are 4 spaces, max line length is 100 characters
    vim: set ts=4 sw=4 sts=4 et tw=100:
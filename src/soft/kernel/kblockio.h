@@ -10,6 +10,7 @@
 
             This API provides access to logical blocks on block devices,
             with transparent caching, reference counting, and delayed write-back.
+            Dirty blocks are written back by a kernel thread once they are old enough.
             A block is always of fixed size (one page size)
             The returned page is page-aligned and must be released explicitly.
 
@@ -20,6 +21,10 @@
 
 #include <hal/devices/blockdev.h>
 
+#define BLOCKIO_MAX_COUNT   8   ///< max number of blocks of blockio_getn() and of a transfer
+#define BLOCKIO_FLUSH_PERIOD 5  ///< number of ticks between two wake-ups of the write-back thread
+#define BLOCKIO_DIRTY_AGE   10  ///< number of ticks a page stays dirty before being written back
+
 /**
  * \brief   Get a page for the given logical block.
  *          If the block is already cached, returns a pointer to the cached page.
@@ -31,6 +36,31 @@
  */
 void *blockio_get(unsigned bdev, unsigned lba);
 
+/**
+ * \brief   Get the pages of count consecutive logical blocks.
+ *          Same as blockio_get() for each block, but all the missing blocks are queued before
+ *          waiting, thus adjacent blocks are read by a single transfer of the device.
+ *          The reference count of all pages is incremented on success.
+ * \param   bdev  Block device identifier
+ * \param   lba   first Logical Block Address
+ * \param   count number of blocks (at most BLOCKIO_MAX_COUNT)
+ * \param   pages array of count pointers, filled in with the pages
+ * \return  0 on success, -EINVAL or -EIO on failure (then no page is referenced)
+ */
+int blockio_getn (unsigned bdev, unsigned lba, unsigned count, void *pages[]);
+
+/**
+ * \brief   Start reading count consecutive logical blocks into the cache, without referencing them.
+ *          The blocks already cached are skipped. The reads are queued with the other requests of
+ *          the device and started by the write-back thread, thus the caller never waits for them,
+ *          a later blockio_get() of one of these blocks waits for the end of its read.
+ * \param   bdev  Block device identifier
+ * \param   lba   first Logical Block Address
+ * \param   count number of blocks (reduced to BLOCKIO_MAX_COUNT and to the disk size)
+ * \return  0 on success, -EINVAL on failure
+ */
+int blockio_readahead (unsigned bdev, unsigned lba, unsigned count);
+
 /**
  * \brief Mark a page (used as block) as dirty (modified).
  *        This signals that the page has been changed and should be written
@@ -55,11 +85,11 @@ void blockio_unlock(void *page);
 
 /**
  * \brief Release a previously acquired block page.
- *        Ask to synchronize the page if 
  *        Decrements the reference count. The page remains in the cache
  *        and may be reused or evicted later depending on usage.
+ *        A dirty page is not written here, but later by the write-back thread.
  * \param page Pointer to the page to release
- * \return 0 on success, -EIO or -EINVALL on fealure
+ * \return 0 on success, -EINVALL on fealure
  */
 int blockio_release(void *page);
 
@@ -72,12 +102,30 @@ int blockio_release(void *page);
 int blockio_sync(void *page);
 
 /**
- * \brief Write back all dirty blocks in the cache.
+ * \brief Write back all dirty blocks of a device, whatever their age (e.g. for unmount).
+ * \param bdev Block device identifier
+ * \return 0 on success, -EIO or -EINVAL on fealure
+ */
+int blockio_sync_bdev (unsigned bdev);
+
+/**
+ * \brief Write back all dirty blocks in the cache, whatever their age (e.g. for shutdown).
+ * \return 0 on success, -EIO on fealure
+ */
+int blockio_sync_all (void);
+
+/**
+ * \brief Give back to the kernel allocator the pages of the least recently used blocks.
+ *        Only unreferenced, clean and unlocked blocks are evicted from the cache, it never sleeps.
+ *        If dirty blocks could be evicted, the write-back thread is woken up to write them.
+ *        It is called by kmalloc() when there is no more free page.
+ * \param nbpages maximum number of pages to free
+ * \return the number of pages really freed
  */
-void blockio_flush(void);
+unsigned blockio_reclaim(unsigned nbpages);
 
 /**
- * \brief initialize the blockio layer for all block devices
+ * \brief initialize the blockio layer for all block devices and start the write-back thread
  */
 void blockio_init(void);
 
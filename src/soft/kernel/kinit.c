@@ -15,21 +15,32 @@
               - to initialise the SoC (thanks to the soc-specific function soc_init())
               - to initialise the thread scheduler
               - to create and launch the first user process
+              - to start the other CPUs, which wait in the boot code until SmpStart is set,
+                then they call kinit_cpu() with their own small boot stack SmpStack[cpu]
 
 \*------------------------------------------------------------------------------------------------*/
 
 #include <kernel/klibc.h>
 
-#define TICK    200000
+int SmpStart;                                   // set by CPU 0 when the other CPUs can start
+int SmpStack[NCPUS_MAX][256];                   // boot stacks of the other CPUs (used by boot)
+
+void kinit_cpu (void)
+{
+    sched_cpu_start ();                         // the idle thread takes the CPU, never returns
+}
 
 void kinit (void *fdt)
 {
     // Hardware and structure inialization
 
     kmemkernel_init ();                         // kernel mem initialization, do it before soc_init
-    PANIC_IF (soc_init (fdt, TICK) < 0, "SoC initialization failed");
+    ktimer_init ();                             // timer wheels, the timers are one-shot thus
+    PANIC_IF (soc_init (fdt, 0) < 0, "SoC initialization failed"); // without periodic tick
+    __usermem.clock_freq = soc_clock_freq (fdt);   // for the time conversions of ulib/libc.c
     kprintf (Banner_ko6);                       // ko6 banner
     kmemuser_init ();                           // user memory initialization 
+    sched_init ();                              // initialize the scheduler run queues
     ksynchro_init ();                           // initialize all synchronization mecanisms
 
     // Then, create the thread structure for the thread main()
@@ -64,13 +75,14 @@ void kinit (void *fdt)
     test_ustack (10);
 #   endif
 
-    //blockio_init ();
+    blockio_init ();
     vfs_init ();
     vfs_test ();
     
-    // Finally, load the main user programm
+    // Finally, start the other CPUs, then load the main user programm
     // We never return of thread_load() here because thread_load() change $31 to thread_bootstap()
 
+    SmpStart = 1;
     thread_main_load (__usermem.main_thread);
     PANIC_IF(true,"Impossible to be here");
 }
@@ -45,10 +45,13 @@ void delay (unsigned nbcycles)
 int kprintf(char *fmt, ...)
 {
     static char buffer[PRINTF_MAX];
+    static spinlock_t lock;                     // buffer is shared by all CPUs
     va_list ap;
     va_start (ap, fmt);
+    spin_lock (&lock);
     int res = vsnprintf(buffer, sizeof(buffer), fmt, ap);
     tty_write(0, buffer, res);
+    spin_unlock (&lock);
     va_end(ap);
     return res;
 }
@@ -71,7 +74,10 @@ int tty_read (int tty, char *buf, unsigned count)
     return -1;
 }
 
-int tty_write (int tty, char *buf, unsigned count)
+/**
+ * \brief   write in a tty, the calling thread may sleep while the output is full only if wait
+ */
+static int tty_write_wait (int tty, char *buf, unsigned count, int wait)
 {
     /* If the tty is not available, default to 0 */
     if (tty > chardev_count())
@@ -79,10 +85,32 @@ int tty_write (int tty, char *buf, unsigned count)
         
     struct chardev_s *cdev = chardev_get(tty);
     if (cdev)
-        return cdev->ops->chardev_write(cdev, buf, count);
+        return cdev->ops->chardev_write(cdev, buf, count, wait);
     return -1;
 }
 
+int tty_write (int tty, char *buf, unsigned count)
+{
+    return tty_write_wait (tty, buf, count, 0);     // the kernel never waits for the output
+}
+
+int tty_write_user (int tty, char *buf, unsigned count)
+{
+    return tty_write_wait (tty, buf, count, 1);     // the thread may wait, it is in a syscall
+}
+
+void tty_sync (void)
+{
+    for (int tty = 0; tty <= chardev_count(); tty++) {
+        device_t *dev = dev_get (CHAR_DEV, tty);
+        if (dev == NULL)
+            continue;
+        struct chardev_s *cdev = (struct chardev_s *) dev->data;
+        if (cdev->ops->chardev_sync)            // only if the output is buffered
+            cdev->ops->chardev_sync (cdev);
+    }
+}
+
 int tty_putc (int tty, int c)
 {
     tty_write (tty, (char *)&c, 1);             // only write one char
@@ -139,25 +167,105 @@ int tty_gets (int tty, char *buf, int count)
     return res;                                 // returns the number of char read
 }
 
-int fifo_push (struct fifo_s *fifo, char c)
+void fifo_init (struct fifo_s *fifo)
+{
+    ring_init (&fifo->ring, fifo->data, sizeof(fifo->data));
+    fifo->lock = 0;
+    list_init (&fifo->wait);
+}
+
+/**
+ * \brief   notify the first thread waiting for a char, the fifo lock is held
+ * \param   fifo    structure of fifo
+ */
+static void fifo_wakeup (struct fifo_s *fifo)
 {
-    unsigned pt_write_next = (fifo->pt_write + 1) % sizeof(fifo->data);
-    if (pt_write_next != fifo->pt_read) {
-        fifo->data [fifo->pt_write] = c;
-        fifo->pt_write = pt_write_next;
-        return SUCCESS;
+    list_t *item = list_getfirst (&fifo->wait);
+    if (item)
+        thread_notify (thread_item (item));     // it becomes READY (and boosted)
+}
+
+unsigned fifo_dev_push (struct fifo_s *fifo, const char *buf, unsigned count)
+{
+    unsigned res = ring_push (&fifo->ring, buf, count); // lock-free, there is a single producer
+    if (res) {                                  // the lock is needed to not miss a reader which
+        spin_lock (&fifo->lock);                // found the ring empty and is going to wait
+        fifo_wakeup (fifo);
+        spin_unlock (&fifo->lock);
     }
-    return FAILURE;
+    return res;
+}
+
+unsigned fifo_dev_pop (struct fifo_s *fifo, char *buf, unsigned count)
+{
+    unsigned res = ring_pop (&fifo->ring, buf, count);  // lock-free, there is a single consumer
+    if (res) {                                  // the lock is needed to not miss a writer which
+        spin_lock (&fifo->lock);                // found the ring full and is going to wait
+        fifo_wakeup (fifo);
+        spin_unlock (&fifo->lock);
+    }
+    return res;
+}
+
+int fifo_push (struct fifo_s *fifo, char c)
+{
+    return (fifo_dev_push (fifo, &c, 1)) ? SUCCESS : FAILURE;
 }
 
 int fifo_pull (struct fifo_s *fifo, char *c)
 {
-    if (fifo->pt_read != fifo->pt_write) {
-        *c = fifo->data [fifo->pt_read];
-        fifo->pt_read = (fifo->pt_read + 1)% sizeof(fifo->data);
-        return SUCCESS;
+    spin_lock (&fifo->lock);                    // a single consumer at a time
+    unsigned res = ring_pop (&fifo->ring, c, 1);
+    spin_unlock (&fifo->lock);
+    return (res) ? SUCCESS : FAILURE;
+}
+
+unsigned fifo_read (struct fifo_s *fifo, char *buf, unsigned count)
+{
+    unsigned res = 0;
+    while (count) {
+        spin_lock (&fifo->lock);                // a single consumer at a time
+        res = ring_pop (&fifo->ring, buf, count);   // all the available chars at once
+        if (res) {
+            if (ring_count (&fifo->ring))       // chars are left, give them to the next reader
+                fifo_wakeup (fifo);
+            spin_unlock (&fifo->lock);
+            break;
+        }
+        if (!thread_may_wait ()) {              // no thread yet, thus polling
+            spin_unlock (&fifo->lock);
+            irq_enable ();                      // get few characters
+            irq_disable ();                     // close enter
+            continue;
+        }
+        thread_addlast (&fifo->wait, ThreadCurrent); // the next fifo_dev_push() notifies it
+        spin_unlock (&fifo->lock);
+        thread_wait_io ();                      // other threads run meanwhile
+    }
+    return res;
+}
+
+unsigned fifo_write (struct fifo_s *fifo, const char *buf, unsigned count, int wait)
+{
+    unsigned res = 0;
+    while (count) {
+        spin_lock (&fifo->lock);                // a single producer at a time
+        res = ring_push (&fifo->ring, buf, count);  // as many chars as possible at once
+        if (res) {
+            if (ring_space (&fifo->ring))       // room is left, give it to the next writer
+                fifo_wakeup (fifo);
+            spin_unlock (&fifo->lock);
+            break;
+        }
+        if (!wait || !thread_may_wait ()) {     // kernel writer or no thread yet, the caller
+            spin_unlock (&fifo->lock);          // makes room
+            break;
+        }
+        thread_addlast (&fifo->wait, ThreadCurrent); // the next fifo_dev_pop() notifies it
+        spin_unlock (&fifo->lock);
+        thread_wait_io ();                      // other threads run meanwhile
     }
-    return FAILURE;
+    return res;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -224,7 +332,8 @@ void kcmd (int tty)
 
 void tick_event (void)
 {
-    thread_yield();
+    ktimer_event();                             // expired timers of the CPU, e.g. the quantum
+    thread_preempt();                           // then the thread may lose the CPU
     kcmd(0);
 }
 
@@ -37,6 +37,7 @@
 #include <common/esc_code.h>        // ANSI escape code
 #include <common/cstd.h>            // generic C functions
 #include <common/list.h>            // generic list management
+#include <common/ring.h>            // lock-free SPSC ring buffer
 #include <common/errno.h>           // standard error code number
 #include <common/syscalls.h>        // syscall's codes
 #include <common/kshell_syscalls.h> // kshell syscall's codes
@@ -67,6 +68,7 @@
 #include <kernel/kdev.h>            // dynamic devices allocation
 #include <kernel/kmemkernel.h>      // kernel allocators
 #include <kernel/kmemuser.h>        // kernel part of user allocators 
+#include <kernel/ktimer.h>          // one-shot kernel timers
 #include <kernel/kthread.h>         // thread functions and scheduler
 #include <kernel/ksynchro.h>        // mutex, barrier and similar functions
 #include <kernel/kshell.h>          // kshell syscall
@@ -76,7 +78,7 @@
 #define PRINTF_MAX 512  /* largest printed message */
 #define CEIL(a,b)       ((int)(b)*(((int)(a)+(int)(b)-1)/(int)(b))) /* round up a aligned on b */
 #define FLOOR(a,b)      ((int)(b)*((int)(a)/(int)(b)))              /* round down a aligned on b */
-#define FIFO_DEPTH 20   /* maximum fifo depth */
+#define FIFO_DEPTH 256  /* fifo depth, a power of 2 (see common/ring.h) */
 
 #define V(fmt,v) kprintf("%s : "fmt, #v, (v))
 
@@ -139,9 +141,26 @@ extern int tty_read (int tty, char *buf, unsigned count);
  * \param tty   the TTY's number
  * \param buf   target buffer sent to the tty
  * \param count number of bytes to read into buffer
+ * \note  the current thread never sleeps, when the output is full the device is polled, thus
+ *        tty_write() may be called by an ISR, under a spinlock or by kmalloc() (kprintf())
  */
 extern int tty_write (int tty, char *buf, unsigned count);
 
+/**
+ * \brief Same as tty_write() but the current thread may sleep while the output is full,
+ *        it is the write() syscall, the kernel must use tty_write().
+ * \param tty   the TTY's number
+ * \param buf   target buffer sent to the tty
+ * \param count number of bytes to write
+ */
+extern int tty_write_user (int tty, char *buf, unsigned count);
+
+/**
+ * \brief Send the buffered output chars of all TTYs by polling, then the next writes are
+ *        synchronous. It is used when the IRQ can no longer be handled, i.e. by kdump().
+ */
+extern void tty_sync (void);
+
 /**
  * \brief     write a single char to the tty
  * \param     tty   tty number (between 0 and NTTYS-1)
@@ -175,25 +194,56 @@ extern int tty_puts (int tty, char *buf);
 extern int tty_gets (int tty, char *buf, int count);
 
 /**
- * \brief Simple fifo (1 writer - 1 reader)
- *          - data      buffer of data
- *          - pt_write  write pointer for L fifos (0 at the beginning)
- *          - pt_read   read pointer for L fifos (0 at the beginning)
- *
- *        data[] is used as a circular array. At the beginning (pt_read == pt_write) means an empty fifo
- *        then when we push a data, we write it at pt_write, the we increment pt_write % fifo_size.
- *        The fifo is full when it remains only one free cell, then when (pt_write + 1)%size == pt_read
+ * \brief Chardev fifo, it is a SPSC ring (see common/ring.h) with a queue of waiting threads
+ *          One side is the device (its ISR), the other side are the threads, thus:
+ *          - for an input fifo, the ISR pushes a burst of chars with fifo_dev_push(), and the
+ *            threads read them with fifo_read(), they wait in the queue while it is empty,
+ *          - for an output fifo, the threads write chars with fifo_write(), they wait in the queue
+ *            while it is full (only in the write() syscall, the kernel writers poll the device),
+ *            and the ISR pops a burst of chars with fifo_dev_pop().
+ *          The device side does not take any lock to access the ring, it takes the lock only to
+ *          notify the first waiting thread. The lock serializes the threads (thus there is a single
+ *          producer or consumer at a time on their side) and it protects the wait queue.
+ *          Each thread copies as many chars as possible at once, thus it does not poll the fifo.
  */
 struct fifo_s {
-    char data [FIFO_DEPTH];         ///< Circular array
-    unsigned pt_read;               ///< Read pointer
-    unsigned pt_write;              ///< Write pointer
+    ring_t ring;                    ///< lock-free ring of chars
+    char data [FIFO_DEPTH];         ///< its circular array
+    spinlock_t lock;                ///< serializes the threads and protects wait
+    list_t wait;                    ///< waiting threads, notified by the device side
 };
 
 /* Helper functions for CHARDEV's FIFOs */
 
 /**
- * \brief   push a character into the chardev's FIFO
+ * \brief   initialize an empty chardev's FIFO without waiting thread
+ * \param   fifo    structure of fifo to initialize
+ */
+extern void fifo_init (struct fifo_s *fifo);
+
+/**
+ * \brief   push as many chars as possible into the chardev's FIFO, then notify a waiting reader
+ *          It is called by the ISR of the device, the single producer.
+ * \param   fifo    structure of fifo to store data
+ * \param   buf     chars to write
+ * \param   count   number of chars in buf
+ * \return  number of chars pushed, the others are lost because the FIFO is full
+ */
+extern unsigned fifo_dev_push (struct fifo_s *fifo, const char *buf, unsigned count);
+
+/**
+ * \brief   pop as many chars as possible from the chardev's FIFO, then notify a waiting writer
+ *          It is called by the ISR of the device, the single consumer (or by a polling function
+ *          serialized with the ISR by the driver).
+ * \param   fifo    structure of fifo to get data
+ * \param   buf     buffer where the chars are copied
+ * \param   count   size of buf
+ * \return  number of chars popped, 0 if the FIFO is empty
+ */
+extern unsigned fifo_dev_pop (struct fifo_s *fifo, char *buf, unsigned count);
+
+/**
+ * \brief   push a character into the chardev's FIFO (device side)
  * \param   fifo    structure of fifo to store data
  * \param   c       char to write
  * \return  SUCCESS or FAILURE
@@ -201,7 +251,32 @@ struct fifo_s {
 extern int fifo_push (struct fifo_s *fifo, char c);
 
 /**
- * \brief   pop a character from the chardev's FIFO
+ * \brief   pop all the available chars (count at most) from the chardev's FIFO, wait if it is empty
+ *          The current thread waits for an I/O (see thread_wait_io()) until the ISR pushes a char
+ *          but before the first thread is loaded, it polls the FIFO with IRQ enabled briefly.
+ * \param   fifo    structure of fifo to store data
+ * \param   buf     buffer where the chars are copied
+ * \param   count   size of buf
+ * \return  number of chars read, at least 1 if count > 0
+ */
+extern unsigned fifo_read (struct fifo_s *fifo, char *buf, unsigned count);
+
+/**
+ * \brief   push as many chars as possible (count at most) into the chardev's FIFO, wait if it is
+ *          full. The current thread waits for an I/O until the ISR pops chars, but if it must not
+ *          wait (!wait, kernel writers) or cannot wait (before the first thread is loaded) it
+ *          returns 0, then the caller must make room by itself, for instance by sending the chars
+ *          to the device by polling.
+ * \param   fifo    structure of fifo to store data
+ * \param   buf     chars to write
+ * \param   count   number of chars in buf
+ * \param   wait    1 if the thread may wait (write() syscall), 0 for the kernel writers
+ * \return  number of chars written, at least 1 if count > 0 and if the thread may wait
+ */
+extern unsigned fifo_write (struct fifo_s *fifo, const char *buf, unsigned count, int wait);
+
+/**
+ * \brief   pop a character from the chardev's FIFO, without waiting
  * \param   fifo    structure of fifo to store data
  * \param   c       pointer on char to put the read char 
  * \return  SUCCESS or FAILURE
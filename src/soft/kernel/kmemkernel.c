@@ -9,53 +9,94 @@
   \brief    kernel allocators 
 
   This file contains the kernel memory management
-  * The physical page management
+  * The physical page management (buddy allocator)
   * Slab allocator dedicated to the use of the kernel for all its objects
 
+  Buddy allocator
+
+    * A block is a set of 2^order contiguous pages, aligned on its size (from the kmb address).
+      The buddy of the block of page index i is the block of page index i ^ (1<<order), both
+      are the two halves of the block of order+1 at page index i & ~(1<<order).
+    * FreeArea[order] is the list of the free blocks of 2^order pages, chained by their first
+      page with the list API. The Page[] descriptor of this first page is tagged buddy.head with
+      the order, the descriptors of the other pages of a free block are just PAGE_FREE.
+    * kmalloc_pages(order) takes a block in the first non empty FreeArea[] from order, and
+      splits it as many times as needed, the upper halves go to the lower FreeArea[] lists.
+    * kfree_pages() merges the block with its buddy as long as the buddy is a free block of the
+      same order, then the merged block goes in its FreeArea[].
+    * At initialization, the kmb..kme region is cut into the largest aligned blocks.
+    * kmalloc_pages_split() cuts a block into pages of order 0, thus contiguous pages that are
+      freed one by one, the pages beyond the asked count are given back at once.
+    * Whole pages and slabs are blocks of order 0, the descriptor of an allocated block keeps its
+      order (slab.order) thus kfree() of the first page is enough to free a block.
+
   Slab allocator
 
     * Allocate objects (aligned on a cache line) into slabs.
     * A slab is a segment (aligned on a page) that contains a single type of object.
     * In general, for large objects (> 1/8 page = 512 bytes), larger slabs (2 pages or 4 pages)
       are used to reduce external fragmentation.
-    * The size of allocated objects is one page maximum.
-
-    Structure list_t Slab[]
-      * For allocation, the main structure is the Slab[] table.
-      * Slab[] is indexed by the size of the object in cache line units (CacheLineSize).
-      * The same size free objects are chained together with the ?list? API.
-      * Slab[i] is thus the root of objects which are *CacheLineSize bytes
-      * Slab[0] is for objects of a whole page, thus Slab[0] is the root of  the whole pages list
+    * The size of allocated objects is one page maximum, kmalloc() of more than a page gives a
+      block of the buddy allocator.
+
+    Slab descriptors
+      * A slab is a page cut into objects of the same size, in cache line units (CacheLineSize).
+      * Each slab owns the list of its free objects, the first word of a free object points to
+        the next free object of the same slab. The head of this list is stored in the Page[]
+        descriptor of the slab as an object index (slab.free), with the number of used objects.
+      * Partial[i] is the first of the slabs of i*CacheLineSize objects having free objects and
+        used objects. The slabs are doubly linked with page indexes stored in their descriptor.
+      * A full slab is in no list, it goes back to Partial[i] when one of its objects is freed.
+      * An empty slab is not kept, it goes back to the buddy allocator immediately.
 
     void memory_init (void)
-      * All cells of Slab[] table are initialized empty (with list_init()) but slab[0]
-      * Slab[0] is initialized with all free pages.
+      * All Partial[] lists are initialized empty, and FreeArea[] with all free pages.
 
     void * kmalloc (size_t size)
       * For these following cases, if there is a problem, it is a panic situation. That's the end.
         * the desired size is greater than one page
         * the desired size is one page, but there is no more free page availabble
+        even after asking the block cache to give back an unused page (blockio_reclaim())
       * The usual case is
         * calculate lines that is the minimum number of cache lines containing the requested size
-        * lines is actually the type of slab, and thus the slab number
-        * get the first object of Slab[lines] list (with list_getfirst()) and return it
-      * If there is no more free objects in Slab[lines]
-        * call kmalloc(PAGE_SIZE) itself to get a full page*
-        * split the new page into as many free object of nbline size,
-        * each piece is added to the Slab[lines] list (with list_addlast())
-        * then get the first object of Slab[lines] list (with list_getfirst()) and return it
+        * lines is actually the type of slab
+        * take the first free object of the first slab in Partial[lines] and return it
+        * if this slab has no more free objects, it is unlinked from Partial[lines] (full)
+      * If Partial[lines] is empty
+        * get a free page from the buddy allocator
+        * chain all its objects of lines size in the free list of the new slab
+        * and add the new slab in Partial[lines]
       * The return object is cleared (with 0) to reduce the risk of fealure in case of bad reuse
+        kmalloc() is kzalloc(), kmalloc_nozero() does not clear the object for the callers
+        that overwrite it entirely at once, such as the block cache for its pages.
+      * Objects smaller than a page are first taken from the magazine of the CPU (see below)
 
     void kfree (void * addr)
       * For these following cases, if there is a problem, it is a panic situation. That's the end.
         * the addr is not inside the kernel heap
       * The usual case is
         * retreave the page number to discover the slab type thanks to the Page[] structure
-        * put the object back at the beginning of the list Slab[lines]
-        * if the size is exactly one page, return kfree
-        * otherwise, decrement the number of objects allocated in the current slab/page
-        * if this number is 0 then unlink all objects belonging to the current slab/page
-        * then put the tile/page back in slab[0] (free pages)
+        * if the size is one page or more, put it back in the buddy allocator and return
+        * otherwise, put the object at the beginning of the free list of its slab
+        * and decrement the number of objects allocated in the slab
+        * if the slab was full, it is linked again in Partial[lines]
+        * if this number is 0 then the slab is unlinked from Partial[lines] and put back in
+          the buddy allocator, without browsing any object, thus kfree() is always O(1)
+      * Objects smaller than a page are first put back in the magazine of the CPU (see below)
+
+  Per-CPU magazines
+
+    * Slabs and ObjectsThisSize[] are shared by all CPUs, they are protected by SlabLock.
+    * Magazine[cpu][lines] is a small free list of objects of lines size owned by a CPU.
+      kmalloc() and kfree() of an object smaller than a page only use the magazine of the current
+      CPU, without lock, since the kernel code runs with IRQ disabled.
+    * When the magazine is empty, kmalloc() refills it with KMAG_BATCH objects taken from
+      Partial[lines] under SlabLock. When it is full (KMAG_SIZE objects), kfree() gives KMAG_BATCH
+      objects back to their slabs. Thus SlabLock is taken once every KMAG_BATCH operations.
+    * From the slab point of view, the objects in a magazine are allocated, thus a slab page
+      can return to the buddy allocator only when its objects have left the magazines.
+    * Whole pages are not kept in magazines, FreeArea[] must remain the lists of all free pages
+      because kmalloc() asks the block cache for pages when it is empty.
 
 \*------------------------------------------------------------------------------------------------*/
 
@@ -77,6 +118,7 @@ static size_t NbPages;                  // Total number of pages in kernel memor
 #define SEGFAULT(addr) (((char *)(addr) < kmb)||((char *)(addr) >= kme))
 #define PAGEINDEX(page) (size_t)(((char *)(page)-(char *)kmb)>>12;
 #define PAGE(page) ((((char*)(page) - kmb)>>12)%NbPages)
+#define PAGEADDR(pageidx) (char *)((size_t)kmb + ((pageidx)<<12)) // address of page pageidx
 
 // Variables for kernel memory allocator -----------------------------------------------------------
 
@@ -90,10 +132,19 @@ typedef union {                         // page usage description
     unsigned long long raw;             // 64 bits 
     struct {
         unsigned type:2;                // type of page SLAB
-        unsigned reserved:14;           // not used yet
-        unsigned lines:8;               // object size in number of cache lines 
-        unsigned nbused:8;              // number of used objects is this slab
+        unsigned free:9;                // index of the first free object, SLAB_NOFREE if full
+        unsigned lines:8;               // object size in number of cache lines (0 in BLOCK pages)
+        unsigned order:4;               // log2 of the number of pages (0 in BLOCK pages)
+        unsigned nbused:9;              // number of used objects is this slab (256 at most)
+        unsigned prev:16;               // previous slab in Partial[lines] or SLAB_NONE
+        unsigned next:16;               // next slab in Partial[lines] or SLAB_NONE
     } slab;
+    struct {
+        unsigned type:2;                // type of page FREE
+        unsigned head:1;                // first page of a free block, in FreeArea[order]
+        unsigned reserved:16;           // not used
+        unsigned order:4;               // log2 of the number of pages in the free block
+    } buddy;
     struct {
         unsigned type:2;                // type of page BLOCK
         unsigned bdev:4;                // to have several disks 
@@ -108,8 +159,23 @@ typedef union {                         // page usage description
 
 static page_t Page[DATARAMSIZE>>12];    // DATARAMSIZE / 4kB (size = ((256<<20)>>12)<<3 = 512 kB
 
-static list_t Slab[256];                // free lists, Slab[i]-> i*CacheLineSize, Slab[0]-> pages
+#define SLAB_NONE   0xFFFF              // no slab in Partial[] or prev/next (NbPages < 0xFFFF)
+#define SLAB_NOFREE 0x1FF               // no free object in slab.free
+
+static list_t FreeArea[PAGE_ORDER_MAX+1]; // FreeArea[o] -> free blocks of 2^o pages
+static unsigned short Partial[256];     // Partial[i] -> first slab of i*CacheLineSize objects
 static size_t ObjectsThisSize[256];     // ObjectsThisSize[i]= allocated objets of i*CacheLineSize
+static spinlock_t SlabLock;             // protects slabs and ObjectsThisSize[] (shared by CPUs)
+
+#define KMAG_SIZE   16                  // maximum number of objects in a magazine
+#define KMAG_BATCH  (KMAG_SIZE/2)       // number of objects moved from/to slabs at once
+
+typedef struct kmag_s {                 // per-CPU cache of free objects of the same size
+    list_t objs;                        // free objects
+    unsigned nobj;                      // number of objects in objs
+} kmag_t;
+
+static kmag_t Magazine[NCPUS_MAX][256]; // Magazine[cpu][i] -> i*CacheLineSize objects of the cpu
 
 
 //--------------------------------------------------------------------------------------------------
@@ -117,7 +183,6 @@ static size_t ObjectsThisSize[256];     // ObjectsThisSize[i]= allocated objets
 //--------------------------------------------------------------------------------------------------
 
 void page_set_free (void *page)  { Page[PAGE(page)].block.type   = PAGE_FREE;  }
-void page_set_block (void *page) { Page[PAGE(page)].block.type   = PAGE_BLOCK; }
 void page_set_slab (void *page)  { Page[PAGE(page)].block.type   = PAGE_SLAB;  }
 void page_set_valid (void *page) { Page[PAGE(page)].block.valid  = 1; }
 void page_set_lock (void *page)  { Page[PAGE(page)].block.lock = 1; }
@@ -150,6 +215,12 @@ int page_dec_refcount (void *page)
     return Page[PAGE(page)].block.refcount = refcount-1;
 }
 
+void page_set_block (void *page)                            // page just given by kmalloc(PAGE_SIZE)
+{
+    Page[PAGE(page)].raw = PAGE_FREE;                       // forget all slab fields
+    Page[PAGE(page)].block.type = PAGE_BLOCK;               // then it is a clean unreferenced block
+}
+
 void page_set_lba(void *page, unsigned bdev, unsigned lba) {
     Page[PAGE(page)].block.bdev = bdev; 
     Page[PAGE(page)].block.lba  = lba; 
@@ -173,40 +244,346 @@ void kmemkernel_init (void)
     NbPages = (kme-kmb)/PAGE_SIZE;                          // maximum number of pages
     MaxLineSlab = PAGE_SIZE / CacheLineSize;                // 256 when line is 16, 128 for 32, etc.
 
-    for (int i = 0 ; i < MaxLineSlab ; i++)                 // initialize each list is Slab table
-        list_init (&Slab[i]);                               // Slab[i] -> i*cachelinesize objects
-    for (char *p = kmb; p != kme; p += PAGE_SIZE) {         // initialize the page (slab) list
-        list_addlast (&Slab[0], (list_t *)p);               // pointed by Slab[0]
-        Page[PAGE(p)].raw = PAGE_FREE;                      // this page is free
+    for (int i = 0 ; i < MaxLineSlab ; i++)                 // no slab at all, thus no partial
+        Partial[i] = SLAB_NONE;                             // Partial[i] -> i*cachelinesize objects
+    for (int c = 0 ; c < NCPUS_MAX ; c++)                   // and each magazine, all are empty
+        for (int i = 0 ; i < MaxLineSlab ; i++)
+            list_init (&Magazine[c][i].objs);
+    for (int o = 0 ; o <= PAGE_ORDER_MAX ; o++)             // no free block yet
+        list_init (&FreeArea[o]);
+    for (size_t i = 0 ; i < NbPages ; i++)                  // all pages are free
+        Page[i].raw = PAGE_FREE;
+    for (size_t i = 0, o ; i < NbPages ; i += 1 << o) {     // cut the memory in blocks
+        for (o = PAGE_ORDER_MAX; (i & ((1<<o)-1)) || (i + (1<<o) > NbPages); o--);
+        Page[i].buddy.head = 1;                             // the largest aligned block at i
+        Page[i].buddy.order = o;
+        list_addlast (&FreeArea[o], (list_t *)PAGEADDR(i)); // pointed by FreeArea[o]
     }
 }
 
 //--------------------------------------------------------------------------------------------------
 
-void * kmalloc (size_t size)
+/**
+ * \brief   add a slab at the beginning of Partial[lines], SlabLock must be held
+ * \param   lines   object size in cache lines
+ * \param   pageidx page number of the slab
+ * \return  nothing
+ */
+static void slab_link (size_t lines, unsigned pageidx)
+{
+    unsigned first = Partial[lines];
+    Page[pageidx].slab.prev = SLAB_NONE;
+    Page[pageidx].slab.next = first;
+    if (first != SLAB_NONE)
+        Page[first].slab.prev = pageidx;
+    Partial[lines] = pageidx;
+}
+
+/**
+ * \brief   remove a slab from Partial[lines], SlabLock must be held
+ * \param   lines   object size in cache lines
+ * \param   pageidx page number of the slab
+ * \return  nothing
+ */
+static void slab_unlink (size_t lines, unsigned pageidx)
+{
+    unsigned prev = Page[pageidx].slab.prev;
+    unsigned next = Page[pageidx].slab.next;
+    if (prev != SLAB_NONE) Page[prev].slab.next = next;     // prev is not the first
+    else                   Partial[lines] = next;           // else next becomes the first
+    if (next != SLAB_NONE) Page[next].slab.prev = prev;
+}
+
+/**
+ * \brief   take a free block of 2^order pages in FreeArea[], SlabLock must be held
+ * \param   order   log2 of the number of pages
+ * \return  the first page of the block, or NULL if there is no free block large enough
+ */
+static void *buddy_get (unsigned order)
+{
+    unsigned o = order;
+    while ((o <= PAGE_ORDER_MAX) && list_isempty (&FreeArea[o]))
+        o++;                                                // first non empty FreeArea[]
+    if (o > PAGE_ORDER_MAX)
+        return NULL;
+
+    void * res = list_getfirst (&FreeArea[o]);
+    unsigned pageidx = PAGE(res);
+    Page[pageidx].raw = PAGE_FREE;                          // it is no longer a free block
+    while (o > order) {                                     // too large, split it
+        o--;                                                // the upper half is a free block
+        unsigned buddy = pageidx + (1 << o);
+        Page[buddy].buddy.head = 1;
+        Page[buddy].buddy.order = o;
+        list_addfirst (&FreeArea[o], (list_t *)PAGEADDR(buddy));
+    }
+    return res;
+}
+
+/**
+ * \brief   put a block of 2^order pages back in FreeArea[] and merge it with its free buddies,
+ *          SlabLock must be held
+ * \param   block   first page of the block
+ * \param   order   log2 of the number of pages
+ * \return  nothing
+ */
+static void buddy_put (void * block, unsigned order)
+{
+    unsigned pageidx = PAGE(block);
+    while (order < PAGE_ORDER_MAX) {
+        unsigned buddy = pageidx ^ (1 << order);            // the other half of the larger block
+        if ((buddy + (1 << order) > NbPages)                // out of the kernel memory
+        ||  (Page[buddy].buddy.type != PAGE_FREE)           // or used
+        ||  (Page[buddy].buddy.head == 0)                   // or part of another free block
+        ||  (Page[buddy].buddy.order != order))             // or split
+            break;
+        list_unlink ((list_t *)PAGEADDR(buddy));            // the buddy leaves FreeArea[order]
+        Page[buddy].raw = PAGE_FREE;                        // it is just a page of the new block
+        pageidx &= ~(1 << order);                           // first page of the merged block
+        order++;
+    }
+    Page[pageidx].raw = PAGE_FREE;
+    Page[pageidx].buddy.head = 1;
+    Page[pageidx].buddy.order = order;
+    list_addfirst (&FreeArea[order], (list_t *)PAGEADDR(pageidx));
+}
+
+/**
+ * \brief   take a free block of 2^order pages, SlabLock must be held but it is released while
+ *          the block cache is asked to give pages back, since it calls kfree()
+ * \param   order   log2 of the number of pages
+ * \return  the first page of the block, panic if there is no more free block large enough
+ */
+static void *slab_get_pages (unsigned order)
+{
+    void * res = buddy_get (order);
+    while (res == NULL) {                                   // memory pressure
+        spin_unlock (&SlabLock);                            // kfree() will be called
+        unsigned freed = blockio_reclaim (1);               // evict an unused block from the cache
+        spin_lock (&SlabLock);
+        res = buddy_get (order);                            // the freed page may be merged
+        PANIC_IF ((res == NULL) && (freed == 0),            // nothing more can be freed
+            "No more kernel data space");                   // write a message then panic
+    }
+    ObjectsThisSize [0] += 1 << order;                      // increment the number of pages used
+    Page[PAGE(res)].slab.type = PAGE_SLAB;                  // page used as a slab, lines 0
+    Page[PAGE(res)].slab.order = order;                     // of 2^order pages
+    Page[PAGE(res)].slab.nbused = 1;                        // of a single object
+    return res;
+}
+
+/**
+ * \brief   put a block back in FreeArea[], its order is in its descriptor, SlabLock must be held
+ * \param   pages   first page of the block
+ * \return  nothing
+ */
+static void slab_put_pages (void * pages)
+{
+    unsigned order = Page[PAGE(pages)].slab.order;          // 0 for BLOCK pages
+    ObjectsThisSize[0] -= 1 << order;                       // decr the number of pages used
+    buddy_put (pages, order);
+}
+
+/**
+ * \brief   create a new slab of lines objects and add it in Partial[lines], SlabLock must be held
+ * \param   lines   object size in cache lines, greater than 0
+ * \return  nothing
+ */
+static void slab_new (size_t lines)
+{
+    char *page = slab_get_pages (0);                        // ask for a free page (i.e. slab)
+    unsigned pageidx = PAGE(page);
+    size_t size = lines * CacheLineSize;
+    char *p;
+    for (p = page; p + 2*size <= page + PAGE_SIZE; p += size) // cut the slab into objects
+        *(char **)p = p + size;                             // and chain them together
+    *(char **)p = NULL;                                     // p is the last object of the slab
+    Page[pageidx].slab.lines = lines;                       // this page is used as a slab of lines
+    Page[pageidx].slab.nbused = 0;                          // reset the allocated counter
+    Page[pageidx].slab.free = 0;                            // the first free object is the first
+    slab_link (lines, pageidx);
+}
+
+/**
+ * \brief   take the first free object of the first slab of Partial[lines], SlabLock must be held
+ * \param   lines   object size in cache lines, greater than 0
+ * \return  the object, Partial[lines] must not be empty
+ */
+static void *slab_get (size_t lines)
+{
+    unsigned pageidx = Partial[lines];                      // the first partial slab
+    char *page = PAGEADDR(pageidx);
+    size_t size = lines * CacheLineSize;
+    char *obj = page + Page[pageidx].slab.free * size;      // obj is its first free object
+    char *next = *(char **)obj;                             // next free object in the slab
+    Page[pageidx].slab.free = (next) ? (next - page) / size : SLAB_NOFREE;
+    Page[pageidx].slab.nbused++;                            // one more times
+    ObjectsThisSize [lines]++;                              // increment the number of objects
+    if (next == NULL)                                       // no more free object, the slab is
+        slab_unlink (lines, pageidx);                       // full, thus it leaves Partial[lines]
+    return obj;
+}
+
+/**
+ * \brief   put an object back in its slab, SlabLock must be held
+ *          if it is the last object used in its slab, the page goes back to FreeArea[0]
+ * \param   obj     the object, smaller than a page
+ * \return  nothing
+ */
+static void slab_put (void * obj)
+{
+    unsigned pageidx = PAGE(obj);                           // pageidx is the page where the obj is
+    size_t lines = Page[pageidx].slab.lines;                // which slab to use
+    char *page = PAGEADDR(pageidx);
+    size_t size = lines * CacheLineSize;
+    unsigned free = Page[pageidx].slab.free;                // SLAB_NOFREE if the slab is full
+    *(char **)obj = (free == SLAB_NOFREE) ? NULL : page + free * size;
+    Page[pageidx].slab.free = ((char *)obj - page) / size;  // obj is the first free object now
+    ObjectsThisSize[lines]--;                               // decr the number of obj of size lines
+    if (--Page[pageidx].slab.nbused == 0) {                 // if no more object left is this slab
+        if (free != SLAB_NOFREE)                            // it was in Partial[lines]
+            slab_unlink (lines, pageidx);
+        slab_put_pages (page);                              // the empty slab is a free page now
+    } else if (free == SLAB_NOFREE) {                       // the slab was full
+        slab_link (lines, pageidx);                         // it has a free object now
+    }
+}
+
+/**
+ * \brief   refill an empty magazine with KMAG_BATCH objects of Partial[lines]
+ * \param   mag     the magazine of the current CPU
+ * \param   lines   object size in cache lines
+ * \return  nothing, but mag contains at least one object
+ */
+static void kmag_refill (kmag_t *mag, size_t lines)
+{
+    spin_lock (&SlabLock);                                  // !--! critical section
+    while (mag->nobj < KMAG_BATCH) {
+        if (Partial[lines] == SLAB_NONE) {                  // if no more object in the slabs
+            if (mag->nobj) break;                           // what we have is enough
+            slab_new (lines);                               // ask for a new slab
+        }
+        list_addlast (&mag->objs, slab_get (lines));        // allocated from the slab view
+        mag->nobj++;
+    }
+    spin_unlock (&SlabLock);                                // !--! end of critical section
+}
+
+/**
+ * \brief   give KMAG_BATCH objects of a full magazine back to their slabs
+ * \param   mag     the magazine of the current CPU
+ * \return  nothing
+ */
+static void kmag_drain (kmag_t *mag)
+{
+    spin_lock (&SlabLock);                                  // !--! critical section
+    while (mag->nobj > KMAG_SIZE - KMAG_BATCH) {
+        slab_put (list_getlast (&mag->objs));               // the least recently freed first
+        mag->nobj--;
+    }
+    spin_unlock (&SlabLock);                                // !--! end of critical section
+}
+
+/**
+ * \brief   allocate a block of 2^order pages without clearing it
+ * \param   order   log2 of the number of pages
+ * \return  the first page of the block, panic if it is too big or if there is no more space
+ */
+static void * pages_alloc (unsigned order)
+{
+    PANIC_IF (order > PAGE_ORDER_MAX,                       // larger than the largest block
+        "%d pages is too big", 1 << order);                 // write a message then panic
+
+    spin_lock (&SlabLock);                                  // !--! critical section
+    void * res = slab_get_pages (order);
+    spin_unlock (&SlabLock);                                // !--! end of critical section
+    return res;
+}
+
+void * kmalloc_pages (unsigned order)
 {
-    PANIC_IF (size > PAGE_SIZE,                             // kmalloc is for small object
-        "%d is too big, more than a single page", size);    // write a message then panic
-    PANIC_IF ((size==PAGE_SIZE) && list_isempty (&Slab[0]), // free page are listed in Slab[0]
-        "No more kernel data space");                       // write a message then panic
+    void * res = pages_alloc (order);
+    memset (res, 0, PAGE_SIZE << order);                    // clear allocated memory
+    return res;
+}
+
+void * kmalloc_pages_split (unsigned count)
+{
+    unsigned order = 0;
+    while ((1 << order) < count)                            // smallest block for count pages
+        order++;
+    if ((count == 0) || (order > PAGE_ORDER_MAX))
+        return NULL;
+
+    spin_lock (&SlabLock);                                  // !--! critical section
+    char * res = buddy_get (order);                         // only a free block, no reclaim
+    if (res) {
+        unsigned pageidx = PAGE(res);
+        for (unsigned i = 0; i < (1 << order); i++) {
+            if (i >= count) {                               // the pages beyond count are
+                buddy_put (PAGEADDR(pageidx + i), 0);       // given back, merged with the others
+                continue;
+            }
+            Page[pageidx + i].raw = PAGE_FREE;              // each page is a block of order 0
+            Page[pageidx + i].slab.type = PAGE_SLAB;        // as given by kmalloc(PAGE_SIZE)
+            Page[pageidx + i].slab.nbused = 1;
+            ObjectsThisSize[0]++;
+        }
+    }
+    spin_unlock (&SlabLock);                                // !--! end of critical section
+    return res;
+}
+
+void kfree_pages (void * pages)
+{
+    PANIC_IF (SEGFAULT(pages) || ((size_t)pages & (PAGE_SIZE-1)),
+        "\nkfree_pages: %p is not a page", pages);          // write a message then panic
+    PANIC_IF ((Page[PAGE(pages)].slab.type == PAGE_FREE)    // attempt to free a free block
+           || (Page[PAGE(pages)].slab.lines != 0),          // or a slab of small objects
+        "\nkfree_pages: %p not allocated by kmalloc_pages()", pages);
+
+    spin_lock (&SlabLock);                                  // !--! critical section
+    slab_put_pages (pages);                                 // back to FreeArea[]
+    spin_unlock (&SlabLock);                                // !--! end of critical section
+}
+
+void * kmalloc_nozero (size_t size)
+{
+    if (size > PAGE_SIZE) {                                 // several pages, from the buddies
+        unsigned order = 0;
+        while ((PAGE_SIZE << order) < size)                 // smallest block for size
+            order++;
+        return pages_alloc (order);                         // panic if it is too big
+    }
 
     size_t lines = NBLINE(size);                            // required lines for size
     size = lines * CacheLineSize;                           // actual size asked
-    
-    if ((size!=PAGE_SIZE) && list_isempty (&Slab[lines])) { // if no more object in the slab
-        char *page = kmalloc (PAGE_SIZE);                   // ask for a free page (i.e. slab)
-        Page[PAGE(page)].slab.nbused = 0;                   // reset the allocated counter
-        for (char *p=page; p+size<=page+PAGE_SIZE; p+=size) // cut the slab into objects
-            list_addlast (&Slab[lines], (list_t *)p);       // and chain them together
+    void * res;
+
+    if (size == PAGE_SIZE) {                                // a whole page, from FreeArea[0]
+        spin_lock (&SlabLock);                              // !--! critical section
+        res = slab_get_pages (0);
+        spin_unlock (&SlabLock);                            // !--! end of critical section
+    } else {                                                // a small object, from the magazine
+        kmag_t *mag = &Magazine[cpuid()][lines];            // of the current CPU, without lock
+        if (mag->nobj == 0)                                 // if it is empty
+            kmag_refill (mag, lines);                       // then take objects in the slab
+        res = list_getfirst (&mag->objs);                   // res is the most recently freed
+        mag->nobj--;
     }
-    void * res = list_getfirst (&Slab[lines%MaxLineSlab]);  // res is the first object in list
-    ObjectsThisSize [lines % MaxLineSlab]++;                // increment the number of objects
-    Page[PAGE(res)].slab.lines = lines % MaxLineSlab;       // this page is used as a slab of nbline
-    Page[PAGE(res)].slab.nbused++;                          // one more times
-    Page[PAGE(res)].slab.type = PAGE_SLAB;                  // page used as a slab
+    return res;                                             // finally returns res
+}
 
+void * kzalloc (size_t size)
+{
+    void * res = kmalloc_nozero (size);
     memset (res, 0, size);                                  // clear allocated memory
-    return res;                                             // finally returns res
+    return res;
+}
+
+void * kmalloc (size_t size)
+{
+    return kzalloc (size);                                  // kmalloc() always clears
 }
 
 void *kcalloc(size_t n, size_t size)
@@ -222,25 +599,18 @@ void kfree (void * obj)
     size_t lines = Page[pageidx].slab.lines;                // which slab to use
     PANIC_IF ( Page[pageidx].slab.type == PAGE_FREE,        // attempt to free obj in a free page
         "\nkfree: double free of %p\n", obj);
-    
-    list_addfirst (&Slab[lines], (list_t *)obj);            // add it to the right free list
-    ObjectsThisSize[lines]--;                               // decr the number of obj of size lines
-    if (lines == 0) {                                       // obj is a page 
-        Page[pageidx].raw = PAGE_FREE;                      // return to free type
+
+    if (lines == 0) {                                       // obj is a page or a block
+        spin_lock (&SlabLock);                              // !--! critical section
+        slab_put_pages (obj);                               // back to FreeArea[]
+        spin_unlock (&SlabLock);                            // !--! end of critical section
         return;
     }
-    if (--Page[pageidx].slab.nbused == 0) {                 // if no more object left is this slab
-        list_t *page = (list_t *)((size_t)obj & ~0xFFF);    // address of the page containing obj
-        list_foreach (&Slab[lines], item) {                 // browse all item in free list
-            if (PAGE(item) == pageidx) {                    // if current item is in the page
-                list_unlink (item);                         // unlink it
-            }
-        }
-        Page[pageidx].raw = PAGE_FREE;                      // return to free type
-        Page[pageidx].slab.lines = 0;                       // since the page is empty, thus lines 0
-        list_addfirst (&Slab[0], (list_t *)page);           // add the free page in slab[O]
-        ObjectsThisSize[0]--;                               // decr the number of pages used
-    }
+    kmag_t *mag = &Magazine[cpuid()][lines];                // magazine of the current CPU
+    if (mag->nobj == KMAG_SIZE)                             // if it is full
+        kmag_drain (mag);                                   // then give objects back to the slab
+    list_addfirst (&mag->objs, (list_t *)obj);              // it will be the next allocated
+    mag->nobj++;
 }
 
 char * kstrdup (const char * str) 
@@ -264,8 +634,15 @@ void kmalloc_stat (void)
     kprintf ("\n(s) Object Size ; (f) Free Objects ; (a) Allocated Objects\n");
     for (size_t lines=0 ; lines<MaxLineSlab ; lines++) {    // for all slabs
         size_t sz = (lines) ? lines*CacheLineSize : 4096;   // size really allocated
-        size_t nf = list_nbobj (&Slab[lines]);              // number of free obj of size nline
-        size_t na = ObjectsThisSize[lines];                 // number of allocated obj of size nline
+        size_t nm = 0;                                      // number of obj in magazines
+        for (int c = 0 ; c < NCPUS_MAX ; c++)
+            nm += Magazine[c][lines].nobj;
+        size_t nf = nm;                                     // number of free obj of size nline
+        for (int o = 0; (lines == 0) && (o <= PAGE_ORDER_MAX); o++)
+            nf += list_nbobj (&FreeArea[o]) << o;           // free pages
+        for (unsigned p = Partial[lines]; lines && p != SLAB_NONE; p = Page[p].slab.next)
+            nf += PAGE_SIZE/sz - Page[p].slab.nbused;       // free obj in partial slabs
+        size_t na = ObjectsThisSize[lines] - nm;            // number of allocated obj of size nline
         if (nf+na) {                                        // if there is something to print
             kprintf ("|s %d\tf %d\ta %d", sz, nf, na);      // print data
             kprintf ((++cr%3)?"\t":"\t|\n");                // adds a \n all three print
@@ -278,7 +655,8 @@ void kmalloc_stat (void)
     kprintf ("\n(p) Page Number ; (s) Object Size ; (a) Allocated Objects\n");
     for (size_t p = 0; p < NbPages; p++) {                  // for all pages
         size_t ps = Page[p].slab.lines * CacheLineSize;     // for what slab[] it is used
-        size_t pa = Page[p].slab.nbused;                    // how many alloc objects there are in
+        size_t pa = (Page[p].slab.type == PAGE_SLAB) ?      // how many alloc objects there are in
+                    Page[p].slab.nbused : Page[p].block.refcount;
         if (pa) {                                           // if the page contain allocated object
             kprintf ("|p %d\ts %d\ta %d",p,ps,pa);          // print data
             kprintf ((++cr%3)?"\t":"\t|\n");                // adds a \n all three print
@@ -301,7 +679,7 @@ void kmalloc_test (size_t turn, size_t size)
     while (turn--) {                                        // the number of turn is configurable
         int sz = 1+(krand()+CacheLineSize/2) % size;        // choose a size
         size_t lines = NBLINE(sz);                          // required lines for size
-        lines %= MaxLineSlab;                               // if sz==PAGE_SIZE use Slab[0]
+        lines %= MaxLineSlab;                               // if sz==PAGE_SIZE use lines 0
         if (krand()%2) {                                    // alloc or free
             obj = kmalloc (sz);                             // allocate a new object
             list_addlast (&KMallocTest[lines], obj);        // add it in allocated object
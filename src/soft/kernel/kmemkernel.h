@@ -19,6 +19,7 @@
 
 /**
  * \brief Set the page type or Mark the given page as dirty / lock / valid.
+ *        page_set_block() resets the whole descriptor (flags, refcount and lba)
  * \param page Pointer to the page buffer.
  */
 void page_set_free (void *page);
@@ -81,15 +82,57 @@ void page_get_lba (void *page, unsigned *bdev, unsigned *lba);
  */
 void kmemkernel_init (void);
 
+#define PAGE_ORDER_MAX 10       ///< the largest block of kmalloc_pages() is 2^10 pages (4MB)
+
+/**
+ * \brief   allocate a block of contiguous pages in the kernel address space (buddy allocator)
+ * \param   order   log2 of the number of pages, at most PAGE_ORDER_MAX
+ * \return  a pointer to the first page of 2^order pages, aligned on the block size from the
+ *          beginning of the kernel heap. The block is cleared, panic if there is no more space
+ */
+void * kmalloc_pages (unsigned order);
+
+/**
+ * \brief   allocate count contiguous pages, each of them is then freed by its own kfree()
+ *          They are taken from the free blocks only, the block cache is not asked to give pages
+ *          back, thus the caller must be ready to allocate its pages one by one.
+ *          The pages are not cleared, they are for the callers that overwrite them (disk reads).
+ * \param   count   number of pages, at most 2^PAGE_ORDER_MAX
+ * \return  a pointer to the first page, or NULL if there is no free block large enough
+ */
+void * kmalloc_pages_split (unsigned count);
+
+/**
+ * \brief   free a block allocated by kmalloc_pages() or a page allocated by kmalloc()
+ * \param   pages   pointer to the first page, the order is known by the allocator
+ */
+void kfree_pages (void * pages);
+
 /**
  * \brief   allocate an object in the kernel address space
- * \param   size in bytes (must be at most a PAGE SIZE)
+ * \param   size in bytes, at most (PAGE_SIZE << PAGE_ORDER_MAX)
  * \return  a pointer to an object with at least "size" byte size
- *          It is rounded up to a whole number of cache lines.
+ *          It is rounded up to a whole number of cache lines, or to a block of kmalloc_pages()
+ *          when it is larger than a page.
  *          The segment allocated is cleared because this is safer
  */
 void * kmalloc (size_t size);
 
+/**
+ * \brief   same as kmalloc, kzalloc() makes it explicit that the object is cleared
+ * \param   size in bytes, at most (PAGE_SIZE << PAGE_ORDER_MAX)
+ * \return  a pointer to the cleared object
+ */
+void * kzalloc (size_t size);
+
+/**
+ * \brief   same as kmalloc but the object is not cleared, it contains what was there before
+ *          Only for the callers that write the whole object at once (disk read, string copy)
+ * \param   size in bytes, at most (PAGE_SIZE << PAGE_ORDER_MAX)
+ * \return  a pointer to an object with at least "size" byte size
+ */
+void * kmalloc_nozero (size_t size);
+
 /**
  * \brief   Duplicates a string in kernel memory using the slab allocator.
  * \param   str   The null-terminated string to duplicate.
@@ -21,6 +21,7 @@ static size_t CacheLineSize;            // max between 16 and the true cache lin
 //--------------------------------------------------------------------------------------------------
 
 static list_t FreeUserStack;            // free stack
+static spinlock_t UserMemLock;          // protects FreeUserStack, ustack_end and uheap_end
 
 extern int __kbss_end;                  // 1st char above kbss section see kernel.ld (page aligned)
 extern int __kdata_end;                 // 1st char above the kernel data region (page aligned)
@@ -37,6 +38,7 @@ void kmemuser_init()
 int * malloc_ustack (void)
 {
     int * top;                                              // top will be the new stack pointer
+    spin_lock (&UserMemLock);                               // !--! critical section
     int * end = (int *)list_getlast (&FreeUserStack);       // get last free stack (biggest addr)
     if (end == NULL) {                                      // if there is no more free stack
         top = __usermem.ustack_end;                         // try to get one
@@ -47,6 +49,7 @@ int * malloc_ustack (void)
     } else {
         top = end + USTACK_SIZE/sizeof(int);                // compute stack's top from stack's end
     }
+    spin_unlock (&UserMemLock);                             // !--! end of critical section
     top--;                                                  // get a word to put MAGIC
     *top = *end = MAGIC_STACK;                              // to be able to check free
     return top;                                             // finally return the top
@@ -69,6 +72,7 @@ void free_ustack (int * top)
     PANIC_IF (*top != MAGIC_STACK, "Corrupted top Stack");  // if no magic number then panic
     PANIC_IF (*end != MAGIC_STACK, "Corrupted end Stack");  // if no magic number then panic
 
+    spin_lock (&UserMemLock);                               // !--! critical section
     if (end ==__usermem.ustack_end) {                       // if it is the lowest stack
         __usermem.ustack_end += USTACK_SIZE/sizeof(int);    // shrink the stacks' region
         list_foreach (&FreeUserStack, stack) {              // foreach free stack
@@ -80,6 +84,7 @@ void free_ustack (int * top)
         }
     } else                                                  // else the freed stack isn't at the end
         list_addsort (&FreeUserStack,(list_t*)end,cmp_addr);// add it in free list in order
+    spin_unlock (&UserMemLock);                             // !--! end of critical section
 }
 
 void print_ustack (void)
@@ -118,12 +123,16 @@ void test_ustack (size_t turn)
 void * sbrk (int increment)
 {
     errno = SUCCESS;
+    spin_lock (&UserMemLock);                               // !--! critical section
     int * a = __usermem.uheap_end + increment/sizeof(int);  // sizeof() because uheap_end is int*
     a = (int *) FLOOR (a, CacheLineSize);                   // addr 'a' could be the new uheap_end
     if ((a<__usermem.uheap_beg)||(a>__usermem.ustack_end)){ // if it is outside the heap zone
+        spin_unlock (&UserMemLock);                         // !--! end of critical section
         errno = ENOMEM;
         return (void *)-1;                                  // -1 on failure
     }
+    __usermem.uheap_end = a;                                // the heap is extended or reduced
+    spin_unlock (&UserMemLock);                             // !--! end of critical section
     return a;                                               // else return a;
 }
 
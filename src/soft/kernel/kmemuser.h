@@ -38,9 +38,9 @@ void print_ustack (void);
 void test_ustack (size_t turn);
 
 /**
- * \brief   change the boundary of the heap
+ * \brief   change the boundary of the heap (__usermem.uheap_end), it cannot cross the stacks
  * \param   increment integer added to the current heap boundary
- * \return  SUCCESS or FAILURE
+ * \return  the new end of the heap, or (void *)-1 on failure
  */
 void * sbrk (int increment);
 
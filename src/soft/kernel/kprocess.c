@@ -23,5 +23,5 @@ typedef struct process_s * process_t;
  * \brief   process_s structure which contains all we need to run a process
  */
 struct process_s {
-// Thread & Scheduler : ThreadTab ; ThreadCurrentIdx ; ThreadCurrent
+// Thread & Scheduler : ThreadTab ; SchedQueue ; ThreadCurrent
 };
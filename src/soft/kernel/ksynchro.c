@@ -17,146 +17,145 @@
 // All synchro mecanism 
 //--------------------------------------------------------------------------------------------------
 
-static list_t MutexGroot;       ///< Mutex Global Root
 static list_t BarrierGroot;     ///< Barrier Global Root
+static list_t CondGroot;        ///< Condition variable Global Root
+static list_t RwlockGroot;      ///< Reader-writer lock Global Root
+
+#define FUTEX_BUCKETS   16      ///< number of futex wait queues, hashed on the futex address
+
+static struct futex_bucket_s {
+    spinlock_t  lock;           ///< protects the wait queue
+    list_t      wait;           ///< waiting threads of all the futexes hashed in this bucket
+} FutexBucket[FUTEX_BUCKETS];
 
 int ksynchro_init (void) 
 {
-    list_init (&MutexGroot);
     list_init (&BarrierGroot);
+    list_init (&CondGroot);
+    list_init (&RwlockGroot);
+    for (int b = 0; b < FUTEX_BUCKETS; b++)
+        list_init (&FutexBucket[b].wait);
     INFO ("Synchronization mecanismes successfully initialized");
     return 0;
 }
 
-//--------------------------------------------------------------------------------------------------
-// Mutex API
-//--------------------------------------------------------------------------------------------------
-
-struct thread_mutex_s {
-    spinlock_t  lock;           ///< protection against parallel modifications
-    unsigned    busy;           ///< 1 mutex is busy ; 0 mutex is free
-    list_t      wait;           ///< list element to chain threads that are wainting for the mutex
-    thread_t    owner;          ///< a thread has to be locked and unlocked by the same thread
-    list_t      glist;          ///< all mutex whatever the process it belongs are chained
-    int         pid;            ///< Process identifier owner
-};
-
 /**
- * Create and initialize a mutex
+ * \brief   remove a thread from a waiting list if it is still there, the lock of the list is held
+ * \param   root    the waiting list
+ * \param   thread  the thread to remove
+ * \return  1 if the thread was in the list, 0 if it has already been removed (thus notified)
  */
-int thread_mutex_init (thread_mutex_t * mutex)
+static int ksynchro_unlink (list_t * root, thread_t thread)
 {
-    thread_mutex_t m = kmalloc (sizeof (*m));                   // Get memory
-    if (m == NULL) return ENOMEM;                               // malloc impossible
-    list_addlast (&MutexGroot, &m->glist);                      // add it in global mutex list
-    m->pid = thread_pid(ThreadCurrent);                         // it herits the thread's pid    
-    m->lock = 0;                                                // lock to protect
-    m->busy = 0;                                                // busy is free at first
-    list_init (&m->wait);                                       // no waiting threads
-    m->owner = NULL;                                            // no thread owns the mutex
-    *mutex = m;                                                 // at last save the new mutex
-    return SUCCESS;
+    list_foreach (root, item) {
+        if (thread_item (item) == thread) {
+            list_unlink (item);
+            return 1;
+        }
+    }
+    return 0;
 }
 
+//--------------------------------------------------------------------------------------------------
+// Futex API
+//
+// A futex is an int in the user memory, the user mutexes are acquired and released with atomic
+// operations on it, without any syscall, as long as there is no contention (see ulib/pthread.c).
+// The kernel only provides the wait queues for the contended cases. A waiting thread is described
+// by a futex_waiter_t on its kernel stack, it is chained in the bucket of the futex address.
+// The value of the futex is checked under the bucket lock before waiting, and the user changes the
+// value before calling thread_futex_wake() which takes the same lock, thus a wake cannot be lost.
+//--------------------------------------------------------------------------------------------------
+
+#define FUTEX_BUCKET(addr)  (&FutexBucket[((unsigned)(addr) >> 2) % FUTEX_BUCKETS])
+
+typedef struct futex_waiter_s {
+    list_t      list;           ///< element of the wait queue of the bucket
+    int *       addr;           ///< address of the awaited futex, NULL when it is woken
+    thread_t    thread;         ///< waiting thread
+} futex_waiter_t;
+
 /**
- * Destroy the given mutex if possible
+ * \brief   cancel function of a timed wait, called by the timer of the thread at its deadline
+ * \param   thread  the waiting thread
+ * \param   arg     its futex_waiter_t
+ * \return  1 if it was still waiting, 0 if it has been woken
  */
-int thread_mutex_destroy (thread_mutex_t * mutex)
+static int thread_futex_cancel (thread_t thread, void * arg)
 {
-    thread_mutex_t m = *mutex;
-    if (m == NULL) return EINVAL;                               // unitialized mutex
-    if (m->busy) return EBUSY;                                  // try to destroy an lock mutex
-    if (m->owner != ThreadCurrent) return EPERM;                // the thread does not own the mutex
-    list_unlink (&m->glist);                                    // unlink from the global list
-    kfree (m);
-    return SUCCESS;
+    futex_waiter_t * w = arg;
+    struct futex_bucket_s * b = FUTEX_BUCKET (w->addr);    // addr is not NULL until the wake
+    spin_lock (&b->lock);
+    int waiting = (w->addr != NULL);                        // not yet woken
+    if (waiting)
+        list_unlink (&w->list);
+    spin_unlock (&b->lock);
+    return waiting;
 }
 
-/**
- * lock = Acquire the mutex.
- * First, check if the arguments are legal, then take the lock that protects the mutex,
- * it is an active loop but not too long.
- * After that, there are two possibilities: A) the mutex is busy, B) the mutex is free.
- * A) busy case: ThreadCurrent is added to the end of the mutex's pending thread list using
- *    thread_addlast(). This function is defined in the thread API (kthread.c), note that we cannot
- *    use list_addlast() as we do not have access to the thread structure (it is a hidden structure
- *    for security reasons).
- *    Next, we need to release the lock, then finally the current thread needs to change its
- *    state from RUNNING to WAIT. When the thread that currently owns the mutex releases it,
- *    then it will give ownership of the mutex by leaving the state occupied, but changing
- *    the owner field. Note that it is possible that the release of the mutex occurs just after
- *    the current thread has decided to wait, there could be a risk that it will start waiting
- *    while it owns the mutex. This case is handled by the thread_wait() and thread_notify()
- *    functions, details are in the comments of these functions in kthread.c.
- * B) free case : it's quite simple, it just have to set busy to 1 and fill the ownership field,
- *    and release the lock.
- */
-int thread_mutex_lock (thread_mutex_t * mutex)
+int thread_futex_wait (int * addr, int val, unsigned deadline, int timed)
 {
-    thread_mutex_t m = *mutex;
-    if (m == NULL) return EINVAL;                           // unitialized mutex
-    if (m->busy && (m->owner == ThreadCurrent)) return EDEADLK; // try to lock several times
-
-    spin_lock (&m->lock);                                   // take the lock of the mutex
-    if (m->busy) {                                          // if the mutex is busy
-        thread_addlast (&m->wait, ThreadCurrent);           // put the current thread waiting
-        spin_unlock (&m->lock);                             // give the lock back
-        thread_wait ();                                     // tell the thread to wait
-    } else {
-        m->busy = 1;                                        // take the mutex
-        m->owner = ThreadCurrent;                           // set the ownership
-        spin_unlock (&m->lock);                             // give the lock back
+    if ((addr == NULL) || ((unsigned)addr & 3)) return EINVAL; // an aligned int is expected
+
+    struct futex_bucket_s * b = FUTEX_BUCKET (addr);
+    futex_waiter_t w = { .addr = addr, .thread = ThreadCurrent };
+
+    spin_lock (&b->lock);                                   // !--! critical section
+    if (*(volatile int *)addr != val) {                     // changed since the user has read it
+        spin_unlock (&b->lock);                             // then it must not wait
+        return EAGAIN;
     }
-    return SUCCESS;                                         // and return with success
+    list_addlast (&b->wait, &w.list);                       // the current thread waits
+    spin_unlock (&b->lock);                                 // !--! end of critical section
+
+    if (!timed)
+        thread_wait ();                                     // until thread_futex_wake()
+    else if (thread_wait_until (deadline, thread_futex_cancel, &w))
+        return ETIMEDOUT;                                   // removed by thread_futex_cancel()
+    return SUCCESS;
 }
 
-/**
- * unlock : release the mutex
- * First, check if the arguments are legal, then take the lock that protects the mutex,
- * Then, get the thread in the thread waiting list of the mutex.
- * There are two possibilities: A) there is one or B) there is not.
- * A) There is a waiting thread, leave the busy field set to 1, change the property and notify
- *    the waiting thread with thread_notify() and it will become READY. If the new mutex owner
- *    decide to wait while the current thread try to notify it, there could be a risk that the
- *    new mutex owner waits definitively with the mutex ownership. This case is handled by the
- *    functions thread_wait() and thread_notify(), see details in kthread.c
- * B) There is no waiting thread, reset busy and owner.
- * At last, in both cases, the mutex lock is released.
- */
-int thread_mutex_unlock (thread_mutex_t * mutex)
+int thread_futex_wake (int * addr, int count)
 {
-    thread_mutex_t m = *mutex;
-    if (m == NULL) return EINVAL;                           // unitialized mutex
-    if (m->busy == 0) return EINVAL;                        // unlocked an unlock mutex
-    if (m->owner != ThreadCurrent) return EPERM;            // the thread does not own the mutex
-
-    spin_lock (&m->lock);                                   // take the lock of the mutex
-    list_t * waiting_item = list_getfirst(&m->wait);        // get thread from waiting list
-    if (waiting_item) {                                     // if there is a thread waiting
-        m->owner = thread_item (waiting_item);              // get the new mutex owner
-        thread_notify (m->owner);                           // this thread owns the mutex
-    } else {                                                // no thread is waiting
-        m->busy = 0;                                        // free the mutex
-        m->owner = NULL;                                    // delete the owner field
+    struct futex_bucket_s * b = FUTEX_BUCKET (addr);
+    int woken = 0;
+
+    spin_lock (&b->lock);                                   // !--! critical section
+    list_foreach (&b->wait, item) {                         // FIFO order
+        if (woken == count)
+            break;
+        futex_waiter_t * w = list_item (item, futex_waiter_t, list);
+        if (w->addr == addr) {                              // waits for this futex
+            list_unlink (item);
+            w->addr = NULL;                                 // woken, before w disappears
+            thread_notify (w->thread);                      // then w must not be used anymore
+            woken++;
+        }
     }
-    spin_unlock (&m->lock);                                 // give the lock back
-    return SUCCESS;
+    spin_unlock (&b->lock);                                 // !--! end of critical section
+    return woken;
 }
 
 /**
- * All the mutexes are on the same list; you just need to delete those used for a specific process.
+ * The waiters are on the kernel stack of the threads, they must be removed from the wait queues
+ * before the threads are destroyed.
  */
-int process_mutexes_cleanup (int pid)
+int process_futexes_cleanup (int pid)
 {
-    list_foreach ( &MutexGroot, mutex_item) {
-        thread_mutex_t m = list_item (mutex_item, struct thread_mutex_s, glist);
-        if (m->pid == pid) {
-            list_unlink (mutex_item);
-            kfree (m);
-        } 
-    } 
+    for (int i = 0; i < FUTEX_BUCKETS; i++) {
+        struct futex_bucket_s * b = &FutexBucket[i];
+        spin_lock (&b->lock);
+        list_foreach (&b->wait, item) {
+            futex_waiter_t * w = list_item (item, futex_waiter_t, list);
+            if (thread_pid (w->thread) == pid) {
+                list_unlink (item);
+                w->addr = NULL;
+            }
+        }
+        spin_unlock (&b->lock);
+    }
     return 0;
-}  
+}
 
 //--------------------------------------------------------------------------------------------------
 // Barrier API
@@ -199,12 +198,12 @@ int thread_barrier_init (thread_barrier_t * barrier, size_t count)
 
     spin_lock (&b->lock);                                   // get the ownership
     if (b->waiting != 0) {                                  // if someone is waiting
-        spin_lock (&b->lock);                               // release the ownership
+        spin_unlock (&b->lock);                             // release the ownership
         return EBUSY;                                       // return an error
     }
 
     b->expected = count;                                    // set the number of expected threads
-    spin_lock (&b->lock);                                   // release the ownership
+    spin_unlock (&b->lock);                                 // release the ownership
 
     return SUCCESS;                                         // it's fine
 }
@@ -235,6 +234,47 @@ int thread_barrier_wait (thread_barrier_t * barrier)
     return SUCCESS;                                         // it's fine
 }
 
+/**
+ * \brief   cancel function of a timed wait, called by the timer of the thread at its deadline
+ *          the thread leaves the barrier, thus it is not counted anymore
+ */
+static int thread_barrier_cancel (thread_t thread, void * arg)
+{
+    thread_barrier_t b = arg;
+    spin_lock (&b->lock);                                   // exclusive with the last thread
+    int waiting = ksynchro_unlink (&b->wait, thread);       // the barrier is not yet open
+    if (waiting)
+        b->waiting--;                                       // the thread leaves the barrier
+    spin_unlock (&b->lock);
+    return waiting;
+}
+
+int thread_barrier_timedwait (thread_barrier_t * barrier, unsigned deadline)
+{
+    thread_barrier_t b = *barrier;                          // get the barrier pointer
+
+    if (b == NULL) return EINVAL;                           // b is not created
+    if (b && (b->magic != MAGIC_BARRIER)) return EINVAL;    // check that it is barrier (MAGIC)
+
+    spin_lock (&b->lock);                                   // get the ownership
+    b->waiting++;                                           // the current thread is the newcomer
+    if (b->waiting == b->expected) {                        // if all the expected threads are there
+        list_foreach (&b->wait, waiting_item) {             // then for each thread waiting
+            list_unlink (waiting_item);                     // get thread from waiting list
+            thread_notify (thread_item (waiting_item));     // and notifies it
+        }
+        b->waiting = 0;                                     // init the counter of waiting threads
+        spin_unlock (&b->lock);                             // release the ownership
+    } else {
+        thread_addlast (&b->wait, ThreadCurrent);           // the current thread in the wait. list
+        spin_unlock (&b->lock);                             // release the lock
+        if (thread_wait_until (deadline, thread_barrier_cancel, b)) // wait until the deadline
+            return ETIMEDOUT;                               // the barrier is still closed
+    }
+
+    return SUCCESS;                                         // it's fine
+}
+
 int thread_barrier_destroy (thread_barrier_t * barrier)
 {
     thread_barrier_t b = *barrier;                          // get the barrier pointer
@@ -266,5 +306,242 @@ int process_barriers_cleanup (int pid)
         } 
     } 
     return 0;
-}  
+}
 
+//--------------------------------------------------------------------------------------------------
+// Condition variable API
+//--------------------------------------------------------------------------------------------------
+
+struct thread_cond_s {
+    spinlock_t  lock;           ///< protection against parallel modifications
+    list_t      wait;           ///< list element to chain threads that are waiting for a signal
+    list_t      glist;          ///< all condition variables whatever the process are chained
+    int         pid;            ///< Process identifier owner
+};
+
+int thread_cond_init (thread_cond_t * cond)
+{
+    thread_cond_t c = kmalloc (sizeof (*c));                    // Get memory
+    if (c == NULL) return ENOMEM;                               // malloc impossible
+    list_addlast (&CondGroot, &c->glist);                       // add it in global cond list
+    c->pid = thread_pid(ThreadCurrent);                         // it herits the thread's pid
+    c->lock = 0;                                                // lock to protect
+    list_init (&c->wait);                                       // no waiting threads
+    *cond = c;                                                  // at last save the new cond
+    return SUCCESS;
+}
+
+int thread_cond_destroy (thread_cond_t * cond)
+{
+    thread_cond_t c = *cond;
+    if (c == NULL) return EINVAL;                               // unitialized cond
+    spin_lock (&c->lock);
+    if (!list_isempty (&c->wait)) {                             // threads are waiting
+        spin_unlock (&c->lock);
+        return EBUSY;
+    }
+    list_unlink (&c->glist);                                    // unlink from the global list
+    kfree (c);                                                  // erasing the memory releases lock
+    *cond = NULL;
+    return SUCCESS;
+}
+
+/**
+ * \brief   cancel function of a timed wait, called by the timer of the thread at its deadline
+ */
+static int thread_cond_cancel (thread_t thread, void * arg)
+{
+    thread_cond_t c = arg;
+    spin_lock (&c->lock);                                   // exclusive with the signal
+    int waiting = ksynchro_unlink (&c->wait, thread);       // not yet signaled
+    spin_unlock (&c->lock);
+    return waiting;
+}
+
+/**
+ * wait : the mutex is a futex of the user (see ulib/pthread.c), it is released here, in the kernel,
+ * after the current thread has been added to the waiting list. Thus a thread which signals the
+ * condition with the mutex locked cannot do it between the release and the wait, since it takes
+ * the mutex after the release, then it finds the current thread in the list.
+ * The release is the same as pthread_mutex_unlock(): the futex becomes 0, and if it was 2, there
+ * may be threads waiting for the mutex, then one is woken.
+ * The mutex is taken again by the user when this function returns, whatever the return value.
+ */
+int thread_cond_wait (thread_cond_t * cond, int * mutex, unsigned deadline, int timed)
+{
+    thread_cond_t c = *cond;
+    if (c == NULL) return EINVAL;                           // unitialized cond
+    if ((mutex == NULL) || ((unsigned)mutex & 3)) return EINVAL; // the futex of the mutex
+
+    spin_lock (&c->lock);                                   // take the lock of the cond
+    thread_addlast (&c->wait, ThreadCurrent);               // put the current thread waiting
+    spin_unlock (&c->lock);                                 // give the lock back
+
+    if (atomic_xchg (mutex, 0) == 2)                        // release the mutex of the user
+        thread_futex_wake (mutex, 1);                       // with threads waiting for it
+
+    if (!timed)
+        thread_wait ();                                     // until a signal
+    else if (thread_wait_until (deadline, thread_cond_cancel, c))
+        return ETIMEDOUT;                                   // removed by thread_cond_cancel()
+    return SUCCESS;
+}
+
+int thread_cond_signal (thread_cond_t * cond, int all)
+{
+    thread_cond_t c = *cond;
+    if (c == NULL) return EINVAL;                           // unitialized cond
+
+    spin_lock (&c->lock);                                   // take the lock of the cond
+    list_t * item;
+    while ((item = list_getfirst (&c->wait)) != NULL) {     // the first waiting thread
+        thread_notify (thread_item (item));                 // becomes READY
+        if (!all)                                           // signal: one thread only
+            break;
+    }
+    spin_unlock (&c->lock);                                 // give the lock back
+    return SUCCESS;
+}
+
+/**
+ * All the condition variables are on the same list, delete those used for a specific process.
+ */
+int process_conds_cleanup (int pid)
+{
+    list_foreach (&CondGroot, cond_item) {
+        thread_cond_t c = list_item (cond_item, struct thread_cond_s, glist);
+        if (c->pid == pid) {
+            list_unlink (cond_item);
+            kfree (c);
+        }
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Reader-writer lock API
+//
+// Several readers or one writer hold the lock. A reader waits if there is a writer or a waiting
+// writer, thus the writers are not starved by a continuous flow of readers. The ownership is
+// given by the unlock, as for the mutexes: the last reader gives the lock to the first waiting
+// writer, and a writer gives it to all the waiting readers if any, else to the next writer.
+// Thus, readers and writers alternate when both are waiting.
+//--------------------------------------------------------------------------------------------------
+
+struct thread_rwlock_s {
+    spinlock_t  lock;           ///< protection against parallel modifications
+    unsigned    readers;        ///< number of readers holding the lock
+    thread_t    writer;         ///< writer holding the lock, NULL if none
+    list_t      rwait;          ///< list element to chain readers waiting for the lock
+    list_t      wwait;          ///< list element to chain writers waiting for the lock
+    list_t      glist;          ///< all rwlocks whatever the process it belongs are chained
+    int         pid;            ///< Process identifier owner
+};
+
+int thread_rwlock_init (thread_rwlock_t * rwlock)
+{
+    thread_rwlock_t rw = kmalloc (sizeof (*rw));                // Get memory
+    if (rw == NULL) return ENOMEM;                              // malloc impossible
+    list_addlast (&RwlockGroot, &rw->glist);                    // add it in global rwlock list
+    rw->pid = thread_pid(ThreadCurrent);                        // it herits the thread's pid
+    rw->lock = 0;                                               // lock to protect
+    rw->readers = 0;                                            // the rwlock is free
+    rw->writer = NULL;
+    list_init (&rw->rwait);                                     // no waiting threads
+    list_init (&rw->wwait);
+    *rwlock = rw;                                               // at last save the new rwlock
+    return SUCCESS;
+}
+
+int thread_rwlock_destroy (thread_rwlock_t * rwlock)
+{
+    thread_rwlock_t rw = *rwlock;
+    if (rw == NULL) return EINVAL;                              // unitialized rwlock
+    if (rw->readers || rw->writer) return EBUSY;                // try to destroy a held rwlock
+    list_unlink (&rw->glist);                                   // unlink from the global list
+    kfree (rw);
+    *rwlock = NULL;
+    return SUCCESS;
+}
+
+int thread_rwlock_rdlock (thread_rwlock_t * rwlock)
+{
+    thread_rwlock_t rw = *rwlock;
+    if (rw == NULL) return EINVAL;                          // unitialized rwlock
+    if (rw->writer == ThreadCurrent) return EDEADLK;        // already held for writing
+
+    spin_lock (&rw->lock);                                  // take the lock of the rwlock
+    if ((rw->writer == NULL) && list_isempty (&rw->wwait)) {// no writer, even waiting
+        rw->readers++;                                      // one more reader
+        spin_unlock (&rw->lock);
+    } else {
+        thread_addlast (&rw->rwait, ThreadCurrent);         // put the current thread waiting
+        spin_unlock (&rw->lock);                            // give the lock back
+        thread_wait ();                                     // readers is incremented by unlock
+    }
+    return SUCCESS;
+}
+
+int thread_rwlock_wrlock (thread_rwlock_t * rwlock)
+{
+    thread_rwlock_t rw = *rwlock;
+    if (rw == NULL) return EINVAL;                          // unitialized rwlock
+    if (rw->writer == ThreadCurrent) return EDEADLK;        // try to lock several times
+
+    spin_lock (&rw->lock);                                  // take the lock of the rwlock
+    if ((rw->writer == NULL) && (rw->readers == 0)) {       // the rwlock is free
+        rw->writer = ThreadCurrent;                         // set the ownership
+        spin_unlock (&rw->lock);
+    } else {
+        thread_addlast (&rw->wwait, ThreadCurrent);         // put the current thread waiting
+        spin_unlock (&rw->lock);                            // give the lock back
+        thread_wait ();                                     // writer is set by unlock
+    }
+    return SUCCESS;
+}
+
+int thread_rwlock_unlock (thread_rwlock_t * rwlock)
+{
+    thread_rwlock_t rw = *rwlock;
+    if (rw == NULL) return EINVAL;                          // unitialized rwlock
+
+    spin_lock (&rw->lock);                                  // take the lock of the rwlock
+    int writer = (rw->writer == ThreadCurrent);
+    if (writer)
+        rw->writer = NULL;                                  // the writer leaves
+    else if ((rw->writer == NULL) && rw->readers)
+        rw->readers--;                                      // a reader leaves
+    else {
+        spin_unlock (&rw->lock);
+        return EPERM;                                       // the thread does not hold it
+    }
+    if (rw->readers == 0) {                                 // the rwlock is free
+        list_t * item;
+        if ((writer || list_isempty (&rw->wwait)) && !list_isempty (&rw->rwait)) {
+            while ((item = list_getfirst (&rw->rwait)) != NULL) {
+                rw->readers++;                              // all waiting readers get it
+                thread_notify (thread_item (item));
+            }
+        } else if ((item = list_getfirst (&rw->wwait)) != NULL) {
+            rw->writer = thread_item (item);                // the next writer gets it
+            thread_notify (rw->writer);
+        }
+    }
+    spin_unlock (&rw->lock);                                // give the lock back
+    return SUCCESS;
+}
+
+/**
+ * All the rwlocks are on the same list; you just need to delete those used for a specific process.
+ */
+int process_rwlocks_cleanup (int pid)
+{
+    list_foreach (&RwlockGroot, rwlock_item) {
+        thread_rwlock_t rw = list_item (rwlock_item, struct thread_rwlock_s, glist);
+        if (rw->pid == pid) {
+            list_unlink (rwlock_item);
+            kfree (rw);
+        }
+    }
+    return 0;
+}
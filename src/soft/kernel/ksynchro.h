@@ -26,55 +26,35 @@ int ksynchro_init (void);
 
 
 //--------------------------------------------------------------------------------------------------
-// Mutex API
+// Futex API (wait queues of the user mutexes, see ulib/pthread.c)
 //--------------------------------------------------------------------------------------------------
 
 
 /**
- * \brief   hidden mutex type, the other modules do not what is in the mutex structure
+ * \brief   wait on a futex if it has still the expected value, it is the SYSCALL_FUTEX_WAIT
+ * \param   addr    address of the futex, an int in the user memory
+ * \param   val     expected value, the thread does not wait if the futex has another value
+ * \param   deadline absolute date in cycles (comparable to clock()), used if timed only
+ * \param   timed   1 to wait until the deadline at most, 0 to wait until a wake
+ * \return  SUCCESS when woken by thread_futex_wake(), EAGAIN if the value is not val,
+ *          ETIMEDOUT if the deadline is reached, EINVAL if addr is not an aligned int
  */
-typedef struct thread_mutex_s * thread_mutex_t;
+extern int thread_futex_wait (int * addr, int val, unsigned deadline, int timed);
 
 /**
- * \brief   creates a new mutex and initializes mutex variable with the new mutex (side effect)
- *          it is a nutex with error checking 
- * \param   mutex a pointer referencing the new mutex 
- * \return  0 on success, 1 on fealure
+ * \brief   wake threads waiting on a futex, it is the SYSCALL_FUTEX_WAKE syscall
+ * \param   addr    address of the futex
+ * \param   count   maximum number of threads to wake, in their arrival order
+ * \return  the number of woken threads
  */
-extern int thread_mutex_init (thread_mutex_t * mutex);
+extern int thread_futex_wake (int * addr, int count);
 
 /**
- * \brief   destroy the referenced mutex
- *          If the mutex is locked the destruction is not done, this is an error
- * \param   mutex a pointer referencing a mutex 
- * \return  0 on success, 1 on fealure
+ * \brief   remove the threads of a given pid from the futex wait queues
+ * \param   pid the process identifier that owns the threads
+ * \return  0 on success
  */
-extern int thread_mutex_destroy (thread_mutex_t * mutex);
-
-/**
- * \brief   lock the referenced mutex, it is a blocking operation.
- *          If the mutex is already locked, the calling thread blocks until the mutex becomes 
- *          available. If the mutex does not exist or is already locked, this is an error
- * \param   mutex a pointer referencing a mutex 
- * \return  0 on success, 1 on fealure
- */
-extern int thread_mutex_lock (thread_mutex_t * mutex);
-
-/**
- * \brief   unlock the referenced mutex
- *          If the mutex does not exist or is not locked or has been locked by another, 
- *          this is an error that causes exit with error
- * \param   mutex a pointer referencing a mutex 
- * \return  0 on success, 1 on fealure
- */
-extern int thread_mutex_unlock (thread_mutex_t * mutex);
-
-/**
- * \brief   delete all mutexes from a given pid
- * \param   pid the process identifier that owns the mutexes
- * \return  0 on success, 1 on fealure
- */
-extern int process_mutexes_cleanup (int pid);
+extern int process_futexes_cleanup (int pid);
 
 
 //--------------------------------------------------------------------------------------------------
@@ -110,6 +90,16 @@ extern int thread_barrier_init (thread_barrier_t * barrier, size_t count);
  */
 extern int thread_barrier_wait (thread_barrier_t * barrier);
 
+/**
+ * \brief   wait to the referenced barrier, as thread_barrier_wait() but until the deadline at most,
+ *          then the thread leaves the barrier which waits for one more thread again.
+ *          It is the SYSCALL_BARRIER_TIMED syscall
+ * \param   barrier a pointer referencing a barrier
+ * \param   deadline absolute date in cycles (comparable to clock())
+ * \return  SUCCESS, ETIMEDOUT if the deadline is reached before the last thread, or EINVAL
+ */
+extern int thread_barrier_timedwait (thread_barrier_t * barrier, unsigned deadline);
+
 /**
  * \brief   destroy the referenced barrier
  *          If a thread is waiting at the barrier, then the destruction is not done, it is an error
@@ -130,5 +120,111 @@ extern int thread_barrier_destroy (thread_barrier_t * barrier);
 extern int process_barriers_cleanup (int pid);
 
 
+//--------------------------------------------------------------------------------------------------
+// Condition variable API
+//--------------------------------------------------------------------------------------------------
+
+
+/**
+ * \brief   hidden condition variable type, the user do not know what is in the structure
+ */
+typedef struct thread_cond_s * thread_cond_t;
+
+/**
+ * \brief   creates a new condition variable and initializes cond with it (side effect)
+ * \param   cond a pointer referencing the new condition variable
+ * \return  SUCCESS or ENOMEM
+ */
+extern int thread_cond_init (thread_cond_t * cond);
+
+/**
+ * \brief   destroy the referenced condition variable
+ * \param   cond a pointer referencing a condition variable
+ * \return  SUCCESS, EINVAL if it does not exist, EBUSY if threads are waiting
+ */
+extern int thread_cond_destroy (thread_cond_t * cond);
+
+/**
+ * \brief   release the mutex and wait for a signal on the condition variable, atomically:
+ *          a signal sent by a thread which holds the mutex cannot be lost
+ * \param   cond    a pointer referencing a condition variable
+ * \param   mutex   the futex of the user mutex, held by the current thread (see ulib/pthread.c),
+ *                  the user takes the mutex again after the return
+ * \param   deadline absolute date in cycles (comparable to clock()), used if timed only
+ * \param   timed   1 to wait until the deadline at most, 0 to wait until a signal
+ * \return  SUCCESS when signaled, ETIMEDOUT if the deadline is reached, EINVAL wrong argument
+ */
+extern int thread_cond_wait (thread_cond_t * cond, int * mutex, unsigned deadline, int timed);
+
+/**
+ * \brief   wake the first thread waiting on the condition variable, or all of them
+ * \param   cond    a pointer referencing a condition variable
+ * \param   all     0 to wake one thread (signal), 1 to wake all the threads (broadcast)
+ * \return  SUCCESS or EINVAL
+ */
+extern int thread_cond_signal (thread_cond_t * cond, int all);
+
+/**
+ * \brief   delete all condition variables from a given pid
+ * \param   pid the process identifier that owns the condition variables
+ * \return  0 on success
+ */
+extern int process_conds_cleanup (int pid);
+
+
+//--------------------------------------------------------------------------------------------------
+// Reader-writer lock API
+//--------------------------------------------------------------------------------------------------
+
+
+/**
+ * \brief   hidden reader-writer lock type, the user do not know what is in the structure
+ */
+typedef struct thread_rwlock_s * thread_rwlock_t;
+
+/**
+ * \brief   creates a new rwlock and initializes rwlock with it (side effect)
+ * \param   rwlock a pointer referencing the new rwlock
+ * \return  SUCCESS or ENOMEM
+ */
+extern int thread_rwlock_init (thread_rwlock_t * rwlock);
+
+/**
+ * \brief   destroy the referenced rwlock
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL if it does not exist, EBUSY if it is held
+ */
+extern int thread_rwlock_destroy (thread_rwlock_t * rwlock);
+
+/**
+ * \brief   lock the rwlock for reading, several readers hold it together. The thread waits while
+ *          a writer holds it or waits for it.
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL, EDEADLK if the current thread holds it for writing
+ */
+extern int thread_rwlock_rdlock (thread_rwlock_t * rwlock);
+
+/**
+ * \brief   lock the rwlock for writing, the writer is alone. The thread waits while it is held.
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL, EDEADLK if the current thread holds it for writing
+ */
+extern int thread_rwlock_wrlock (thread_rwlock_t * rwlock);
+
+/**
+ * \brief   unlock the rwlock held for reading or writing, it is given to the waiting threads
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL, EPERM if it is not held
+ */
+extern int thread_rwlock_unlock (thread_rwlock_t * rwlock);
+
+/**
+ * \brief   delete all rwlocks from a given pid
+ * \param   pid the process identifier that owns the rwlocks
+ * \return  0 on success
+ */
+extern int process_rwlocks_cleanup (int pid);
+
+
 
 #endif//_KSYNC_H_
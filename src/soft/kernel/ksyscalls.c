@@ -58,11 +58,18 @@ static int dcache_inval_user (void * addr)
     return SUCCESS;
 }
 
+static int clock64_user (unsigned long long * cycles)
+{
+    if ((unsigned)cycles >= 0x80000000 - sizeof(*cycles)) return EPERM;
+    *cycles = ktimer_clock64 ();                            // clock() does not wrap there
+    return SUCCESS;
+}
+
 void *SyscallVector[] = {
     [0 ... SYSCALL_NR - 1   ] = unknown_syscall,   /* default function */
     [SYSCALL_EXIT           ] = exit,
     [SYSCALL_READ           ] = tty_read,
-    [SYSCALL_WRITE          ] = tty_write,
+    [SYSCALL_WRITE          ] = tty_write_user,
     [SYSCALL_CLOCK          ] = clock,
     [SYSCALL_CPUID          ] = cpuid,
     [SYSCALL_DMA_MEMCPY     ] = dma_memcpy_user,
@@ -76,14 +83,26 @@ void *SyscallVector[] = {
     [SYSCALL_THREAD_EXIT    ] = thread_exit,
     [SYSCALL_SCHED_DUMP     ] = sched_dump,
     [SYSCALL_THREAD_JOIN    ] = thread_join,
-    [SYSCALL_MUTEX_INIT     ] = thread_mutex_init,
-    [SYSCALL_MUTEX_LOCK     ] = thread_mutex_lock,
-    [SYSCALL_MUTEX_UNLOCK   ] = thread_mutex_unlock,
-    [SYSCALL_MUTEX_DESTROY  ] = thread_mutex_destroy,
     [SYSCALL_BARRIER_INIT   ] = thread_barrier_init,
     [SYSCALL_BARRIER_WAIT   ] = thread_barrier_wait,
     [SYSCALL_BARRIER_DESTROY] = thread_barrier_destroy,
     [SYSCALL_KSHELL         ] = sys_kshell,
+    [SYSCALL_SCHED_SETPARAM ] = thread_setprio,
+    [SYSCALL_SCHED_GETPARAM ] = thread_getprio,
+    [SYSCALL_NANOSLEEP      ] = thread_sleep,
+    [SYSCALL_BARRIER_TIMED  ] = thread_barrier_timedwait,
+    [SYSCALL_FUTEX_WAIT     ] = thread_futex_wait,
+    [SYSCALL_FUTEX_WAKE     ] = thread_futex_wake,
+    [SYSCALL_COND_INIT      ] = thread_cond_init,
+    [SYSCALL_COND_WAIT      ] = thread_cond_wait,
+    [SYSCALL_COND_SIGNAL    ] = thread_cond_signal,
+    [SYSCALL_COND_DESTROY   ] = thread_cond_destroy,
+    [SYSCALL_RWLOCK_INIT    ] = thread_rwlock_init,
+    [SYSCALL_RWLOCK_RDLOCK  ] = thread_rwlock_rdlock,
+    [SYSCALL_RWLOCK_WRLOCK  ] = thread_rwlock_wrlock,
+    [SYSCALL_RWLOCK_UNLOCK  ] = thread_rwlock_unlock,
+    [SYSCALL_RWLOCK_DESTROY ] = thread_rwlock_destroy,
+    [SYSCALL_CLOCK64        ] = clock64_user,
 };
 
 /*------------------------------------------------------------------------------------------------*\
@@ -35,14 +35,26 @@ struct thread_s {
     int         ustack_b;         ///< user stack beginning (the highest address, outside the stack)
     int         ustack_e;         ///< user stack end (thus the lowest addr)
     list_t      wait;             ///< list element to chain threads waiting for the same resource
+    list_t      ready;            ///< list element to chain READY threads of the same priority
+    int         prio;             ///< priority, from 0 to SCHED_PRIO_NB-1 (the highest)
+    int         base;             ///< static priority, prio is base plus the boost of an I/O wait
+    int         iowait;           ///< 1 while waiting for an I/O, thus boosted when notified
+    int         cpu;              ///< CPU of the run queue of the thread (the last one used)
+    volatile int oncpu;           ///< 1 while a CPU uses its stack (RUNNING or being switched)
+    ktimer_t    timer;            ///< deadline of a timed wait, it is in the wheel while sleeping
+    int (*cancel) (thread_t, void *); ///< removes the thread from the resource at the deadline
+    void *      cancel_arg;       ///< its argument (the resource)
+    int         timedout;         ///< 1 when the timed wait has reached its deadline
+    volatile int timerdone;       ///< 1 when the function of the timer has returned
     spinlock_t  lock;             ///< lock to protected structure during modification
     int         state;            ///< thread state from the scheduler point of view
-    _tls_t *    ptls;             ///< ptr to current thread local storage (see common/usermem.h)
+    _tls_t *    ptls;             ///< ptr to the thread local storage (see common/usermem.h)
     void *      retval;           ///< return value
     thread_t    join;             ///< expected thread in case of thread_join()
     int         start;            ///< pointer to the function which calls fun(arg)
     int         fun;              ///< pointer to the thread function (cast to int)
     int         arg;              ///< thread argument (cast to int)
+    _tls_t      ktls;             ///< thread local storage of a kernel thread (only errno is used)
     int         pid;              ///< Process identifier owner
     int         tid;              ///< thread id MUST BE PLACED JUST BEFORE CONTEXT (for tracing)
     unsigned long long krandseed; ///< each thread has its own kernel random seed, it is thread safe
@@ -50,9 +62,23 @@ struct thread_s {
     int kstack[1];                ///< lowest address of kernel stack of thread (with MAGIC_STACK)
 };
 
+typedef struct sched_rq_s {             // run queue of a CPU
+    spinlock_t  lock;                   // protects the queues, taken by the CPU and the thieves
+    spinstat_t  stat;                   // contention of the lock (see sched_dump())
+    list_t      queue[SCHED_PRIO_NB];   // queue[p] FIFO of READY threads of priority p
+    unsigned    ready;                  // bit p is set when queue[p] is not empty
+    unsigned    nready;                 // number of READY threads in the queues
+    thread_t    idle;                   // idle thread of the CPU, NULL if the CPU is not started
+    thread_t    prev;                   // thread left by the last switch, see sched_finish()
+    thread_t    running;                // thread elected by the CPU (maybe not yet switched)
+    ktimer_t    quantum;                // end of the quantum of the running thread
+    int         resched;                // set when the running thread must yield the CPU
+} sched_rq_t;
+
 static thread_t ThreadTab[THREAD_MAX];  // simple table for the all the existing threads
-static int      ThreadCurrentIdx;       // index of the current running thread
-thread_t        ThreadCurrent;          // pointer to the current thread
+static spinlock_t ThreadTabLock;        // protects ThreadTab[], threads are created on all CPUs
+thread_t        ThreadCurrentTab[NCPUS_MAX]; // pointer to the current thread of each CPU
+static sched_rq_t RunQueue[NCPUS_MAX];  // run queue of each CPU
 list_t          ThreadGroot;            // Thread Global Root
 
 void thread_addlast (list_t * root, thread_t thread)
@@ -89,28 +115,183 @@ int * thread_errno (thread_t thread)
 //--------------------------------------------------------------------------------------------------
 // scheduler of threads, all functions are static because only used by thread functions defined here
 // however, sched_dump () is an external function since it is a debugging function
+//
+// Each CPU has its own run queue RunQueue[cpu], with a FIFO of READY threads for each priority and
+// a bitmap of non empty FIFOs. A thread is in the run queue of thread->cpu iff it is READY and
+// not oncpu. oncpu is set while a CPU uses the thread's stack, that is from its election until
+// the CPU has switched to another thread, then sched_finish(), called by the new thread, clears
+// it and puts the previous thread back in the run queue if it is still READY. Thus, a thread is
+// never elected by a CPU while its context is not yet saved by another one.
+// When its run queue is empty, a CPU steals the best READY thread of the busiest run queue, and
+// if there is none, it runs its idle thread, which sleeps with irq_wait() until the next IRQ.
+// The priority of a thread is its static priority (base), plus SCHED_PRIO_BOOST when it is
+// notified after an I/O wait (thread_wait_io()), until it yields the CPU or its quantum ends.
+// Since the current thread is kept only without a READY thread of the same or a higher priority,
+// a boosted thread preempts the threads of lower priority at the next tick of its CPU.
+// There is no periodic tick, the quantum of the running thread is a kernel timer, started only
+// when a READY thread of the same or a higher priority waits in the run queue. Thus, a CPU which
+// runs a single thread, or its idle thread, is not interrupted. When a thread is added in a run
+// queue, it starts the quantum if it is needed, or it ends it at once (sched_kick()) if the
+// thread has to preempt the running one, and if it does not, it wakes an idle CPU up to steal it.
+// A sleeping thread, or a thread in a timed wait, is WAIT with its timer in the wheel of its CPU,
+// thus it is not in a run queue and it is never elected before its notification.
 //--------------------------------------------------------------------------------------------------
 
 
+/**
+ * \brief   function of the quantum timer of a CPU, the running thread will yield the CPU when the
+ *          timer ISR calls thread_preempt(), it cannot do it here since other timers may expire
+ * \param   arg is the run queue of the CPU
+ */
+static void sched_quantum_end (void *arg)
+{
+    ((sched_rq_t *) arg)->resched = 1;
+}
+
+/**
+ * \brief   Start the quantum of the running thread of a CPU if a READY thread of the same or a
+ *          higher priority waits in its run queue, otherwise stop it. The run queue lock is held.
+ * \param   rq is the run queue of the CPU
+ * \param   cpu is the CPU
+ */
+static void sched_quantum (sched_rq_t *rq, unsigned cpu)
+{
+    thread_t running = rq->running;
+    if (running && (running != rq->idle) && (rq->ready >> running->prio))
+        ktimer_start (&rq->quantum, cpu, clock () + KTIMER_TICK);
+    else                                                    // it can run alone, no IRQ at all
+        ktimer_stop (&rq->quantum);
+}
+
+/**
+ * \brief   End the quantum of the running thread of a CPU at once, the timer IRQ of the CPU is
+ *          raised as soon as possible, even if it sleeps. The run queue lock is held.
+ * \param   rq is the run queue of the CPU
+ * \param   cpu is the CPU
+ */
+static void sched_kick (sched_rq_t *rq, unsigned cpu)
+{
+    rq->resched = 1;
+    ktimer_start (&rq->quantum, cpu, clock ());
+}
+
+/**
+ * \brief   Kick a CPU which runs its idle thread, if any, in order that it steals a READY thread
+ * \param   cpu is the CPU of the READY thread (it is busy)
+ */
+static void sched_kick_idle (unsigned cpu)
+{
+    for (unsigned c = 0; c < NCPUS_MAX; c++) {
+        sched_rq_t *rq = &RunQueue[c];
+        if ((c == cpu) || !rq->idle || (rq->running != rq->idle)) // running is only a hint here
+            continue;
+        spin_lock_stat (&rq->lock, &rq->stat);              // !--! critical section
+        int idle = (rq->running == rq->idle);               // checked again
+        if (idle)
+            sched_kick (rq, c);
+        spin_unlock (&rq->lock);                            // !--! end of critical section
+        if (idle)
+            return;                                         // a single one is enough
+    }
+}
+
+/**
+ * \brief   Add a READY thread at the end of the queue of its priority in the run queue of its CPU
+ *          then the running thread of this CPU is preempted if the new one has a higher priority,
+ *          or it shares the CPU if they have the same priority.
+ * \param   thread is the thread to add, it is not oncpu
+ * \return  nothing
+ */
+static void sched_enqueue (thread_t thread)
+{
+    unsigned cpu = thread->cpu;
+    sched_rq_t *rq = &RunQueue[cpu];
+    int steal = 0;
+    spin_lock_stat (&rq->lock, &rq->stat);                  // !--! critical section
+    list_addlast (&rq->queue[thread->prio], &thread->ready);
+    rq->ready |= 1 << thread->prio;                         // queue[prio] is not empty
+    rq->nready++;
+    thread_t running = rq->running;
+    if (running && ((running == rq->idle) || (thread->prio > running->prio))) {
+        sched_kick (rq, cpu);                               // the thread takes the CPU at once
+    } else if (running) {
+        if ((thread->prio == running->prio) && !ktimer_pending (&rq->quantum))
+            sched_quantum (rq, cpu);                        // round robin from now
+        steal = 1;                                          // an idle CPU can take it
+    }
+    spin_unlock (&rq->lock);                                // !--! end of critical section
+    if (steal)
+        sched_kick_idle (cpu);
+}
+
+/**
+ * \brief   Take the first thread of a given priority in a run queue, the run queue lock is held
+ * \param   rq is the run queue
+ * \param   prio is the priority, the queue[prio] must not be empty
+ * \return  the thread
+ */
+static thread_t sched_pop (sched_rq_t *rq, int prio)
+{
+    thread_t thread = list_item (list_getfirst (&rq->queue[prio]), struct thread_s, ready);
+    if (list_isempty (&rq->queue[prio]))                    // it was the last of its priority
+        rq->ready &= ~(1 << prio);
+    rq->nready--;
+    thread->oncpu = 1;                                      // elected, not in the run queue now
+    return thread;
+}
+
+/**
+ * \brief   Remove a READY thread from its run queue
+ * \param   thread is the thread to remove
+ * \return  nothing
+ */
+static void sched_dequeue (thread_t thread)
+{
+    sched_rq_t *rq = &RunQueue[thread->cpu];
+    spin_lock_stat (&rq->lock, &rq->stat);                  // !--! critical section
+    list_unlink (&thread->ready);
+    if (list_isempty (&rq->queue[thread->prio]))            // it was the last of its priority
+        rq->ready &= ~(1 << thread->prio);
+    rq->nready--;
+    spin_unlock (&rq->lock);                                // !--! end of critical section
+}
+
 /**
  * \brief   Insert a new thread, in the scheduler
- *          The scheduler is a simple table of all the threads
- *          To insert a new thread, we need to find a place.
+ *          ThreadTab[] is a simple table of all the threads, indexed by their tid
+ *          To insert a new thread, we need to find a place, then it is READY thus in the run
+ *          queue of the least loaded CPU, but the first one which will be loaded by
+ *          thread_main_load().
  * \param   thread_new is the thread to insert
  * \return  nothing
  */
 static void sched_insert (thread_t thread_new)
 {
     int tid = 0;
+    spin_lock (&ThreadTabLock);                             // !--! critical section
     while ((tid < THREAD_MAX) && (ThreadTab[tid])) tid++;   // look for an empty place
     if (tid == THREAD_MAX) {                                // if not found -> exit(1);
+        spin_unlock (&ThreadTabLock);
         kprintf ("[%d] to many thread created (thread.h/THREAD_MAX\n)", clock());
         exit(1);
     }
     thread_new->tid = tid;                                  // set thread identifier
     ThreadTab[tid] = thread_new;                            // store the new thread
-    if (ThreadCurrent == NULL)                              // first thread insertion
+    spin_unlock (&ThreadTabLock);                           // !--! end of critical section
+
+    unsigned best = cpuid ();                               // choose the least loaded CPU
+    for (unsigned cpu = 0; cpu < NCPUS_MAX; cpu++)          // among the started ones
+        if (RunQueue[cpu].idle && (RunQueue[cpu].nready < RunQueue[best].nready))
+            best = cpu;
+    thread_new->cpu = best;
+
+    if (ThreadCurrent == NULL) {                            // first thread insertion
         ThreadCurrent = thread_new;
+        RunQueue[best].running = thread_new;
+        thread_new->oncpu = 1;                              // loaded by thread_main_load()
+    } else {
+        sched_enqueue (thread_new);                         // it can be elected
+    }
 }
 
 /**
@@ -124,39 +305,134 @@ static void sched_unlink (thread_t thread)
 }
 
 /**
- * \brief   Gives the next ThreadCurrentIdx to execute
- *          There are two loops.
- *          at the beginning, sched_elect() goes through the scheduler's thread table ONCE
- *          to find a READY thread. On success, it returns the new ThreadCurrentIdx
- *          In the second loop, if no READY thread has been found, then IRQs are enabled,
- *          and sched_elect() searches until it finds a READY thread
- *          Thus, if thread_yield() is called by timer_isr(), the ThreadCurrent is necessarly
- *          READY and then, sched_elect() will never enable the IRQ (it is forbidden to do so).
- *          __attribute__((noinline)) is to see this function is trace debug
- * \return  the next thread number to execute, it could be unchanged if there is not any else
+ * \brief   Make a thread READY, if it was WAIT then it is added in its run queue, unless it is
+ *          still oncpu, then it will be added by sched_finish(). If it was RUNNING (thread_wait()
+ *          not yet done) it will be added by sched_finish() or kept by sched_elect().
+ *          The thread lock must be held by the caller.
+ * \param   thread is the thread to wake up
+ * \return  nothing
  */
-static __attribute__((noinline)) int sched_elect (void)
+static void sched_wakeup (thread_t thread)
 {
-    // ---- First search for a READY state with IRQ disabled
+    int enqueue = (thread->state == TH_STATE_WAIT) && !thread->oncpu;
+    if (thread->iowait && (thread->state != TH_STATE_READY)) { // not in a run queue
+        thread->prio = thread->base + SCHED_PRIO_BOOST;     // I/O done, boost its priority
+        if (thread->prio >= SCHED_PRIO_NB)
+            thread->prio = SCHED_PRIO_NB - 1;
+    }
+    thread->iowait = 0;
+    thread->state = TH_STATE_READY;
+    if (enqueue)                                            // not in the run queue
+        sched_enqueue (thread);
+}
 
-    int th, thmax;
-    th = thmax = (ThreadCurrentIdx + 1) % THREAD_MAX;       // start with the current thread + 1
-    do {
-        if ( ThreadTab[th] &&
-            (ThreadTab[th]->state == TH_STATE_READY)) {     // thread READY found
-            return th;                                      // return the chosen one
-        }
-        th = (th+1) % THREAD_MAX;                           // go to the next (circular course)
-    } while (th != thmax);                                  // Only one loop
+/**
+ * \brief   Change the static priority of a thread, and its current priority thus it loses its
+ *          boost, if it is READY in a run queue, it is moved to the queue of its new priority.
+ *          The thread lock must be held by the caller, with the run queue lock, we are sure that
+ *          the thread is neither enqueued nor elected meanwhile.
+ * \param   thread is the thread to change
+ * \param   prio is the new priority
+ * \return  nothing
+ */
+static void sched_setprio (thread_t thread, int prio)
+{
+    sched_rq_t *rq = &RunQueue[thread->cpu];
+    spin_lock_stat (&rq->lock, &rq->stat);                  // !--! critical section
+    int queued = (thread->state == TH_STATE_READY) && !thread->oncpu;
+    if (queued) {                                           // move it to its new queue
+        list_unlink (&thread->ready);
+        if (list_isempty (&rq->queue[thread->prio]))        // it was the last of its priority
+            rq->ready &= ~(1 << thread->prio);
+        list_addlast (&rq->queue[prio], &thread->ready);
+        rq->ready |= 1 << prio;
+    }
+    thread->base = prio;
+    thread->prio = prio;
+    spin_unlock (&rq->lock);                                // !--! end of critical section
+}
 
-    // ---- Then if there is no READY thread then wait for it with IRQ enabled
+/**
+ * \brief   Take the best READY thread of the busiest run queue of the other CPUs
+ * \param   cpu is the current CPU
+ * \return  the stolen thread or NULL if there is not any
+ */
+static thread_t sched_steal (unsigned cpu)
+{
+    sched_rq_t *busiest = NULL;
+    for (unsigned c = 0; c < NCPUS_MAX; c++) {              // nready is read without lock, it is
+        if ((c != cpu) && RunQueue[c].nready                // only a hint, checked again below
+        && ((busiest == NULL) || (RunQueue[c].nready > busiest->nready)))
+            busiest = &RunQueue[c];
+    }
+    if (busiest == NULL)
+        return NULL;
+
+    thread_t thread = NULL;
+    spin_lock_stat (&busiest->lock, &busiest->stat);        // !--! critical section
+    if (busiest->ready)                                     // still a READY thread
+        thread = sched_pop (busiest, 31 - clz (busiest->ready));
+    spin_unlock (&busiest->lock);                           // !--! end of critical section
+    return thread;
+}
 
-    irq_enable();
-    while ( (ThreadTab[th] == NULL) || (ThreadTab[th]->state != TH_STATE_READY)) {
-        th = (th+1) % THREAD_MAX;                           // we search as long as we do not found
+/**
+ * \brief   Gives the next thread to execute on the current CPU
+ *          The chosen one is the first thread of the highest priority non empty queue of the CPU
+ *          run queue, found with a count-leading-zeros on its bitmap, thus in constant time.
+ *          If the current thread is still READY, it is kept when there is no thread of the same
+ *          or a higher priority, otherwise it is put back in the run queue by sched_finish().
+ *          If there is no READY thread at all, a thread is stolen from another CPU, and if there
+ *          is none, the idle thread of the CPU is chosen.
+ *          __attribute__((noinline)) is to see this function is trace debug
+ * \return  the next thread to execute, it could be unchanged if there is not any else
+ */
+static __attribute__((noinline)) thread_t sched_elect (void)
+{
+    unsigned cpu = cpuid ();
+    sched_rq_t *rq = &RunQueue[cpu];
+    thread_t prev = ThreadCurrent;
+    thread_t next = NULL;
+    int keep = (prev->state == TH_STATE_READY) && (prev != rq->idle);
+
+    spin_lock_stat (&rq->lock, &rq->stat);                  // !--! critical section
+    if (rq->ready) {                                        // there are READY threads
+        int prio = 31 - clz (rq->ready);                    // highest priority with READY threads
+        if (!keep || (prio >= prev->prio))                  // round robin for the same priority
+            next = sched_pop (rq, prio);
     }
-    irq_disable();
-    return th;                                              // return the chosen one
+    spin_unlock (&rq->lock);                                // !--! end of critical section
+
+    if (next == NULL)                                       // nothing better in the run queue
+        next = (keep) ? prev : sched_steal (cpu);
+    if (next == NULL)                                       // nothing at all
+        next = rq->idle;
+    next->cpu = cpu;                                        // it runs on this CPU now
+
+    spin_lock_stat (&rq->lock, &rq->stat);                  // !--! critical section
+    rq->running = next;                                     // the new READY threads compare to it
+    rq->resched = 0;
+    sched_quantum (rq, cpu);                                // a new quantum, if needed
+    spin_unlock (&rq->lock);                                // !--! end of critical section
+    return next;
+}
+
+/**
+ * \brief   Put the previous thread of the current CPU back in its run queue, if it is READY, since
+ *          its context is saved now. It is called by the next thread just after the switch.
+ */
+static void sched_finish (void)
+{
+    sched_rq_t *rq = &RunQueue[cpuid()];
+    thread_t prev = rq->prev;
+    if (prev == NULL)                                       // no switch before
+        return;
+    rq->prev = NULL;
+    spin_lock (&prev->lock);                                // !--! critical section
+    prev->oncpu = 0;                                        // another CPU can elect it now
+    if ((prev->state == TH_STATE_READY) && (prev != rq->idle))
+        sched_enqueue (prev);                               // yield or notified before the switch
+    spin_unlock (&prev->lock);                              // !--! end of critical section
 }
 
 /**
@@ -164,15 +440,17 @@ static __attribute__((noinline)) int sched_elect (void)
  */
 static void sched_switch (void)
 {
-    int th_next = sched_elect ();                           // get a next ready thread
-    if (th_next != ThreadCurrentIdx) {                      // if it is not the same
-        if (thread_context_save (ThreadCurrent->context)) { // Save current context, and return 1
-            ThreadCurrentIdx = th_next;                     // update ThreadCurrentIdx
-            ThreadCurrent = ThreadTab[th_next];             // update ThreadCurrent
-            __usermem.ptls = ThreadCurrent->ptls;
+    thread_t th_prev = ThreadCurrent;
+    thread_t th_next = sched_elect ();                      // get a next ready thread
+    if (th_next != th_prev) {                               // if it is not the same
+        th_next->oncpu = 1;                                 // idle is not popped from a queue
+        if (thread_context_save (th_prev->context)) {       // Save current context, and return 1
+            RunQueue[cpuid()].prev = th_prev;               // to be finished by th_next
+            ThreadCurrent = th_next;                        // update ThreadCurrent
             thread_context_load (ThreadCurrent->context);   // load contxt, exit thread_context_save
             // FIXME we'll have to destroy the old thread if it is dead
         }                                                   // but with 0 as return value
+        sched_finish ();                                    // th_prev is back, maybe on another CPU
     }
     ThreadCurrent->state= TH_STATE_RUNNING;                 // the chosen one is RUNNNIG
 }
@@ -199,7 +477,14 @@ void sched_dump (void)
     };
 
     kprintf (Y"-------------------------- DUMP ALL THREADS ---------------------------\n");
-    kprintf (W"thread current ("P") : "D"\n", ThreadCurrent, ThreadCurrentIdx);
+    for (int cpu = 0; cpu < NCPUS_MAX; cpu++) {
+        if (RunQueue[cpu].idle == NULL) continue;           // CPU not started
+        kprintf (W"cpu "D" current ("P") : "D"\t", cpu, ThreadCurrentTab[cpu],
+                 (ThreadCurrentTab[cpu]) ? ThreadCurrentTab[cpu]->tid : -1);
+        kprintf (W"ready priorities : "P"\t", RunQueue[cpu].ready);
+        kprintf (W"lock : "D" taken "D" contended "D" polls\n", RunQueue[cpu].stat.acquired,
+                 RunQueue[cpu].stat.contended, RunQueue[cpu].stat.polls);
+    }
     for (int th = 0; th < THREAD_MAX; th++) {
         thread_t thread = ThreadTab[th];
         if (thread) {
@@ -208,6 +493,8 @@ void sched_dump (void)
             kprintf ("["D"] thread: "P,  clock (), thread);
             kprintf ("   errmsg: "S"\n", errno_mess(errno));
             kprintf (" - state:     "S"\t", state_name[thread->state]);
+            kprintf ("   prio:      "D" ("D")\t", thread->prio, thread->base);
+            kprintf ("   cpu:       "D"\n", thread->cpu);
             kprintf ("   wait.next: "P"\t", thread->wait.next);
             kprintf ("   wait.prev: "P"\n", thread->wait.prev);
             kprintf (" - retval:    "P"\t", thread->retval);
@@ -257,6 +544,24 @@ void sched_dump (void)
 //--------------------------------------------------------------------------------------------------
 
 
+/**
+ * \brief   function of the timer of a thread, called by the timer ISR of the CPU where the thread
+ *          started its timed wait, when the deadline is reached. If the thread is still waiting
+ *          for its resource, the cancel function removes it from the waiting list of the resource
+ *          under the resource lock, then the thread is notified as it would be by the resource.
+ *          Otherwise, the resource has already notified it and nothing has to be done.
+ * \param   arg is the thread
+ */
+static void thread_timeout (void *arg)
+{
+    thread_t thread = arg;
+    if ((thread->cancel == NULL) || thread->cancel (thread, thread->cancel_arg)) {
+        thread->timedout = 1;                                   // set before the notification
+        thread_notify (thread);                                 // WAIT (or still RUNNING) to READY
+    }
+    thread->timerdone = 1;                                      // the thread struct can be freed
+}
+
 /**
  * \brief   thread_bootstrap() function is the bootstrap of the thread.
  *          It means that it is the very first function we call when the thread_context_load()
@@ -294,6 +599,7 @@ void sched_dump (void)
  */
 static void thread_bootstrap (void)
 {
+    sched_finish ();                                            // the previous thread is saved
     thread_t thread = ThreadCurrent;                            // gets the current thread
     thread->state = TH_STATE_RUNNING;                           // the thread is now RUNNING
     thread_launch (thread->fun, thread->arg, thread->start);    // calls : start(fun,arg)
@@ -307,7 +613,13 @@ int thread_create (thread_t * thread_p, int fun, int arg, int start)
     thread->ustack_b = (int)malloc_ustack();                    // stack beginning (highest address)
     thread->ustack_e = thread->ustack_b - USTACK_SIZE + 4;      // stack end (lowest addr)
     thread->state    = TH_STATE_READY;                          // it can be chosen by the scheduler
+    thread->base     = (ThreadCurrent) ? ThreadCurrent->base    // inherits the static priority
+                                       : SCHED_PRIO_DEFAULT;    // of its creator if any
+    thread->prio     = thread->base;                            // without the boost
+    thread->iowait   = 0;                                       // not waiting for an I/O
     list_init (&thread->wait);                                  // initialize the waiting list
+    ktimer_setup (&thread->timer, thread_timeout, thread);      // not sleeping
+    thread->timerdone = 1;                                      // no timer function is running
     thread->retval   = NULL;                                    // default return value
     thread->join     = NULL;                                    // no awaited thread
     thread->start    = start;                                   // start() will call fun(arg)
@@ -325,13 +637,132 @@ int thread_create (thread_t * thread_p, int fun, int arg, int start)
     sched_insert (thread);                                      // insert new thread in scheduler
     *thread_p = thread;                                         // thread_create true return
     thread->ptls->tls_errno = SUCCESS;                          // syscall's error number
+    thread->ptls->tls_mcache = NULL;                            // malloc() will create it
     return SUCCESS;                                             // if we are here, that is a success
 }
 
+/**
+ * \brief   default start function of a kernel thread, it is reached by thread_launch() in kernel
+ *          mode but with IRQ enabled, thus it disables them as for the rest of the kernel code.
+ * \param   fun     the function of the thread, type: void *(*fun)(void *)
+ * \param   arg     its argument
+ * \return  never returns
+ */
+static void kthread_start (int fun, int arg)
+{
+    irq_disable ();                                             // kernel code is run without IRQ
+    thread_exit (((void *(*)(void *))fun) ((void *)arg));       // exit with the return value
+}
+
+/**
+ * \brief   allocate and initialize a kernel thread, but it is not inserted in the scheduler
+ *          see kthread_create() for the arguments
+ * \return  the new thread or NULL if there is not enough memory
+ */
+static thread_t kthread_alloc (int fun, int arg, int start)
+{
+    thread_t thread = kmalloc (PAGE_SIZE);                      // thread is thus always aligned
+    if (thread == NULL) return NULL;                            // Not enough memory
+    thread->kstack_b = (int)thread + PAGE_SIZE - 4;             // kstack beginning (highest addr)
+    thread->ustack_b = 0;                                       // no user stack
+    thread->ustack_e = 0;
+    thread->state    = TH_STATE_READY;                          // it can be chosen by the scheduler
+    thread->base     = SCHED_PRIO_DEFAULT;                      // default static priority
+    thread->prio     = thread->base;                            // without the boost
+    thread->iowait   = 0;                                       // not waiting for an I/O
+    list_init (&thread->wait);                                  // initialize the waiting list
+    ktimer_setup (&thread->timer, thread_timeout, thread);      // not sleeping
+    thread->timerdone = 1;                                      // no timer function is running
+    thread->retval   = NULL;                                    // default return value
+    thread->join     = NULL;                                    // no awaited thread
+    thread->start    = (start) ? start : (int)kthread_start;    // start() will call fun(arg)
+    thread->fun      = fun;                                     // function of the thread
+    thread->arg      = arg;                                     // argument of the thread
+    thread->ptls     = &thread->ktls;                           // tls in the thread structure
+    kthread_context_init(thread->context,                       // table to store context
+                         thread_bootstrap,                      // thread_bootstrap() to begin
+                         (void *)(thread->kstack_b - 4));       // kernel stack below MAGIC_STACK
+    thread->krandseed  = 1;                                     // default kernel random seed
+
+    *(int*)thread->kstack_b = MAGIC_STACK;                      // should not be erased
+    thread->kstack[0] = MAGIC_STACK;                            // (is kstack_e) should not erased
+    thread->ptls->tls_errno = SUCCESS;                          // kernel functions error number
+    return thread;
+}
+
+int kthread_create (thread_t * thread_p, int fun, int arg, int start)
+{
+    thread_t thread = kthread_alloc (fun, arg, start);
+    if (thread == NULL) return EAGAIN;                          // Not enough memory
+    sched_insert (thread);                                      // insert new thread in scheduler
+    *thread_p = thread;                                         // kthread_create true return
+    return SUCCESS;                                             // if we are here, that is a success
+}
+
+//--------------------------------------------------------------------------------------------------
+// CPUs start, each CPU has an idle thread which is not in ThreadTab[] nor in a run queue
+//--------------------------------------------------------------------------------------------------
+
+/**
+ * \brief   function of the idle thread of each CPU, it is elected when there is no READY thread
+ *          at all, then it sleeps until an IRQ, which can make a thread READY, or until another
+ *          CPU kicks it (sched_kick_idle()), and it tries to elect a thread again, maybe stolen.
+ * \param   arg     not used
+ * \return  never returns
+ */
+static void *sched_idle (void *arg)
+{
+    for (;;) {
+        thread_yield ();                                        // elect a READY thread, if any
+        irq_wait ();                                            // else sleep until an IRQ
+    }
+    return NULL;
+}
+
+/**
+ * \brief   create the idle thread of the current CPU and mark it as started
+ * \return  the idle thread
+ */
+static thread_t sched_cpu_init (void)
+{
+    unsigned cpu = cpuid ();
+    thread_t idle = kthread_alloc ((int)sched_idle, 0, 0);
+    PANIC_IF (idle == NULL, "no memory for the idle thread of cpu %d", cpu);
+    idle->tid  = -1;                                            // not in ThreadTab[]
+    idle->base = 0;                                             // it is never in a run queue
+    idle->prio = 0;
+    idle->cpu  = cpu;
+    RunQueue[cpu].idle = idle;                                  // this CPU is started
+    atomic_add (&__usermem.ncpus, 1);                           // the user mutexes spin if > 1
+    return idle;
+}
+
+void sched_init (void)
+{
+    for (int cpu = 0; cpu < NCPUS_MAX; cpu++) {                 // all the run queues are empty
+        for (int p = 0; p < SCHED_PRIO_NB; p++)
+            list_init (&RunQueue[cpu].queue[p]);
+        ktimer_setup (&RunQueue[cpu].quantum, sched_quantum_end, &RunQueue[cpu]);
+    }
+    sched_cpu_init ();                                          // CPU 0 is started by kinit()
+}
+
+void sched_cpu_start (void)
+{
+    thread_t idle = sched_cpu_init ();                          // the current CPU is started
+    ThreadCurrent = idle;                                       // with its idle thread
+    RunQueue[cpuid()].running = idle;
+    idle->oncpu = 1;
+    thread_main_load (idle);                                    // never returns
+}
+
 static void thread_destroy (thread_t thread)
 {
     PANIC_IF (thread->state != TH_STATE_DEAD, "Attempt to destroy an non-DEAD thread %p", thread); 
-    free_ustack ((int*)thread->ustack_b);                       // free the user stack
+    if (thread->ustack_b)                                       // kernel threads have none
+        free_ustack ((int*)thread->ustack_b);                   // free the user stack
+    if (!ktimer_stop (&thread->timer))                          // it may be killed while sleeping
+        while (!thread->timerdone);                             // or its timer function may run
     sched_unlink (thread);                                      // unlink the thread from the sched
     kfree (thread);                                             // at last free the thread struct
 }
@@ -340,7 +771,6 @@ static void thread_destroy (thread_t thread)
 
 void thread_main_load (thread_t thread)
 {
-    __usermem.ptls = thread->ptls;                              // ptr current thread local storage
     thread_context_load (thread->context);                      // load the register's context
 }
 
@@ -350,9 +780,14 @@ void thread_main_load (thread_t thread)
  * so just we need to put it in a READY state and try to switch to another thread.
  * It is not necessary to take the thread lock, since no one will change the state at this moment
  * If thread is the only READY, it will take the CPU again.
+ * When the timer ISR is taken while sched_elect() sleeps with IRQ enabled, the current thread is
+ * not RUNNING (it is WAIT or ZOMBIE), thus it must not become READY, and nothing is done.
  */
 int thread_yield (void)
 {
+    if (ThreadCurrent->state != TH_STATE_RUNNING)               // idle in sched_elect()
+        return SUCCESS;                                         // keep waiting for a READY thread
+    ThreadCurrent->prio = ThreadCurrent->base;                  // the I/O boost lasts one quantum
     ThreadCurrent->state = TH_STATE_READY;                      // yield the CPU but always READY
     sched_switch ();                                            // Try to change thread
     return SUCCESS;
@@ -378,7 +813,7 @@ void thread_exit (void *retval)
 
     spin_lock (&ThreadCurrent->lock);                           // avoid sequence J1 J2 E1 E2 E3 J3
     if (ThreadCurrent->join != NULL)                            // E2: if there is a thread waiting
-        ThreadCurrent->join->state = TH_STATE_READY;            // E3: then change its state
+        thread_notify (ThreadCurrent->join);                    // E3: then change its state
     spin_unlock (&ThreadCurrent->lock);                         // end of critical section
     sched_switch ();                                            // at last, definitively yield proc
 }
@@ -407,6 +842,7 @@ int thread_join (thread_t thread_expected, void **retval)
         spin_unlock (&thread_expected->lock);                   // end of critical section
     }
     *retval = thread_expected->retval;                          // get the return value
+    while (thread_expected->oncpu);                             // its CPU may still use its stack
     thread_expected->state = TH_STATE_DEAD;                     // finally, the thread is DEAD
     thread_destroy (thread_expected);                           // and has to be destroyed
     return SUCCESS;
@@ -446,6 +882,12 @@ void thread_wait (void)
     sched_switch ();                                            // then switch the thread
 }
 
+void thread_wait_io (void)
+{
+    ThreadCurrent->iowait = 1;                                  // boosted by thread_notify()
+    thread_wait ();
+}
+
 /**
  * Start to read the thread_wait() comment to understand what is T0 and T1.
  * T1 calls the tread_notify() function when the resource expected by T0 has occurred.
@@ -456,9 +898,74 @@ void thread_wait (void)
  */
 void thread_notify (thread_t thread)
 {
-    spin_lock (&ThreadCurrent->lock);                           // !--! critical section
-    thread->state = TH_STATE_READY;                             // (RUNNING or WAIT) to READY
-    spin_unlock (&ThreadCurrent->lock);                         // !--! end of critical section
+    spin_lock (&thread->lock);                                  // !--! critical section
+    sched_wakeup (thread);                                      // (RUNNING or WAIT) to READY
+    spin_unlock (&thread->lock);                                // !--! end of critical section
+}
+
+/**
+ * A timed wait is a thread_wait() with the thread in the wheel of the timer of its CPU, which is
+ * the sleep queue ordered by the wakeup date: the thread is WAIT thus it is in no run queue and it
+ * is never elected until either the resource or its timer notifies it. Both are exclusive since
+ * the notification of the resource and the cancel function, called by the timer, remove the
+ * thread from the waiting list of the resource under the resource lock. Without a resource (sleep)
+ * only the timer notifies it.
+ * At the end, the timer is stopped, but if it has already expired, its function may still run on
+ * the CPU of the timer, then we wait for its end, thus it cannot notify the next wait by mistake.
+ */
+int thread_wait_until (unsigned deadline, int (*cancel) (thread_t, void *), void *arg)
+{
+    thread_t thread = ThreadCurrent;
+    thread->cancel = cancel;                                    // removes the thread from the
+    thread->cancel_arg = arg;                                   // resource at the deadline
+    thread->timedout = 0;
+    thread->timerdone = 0;                                      // thread_timeout() not returned
+    ktimer_start (&thread->timer, cpuid(), deadline);           // in the sleep queue of the CPU
+    thread_wait ();                                             // until the resource or the timer
+    if (!ktimer_stop (&thread->timer))                          // the deadline has been reached
+        while (!thread->timerdone);                             // wait for the end of its function
+    return thread->timedout;
+}
+
+int thread_sleep (unsigned cycles)
+{
+    if (cycles == 0)                                            // nothing to wait, but the CPU
+        return thread_yield ();                                 // is yielded as POSIX asks for
+    thread_wait_until (clock () + cycles, NULL, NULL);          // only the timer can notify it
+    return SUCCESS;
+}
+
+void thread_preempt (void)
+{
+    sched_rq_t *rq = &RunQueue[cpuid()];
+    if (rq->resched) {                                          // end of quantum or preemption
+        rq->resched = 0;
+        thread_yield ();
+    }
+}
+
+int thread_may_wait (void)
+{
+    return ThreadCurrent && (ThreadCurrent->state == TH_STATE_RUNNING);
+}
+
+int thread_setprio (thread_t thread, int prio)
+{
+    if (thread == NULL)                                         // NULL for the current thread
+        thread = ThreadCurrent;
+    if ((prio < 0) || (prio >= SCHED_PRIO_NB))                  // 0 is the lowest, 31 the highest
+        return EINVAL;
+    spin_lock (&thread->lock);                                  // !--! critical section
+    sched_setprio (thread, prio);                               // moved if it is READY
+    spin_unlock (&thread->lock);                                // !--! end of critical section
+    return SUCCESS;
+}
+
+int thread_getprio (thread_t thread)
+{
+    if (thread == NULL)                                         // NULL for the current thread
+        thread = ThreadCurrent;
+    return thread->base;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -468,8 +975,7 @@ void thread_notify (thread_t thread)
 /**
  * \brief   cleanup all threads of a given process
  *          cleanup the scheduler from all threads of that process and destoy the concerned threads
- *          The scheduler is a simple table of all the threads
- *          To cleanup, we need to find out the process's threads and delete them
+ *          The threads are found in ThreadTab[], the READY ones are also removed from the run queue
  * \param   pid the process identifier that owns the mutexes
  * \return  0 on success, 1 on fealure
  */
@@ -479,9 +985,12 @@ int process_threads_cleanup (int pid)
     while (tid < THREAD_MAX) {                              // scan all threads
         thread_t thread = ThreadTab[tid];                  // get the current one
         if (thread && (thread->pid == pid)) {               // is a thread to delete
+            if ((thread->state == TH_STATE_READY) && !thread->oncpu)
+                sched_dequeue (thread);                     // it must not be elected anymore
             thread->state = TH_STATE_DEAD;                  // it is dead
             thread_destroy (thread);                        // thus destroy it
         }
+        tid++;
     }
     return 0;
 }
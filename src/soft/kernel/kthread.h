@@ -15,6 +15,7 @@
 #define _KTHREAD_H_
 
 #include <common/list.h>
+#include <hal/cpu/cpuregs.h>         // NCPUS_MAX and cpuid() for ThreadCurrent
 
 //--------------------------------------------------------------------------------------------------
 // Maximum number of thread it can be changed
@@ -24,6 +25,16 @@
 #define THREAD_MAX          4
 
 
+//--------------------------------------------------------------------------------------------------
+// Thread priorities, the scheduler elects the first READY thread of the highest priority
+//--------------------------------------------------------------------------------------------------
+
+
+#define SCHED_PRIO_NB       32      /* priorities from 0 to 31 (the highest), one bit per prio */
+#define SCHED_PRIO_DEFAULT  16      /* priority of the first threads, the others inherit it */
+#define SCHED_PRIO_BOOST    4       /* bonus of a thread notified after an I/O wait, one quantum */
+
+
 //--------------------------------------------------------------------------------------------------
 // Thread states
 //-------------------------------------------------------------------------------------------------
@@ -47,11 +58,13 @@
 typedef struct thread_s * thread_t;
 
 /**
- * \brief   Pointeur to the current RUNNING thread (only one per processor)
- *          TODO should be an array if there are several processor
+ * \brief   Pointeur to the current RUNNING thread of each processor, ThreadCurrent is the one of
+ *          the current processor. ThreadCurrentTab[] is also used by the kernel entry (syscalls
+ *          and IRQs) to find the kernel stack of the current thread.
  *          TODO add a variable to count the number of threads and check it when tbread_create
  */
-extern thread_t ThreadCurrent;  
+extern thread_t ThreadCurrentTab[NCPUS_MAX];
+#define ThreadCurrent (ThreadCurrentTab[cpuid()])
 
 /**
  * \brief   Add a thread at the end of a thread list
@@ -67,6 +80,19 @@ extern void thread_addlast (list_t * root, thread_t thread);
  */
 extern thread_t thread_item (list_t * item);
 
+/**
+ * \brief   Initialize the scheduler run queues of all CPUs and the idle thread of CPU 0,
+ *          it must be called by kinit() before the first thread_create
+ */
+extern void sched_init (void);
+
+/**
+ * \brief   Start the current CPU (not the CPU 0) once kinit() is done, its idle thread is loaded
+ *          and it takes READY threads from the other CPUs. It is called by kinit_cpu().
+ * \return  never returns
+ */
+extern void sched_cpu_start (void);
+
 /**
  * \brief   Displays on the console (tty0) all active threads, it is for debugging.
  */
@@ -92,7 +118,14 @@ extern int thread_create (thread_t * thread, int fun, int arg, int start);
 
 /**
  * \brief   same as thread_create but create a kernel thread
- *          Feb, 25th: presently only used in kernel init
+ *          It has no user stack, it runs in kernel mode on its kernel stack with IRQ disabled,
+ *          and the thread function is a kernel function (e.g. the block write-back thread).
+ * \param   thread  pointer to the thread structure
+ * \param   fun     pointer to the function of the thread, void *(*fun)(void *) (cast to int)
+ * \param   arg     the argument given to fun() (cast to int)
+ * \param   start   pointer to the function which will start the thread (cast to int),
+ *                  0 for the default one which calls thread_exit(fun(arg))
+ * \return  0 on success, an error code on fealure
  */
 extern int kthread_create (thread_t * thread, int fun, int arg, int start);
 
@@ -108,6 +141,13 @@ extern void thread_main_load (thread_t thread);
  */
 extern int thread_yield (void);
 
+/**
+ * \brief   Yield the CPU if the quantum of the current thread is over, or if a thread of a higher
+ *          priority is READY, it is called by the timer ISR (see tick_event()) after the kernel
+ *          timers, there is no periodic tick thus the ISR is raised only when it is needed.
+ */
+extern void thread_preempt (void);
+
 /**
  * \brief   Terminates the current thread, it never returns (see details in kthread.c)
  * \param   retval the value can be retrieved by calling the thread_join function by another thread
@@ -135,6 +175,35 @@ extern int thread_join (thread_t thread, void ** retval);
  */
 extern void thread_wait (void);
 
+/**
+ * \brief   Same as thread_wait() but for an I/O (device transfer, char from a tty, etc.)
+ *          When it is notified, the thread gets SCHED_PRIO_BOOST more than its static priority
+ *          until it yields the CPU or its quantum ends, thus it preempts the threads that compute.
+ * \return  nothing but there is a state changement
+ */
+extern void thread_wait_io (void);
+
+/**
+ * \brief   Same as thread_wait() but with a deadline, the thread is notified either by the resource
+ *          or by its timer when the deadline is reached (see details in kthread.c)
+ * \param   deadline    absolute date in cycles (comparable to clock())
+ * \param   cancel      function called at the deadline with the thread and arg, it must remove the
+ *                      thread from the waiting list of the resource, under the resource lock, and
+ *                      return 1 if it was there, 0 if the resource has already notified it.
+ *                      NULL when there is no resource, then only the timer notifies the thread.
+ * \param   arg         argument of cancel (the resource)
+ * \return  1 if the deadline has been reached, 0 if the thread has been notified by the resource
+ */
+extern int thread_wait_until (unsigned deadline, int (*cancel) (thread_t, void *), void *arg);
+
+/**
+ * \brief   Sleep for a number of cycles, it is the SYSCALL_NANOSLEEP syscall
+ *          The thread is WAIT meanwhile, thus its CPU runs the other threads or sleeps.
+ * \param   cycles  number of cycles to sleep, 0 simply yields the CPU
+ * \return  0 (SUCCESS)
+ */
+extern int thread_sleep (unsigned cycles);
+
 /**
  * \brief   Ask the current RUNNING thread to WAIT
  *          the current thread must become READY again after the call to thread_notify().
@@ -146,6 +215,30 @@ extern void thread_wait (void);
  */
 extern void thread_notify (thread_t thread);
 
+/**
+ * \brief   Tell if the current execution may call thread_wait()
+ *          It is false during kinit, before the first thread is loaded, because there is no
+ *          RUNNING thread, then the drivers must poll their devices instead of waiting for IRQs.
+ * \return  1 if there is a RUNNING thread, 0 otherwise
+ */
+extern int thread_may_wait (void);
+
+/**
+ * \brief   Set the static priority of a thread, it is the SYSCALL_SCHED_SETPARAM syscall
+ *          The scheduler elects the READY thread of the highest priority, round robin for the same
+ * \param   thread  the thread to change, NULL for the current thread
+ * \param   prio    the new priority from 0 (the lowest) to SCHED_PRIO_NB-1 (the highest)
+ * \return  0 on success, EINVAL if the priority is out of range
+ */
+extern int thread_setprio (thread_t thread, int prio);
+
+/**
+ * \brief   Get the static priority of a thread, it is the SYSCALL_SCHED_GETPARAM syscall
+ * \param   thread  the thread, NULL for the current thread
+ * \return  its static priority (without the boost of an I/O wait)
+ */
+extern int thread_getprio (thread_t thread);
+
 /**
  * \brief   return address of errno for the thread given
  *          this function is defined here, because it needs to access at the hidden thread struct
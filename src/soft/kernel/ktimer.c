@@ -0,0 +1,250 @@
+/*------------------------------------------------------------------------------------------------*\
+   _     ___    __
+  | |__ /'v'\  / /      \date 2025-04-23
+  | / /(     )/ _ \     Copyright (c) 2021 Sorbonne University
+  |_\_\ x___x \___/     SPDX-License-Identifier: MIT
+
+  \file     kernel/ktimer.c
+  \author   Franck Wajsburt
+  \brief    One-shot kernel timers on a timer wheel per CPU
+
+  Timer wheel
+
+    * Each CPU has a wheel of KTIMER_SLOTS lists, a pending timer is in the slot of its date:
+      (expire >> KTIMER_GRAIN) % KTIMER_SLOTS, thus starting or stopping a timer is O(1).
+      A timer farther than a revolution of the wheel is in the same slot as the timers of the
+      current revolution, it is skipped until its date is reached.
+    * When the timer device of the CPU raises its IRQ, ktimer_event() browses the slots from
+      the last event up to now, moves the expired timers to the expired list, then calls their
+      functions one by one, without the wheel lock, thus they can start timers.
+    * The timer device is programmed for the earliest date only, found by browsing the slots
+      from now. A stopped timer does not reprogram the device, at worst there is a useless IRQ.
+      If there is no pending timer, the device is stopped.
+    * The dates are compared by their difference, thus a wrap of clock() is not a problem as
+      long as the timers are not set more than 2^31 cycles away.
+    * ktimer_clock64() extends clock() with the number of its wraps (epoch), the KtimerEpoch
+      timer reads it every 2^30 cycles, thus each wrap is seen even if nobody asks the time.
+
+\*------------------------------------------------------------------------------------------------*/
+
+#include <kernel/klibc.h>
+
+#define KTIMER_SLOT(date)   (((date) >> KTIMER_GRAIN) & (KTIMER_SLOTS - 1))
+#define KTIMER_BEFORE(a,b)  ((int)((a) - (b)) < 0)          // date a is before date b
+
+typedef struct ktimer_wheel_s {
+    spinlock_t  lock;                       // protects the slots, the CPU and the other ones
+    list_t      slot[KTIMER_SLOTS];         // pending timers, hashed on their date
+    list_t      expired;                    // expired timers, their function is not yet called
+    unsigned    last;                       // date of the last ktimer_event()
+    unsigned    deadline;                   // date programmed in the timer device
+    int         armed;                      // 1 if the timer device is programmed
+} ktimer_wheel_t;
+
+static ktimer_wheel_t KtimerWheel[NCPUS_MAX];
+
+#define KTIMER_EPOCH_PERIOD (1U << 30)                      // less than a half wrap of clock()
+
+static struct {
+    spinlock_t  lock;                       // protects last and epoch
+    unsigned    last;                       // latest clock() read by ktimer_clock64()
+    unsigned    epoch;                      // number of wraps of clock() up to last
+} KtimerClock;
+
+static ktimer_t KtimerEpoch;                // reads the clock every KTIMER_EPOCH_PERIOD cycles
+
+//--------------------------------------------------------------------------------------------------
+// Timer wheel internal functions, the wheel lock is held
+//--------------------------------------------------------------------------------------------------
+
+/**
+ * \brief   find the earliest date of the pending timers of a wheel
+ * \param   wheel   the wheel
+ * \param   now     current date
+ * \param   next    pointer to the earliest date, if any
+ * \return  1 if there is a pending timer, 0 otherwise
+ */
+static int ktimer_next (ktimer_wheel_t *wheel, unsigned now, unsigned *next)
+{
+    int found = 0;
+    for (unsigned s = 0; s < KTIMER_SLOTS; s++) {           // from the slot of now
+        unsigned slot = (now >> KTIMER_GRAIN) + s;          // slot number, not yet modulo
+        unsigned end = (slot + 1) << KTIMER_GRAIN;          // first date of the next slot
+        list_foreach (&wheel->slot[slot & (KTIMER_SLOTS - 1)], item) {
+            ktimer_t *timer = list_item (item, ktimer_t, list);
+            if (KTIMER_BEFORE (timer->expire, end)          // in the current revolution
+            && (!found || KTIMER_BEFORE (timer->expire, *next))) {
+                *next = timer->expire;
+                found = 1;
+            }
+        }
+        if (found)                                          // the following slots are later
+            return 1;
+    }
+    for (unsigned s = 0; s < KTIMER_SLOTS; s++) {           // nothing in a revolution, thus
+        list_foreach (&wheel->slot[s], item) {              // the earliest of the far timers
+            ktimer_t *timer = list_item (item, ktimer_t, list);
+            if (!found || KTIMER_BEFORE (timer->expire, *next)) {
+                *next = timer->expire;
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * \brief   program the timer device of a CPU for the earliest date of its wheel, or stop it
+ * \param   wheel   the wheel of the CPU
+ * \param   cpu     the CPU, timer n interrupts CPU n
+ * \param   force   1 to program the device even if it is already programmed earlier
+ */
+static void ktimer_program (ktimer_wheel_t *wheel, unsigned cpu, int force)
+{
+    device_t *dev = dev_get (TIMER_DEV, cpu);
+    if (dev == NULL)                                        // the CPU has no timer
+        return;
+    timer_t *timer = (timer_t *) dev->data;
+
+    unsigned next = 0;
+    if (!ktimer_next (wheel, clock (), &next)) {            // no pending timer, no IRQ at all
+        if (wheel->armed || force)
+            timer->ops->timer_set_tick (timer, 0);
+        wheel->armed = 0;
+        return;
+    }
+    if (wheel->armed && !force && !KTIMER_BEFORE (next, wheel->deadline))
+        return;                                             // the device will raise the IRQ
+    wheel->deadline = next;
+    wheel->armed = 1;
+    timer->ops->timer_set_deadline (timer, next);
+}
+
+/**
+ * \brief   function of the KtimerEpoch timer, it counts a wrap of clock() if any, then restarts
+ * \param   arg     not used
+ */
+static void ktimer_epoch (void *arg)
+{
+    ktimer_clock64 ();
+    ktimer_start (&KtimerEpoch, cpuid (), clock () + KTIMER_EPOCH_PERIOD);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Kernel timer API
+//--------------------------------------------------------------------------------------------------
+
+void ktimer_init (void)
+{
+    for (int cpu = 0; cpu < NCPUS_MAX; cpu++) {
+        for (int s = 0; s < KTIMER_SLOTS; s++)
+            list_init (&KtimerWheel[cpu].slot[s]);
+        list_init (&KtimerWheel[cpu].expired);
+        KtimerWheel[cpu].last = clock ();
+    }
+    ktimer_setup (&KtimerEpoch, ktimer_epoch, NULL);        // the timer device is programmed by
+    ktimer_start (&KtimerEpoch, cpuid (), clock () + KTIMER_EPOCH_PERIOD); // the next start
+}
+
+unsigned long long ktimer_clock64 (void)
+{
+    spin_lock (&KtimerClock.lock);                          // !--! critical section
+    unsigned now = clock ();
+    unsigned epoch = KtimerClock.epoch;
+    if (!KTIMER_BEFORE (now, KtimerClock.last)) {           // not older than the latest reading
+        if (now < KtimerClock.last)                         // clock() has wrapped meanwhile
+            epoch = ++KtimerClock.epoch;
+        KtimerClock.last = now;
+    } else if (now > KtimerClock.last) {                    // a bit older (another CPU) and read
+        epoch--;                                            // before the wrap of the latest one
+    }
+    spin_unlock (&KtimerClock.lock);                        // !--! end of critical section
+    return ((unsigned long long) epoch << 32) | now;
+}
+
+void ktimer_setup (ktimer_t *timer, void (*fun) (void *arg), void *arg)
+{
+    list_init (&timer->list);
+    timer->cpu = -1;                                        // not pending
+    timer->fun = fun;
+    timer->arg = arg;
+}
+
+void ktimer_start (ktimer_t *timer, unsigned cpu, unsigned expire)
+{
+    ktimer_stop (timer);                                    // it may be on another wheel
+    ktimer_wheel_t *wheel = &KtimerWheel[cpu];
+    spin_lock (&wheel->lock);                               // !--! critical section
+    unsigned now = clock ();
+    if (KTIMER_BEFORE (expire, now))                        // already passed, thus as soon as
+        expire = now;                                       // possible, in the slot of now
+    timer->expire = expire;
+    timer->cpu = cpu;
+    list_addlast (&wheel->slot[KTIMER_SLOT (expire)], &timer->list);
+    if (!wheel->armed || KTIMER_BEFORE (expire, wheel->deadline))
+        ktimer_program (wheel, cpu, 0);                     // it is the earliest one
+    spin_unlock (&wheel->lock);                             // !--! end of critical section
+}
+
+int ktimer_stop (ktimer_t *timer)
+{
+    int cpu = timer->cpu;
+    if (cpu < 0)                                            // not pending
+        return 0;
+    int stopped = 0;
+    ktimer_wheel_t *wheel = &KtimerWheel[cpu];
+    spin_lock (&wheel->lock);                               // !--! critical section
+    if (timer->cpu == cpu) {                                // not expired meanwhile
+        list_unlink (&timer->list);                         // from its slot or the expired list
+        timer->cpu = -1;
+        stopped = 1;
+    }
+    spin_unlock (&wheel->lock);                             // !--! end of critical section
+    return stopped;
+}
+
+int ktimer_pending (ktimer_t *timer)
+{
+    return (timer->cpu >= 0);
+}
+
+void ktimer_event (void)
+{
+    unsigned cpu = cpuid ();
+    ktimer_wheel_t *wheel = &KtimerWheel[cpu];
+
+    spin_lock (&wheel->lock);                               // !--! critical section
+    unsigned now = clock ();
+    unsigned from = wheel->last >> KTIMER_GRAIN;            // browse the slots since the last
+    unsigned to = now >> KTIMER_GRAIN;                      // event up to now, each once at most
+    if (to - from >= KTIMER_SLOTS)
+        to = from + KTIMER_SLOTS - 1;
+    for (unsigned slot = from; slot != to + 1; slot++) {
+        list_foreach (&wheel->slot[slot & (KTIMER_SLOTS - 1)], item) {
+            ktimer_t *timer = list_item (item, ktimer_t, list);
+            if (!KTIMER_BEFORE (now, timer->expire)) {      // expired
+                list_unlink (&timer->list);
+                list_addlast (&wheel->expired, &timer->list);
+            }
+        }
+    }
+    wheel->last = now;
+    wheel->armed = 0;                                       // the IRQ is raised
+
+    list_t *item;
+    while ((item = list_getfirst (&wheel->expired)) != NULL) {
+        ktimer_t *timer = list_item (item, ktimer_t, list);
+        timer->cpu = -1;                                    // not pending anymore
+        spin_unlock (&wheel->lock);                         // !--! the function can start timers
+        timer->fun (timer->arg);
+        spin_lock (&wheel->lock);                           // !--! critical section again
+    }
+    ktimer_program (wheel, cpu, 1);                         // next date or stop the device
+    spin_unlock (&wheel->lock);                             // !--! end of critical section
+}
+
+/*------------------------------------------------------------------------------------------------*\
+   Editor config (vim/emacs): tabs are 4 spaces, max line length is 100 characters
+   vim: set ts=4 sw=4 sts=4 et tw=100:
+   -*- mode: c; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil; fill-column: 100 -*-
+\*------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,97 @@
+/*------------------------------------------------------------------------------------------------*\
+   _     ___    __
+  | |__ /'v'\  / /      \date 2025-04-23
+  | / /(     )/ _ \     Copyright (c) 2021 Sorbonne University
+  |_\_\ x___x \___/     SPDX-License-Identifier: MIT
+
+  \file     kernel/ktimer.h
+  \author   Franck Wajsburt
+  \brief    One-shot kernel timers
+
+            A kernel timer calls a function at an absolute date, given in cycles as clock().
+            Each CPU has a timer wheel and its timer device is programmed in one-shot mode for
+            the earliest date of its wheel only, thus there is no periodic tick: a CPU which is
+            idle or which runs a single thread is not interrupted at all.
+
+\*------------------------------------------------------------------------------------------------*/
+
+#ifndef _KTIMER_H_
+#define _KTIMER_H_
+
+#include <common/list.h>
+
+#define KTIMER_TICK     200000  ///< cycles of a tick, the scheduler quantum and block cache unit
+#define KTIMER_SLOTS    64      ///< number of slots of the wheel of each CPU (power of 2)
+#define KTIMER_GRAIN    14      ///< log2 of the number of cycles covered by a slot
+
+/**
+ * \brief   kernel timer, it is owned by the caller (thus without any allocation)
+ *          it must be initialized by ktimer_setup() before the first ktimer_start()
+ */
+typedef struct ktimer_s {
+    list_t      list;           ///< element of its wheel slot, or of the expired list
+    unsigned    expire;         ///< date in cycles
+    int         cpu;            ///< CPU of the wheel where the timer is, -1 if it is not pending
+    void (*fun) (void *arg);    ///< function called when the date is reached
+    void *      arg;            ///< its argument
+} ktimer_t;
+
+/**
+ * \brief   Initialize the timer wheels of all CPUs, called by kinit() before the scheduler
+ */
+extern void ktimer_init (void);
+
+/**
+ * \brief   Initialize a kernel timer, it is not pending
+ * \param   timer   the timer to initialize
+ * \param   fun     function called by the timer IRQ of the CPU, with the IRQ disabled.
+ *                  It must not switch the thread (nor wait), but it can start timers.
+ * \param   arg     its argument
+ */
+extern void ktimer_setup (ktimer_t *timer, void (*fun) (void *arg), void *arg);
+
+/**
+ * \brief   Start or restart a timer, fun(arg) will be called at the date expire by the CPU cpu
+ *          A date already passed is the next timer IRQ of the CPU, as soon as possible.
+ * \param   timer   the timer, if it is pending, it is stopped first
+ * \param   cpu     the CPU which calls the function, its timer device is programmed
+ * \param   expire  date in cycles (comparable to clock())
+ */
+extern void ktimer_start (ktimer_t *timer, unsigned cpu, unsigned expire);
+
+/**
+ * \brief   Stop a timer if it is pending, then its function will not be called
+ * \param   timer   the timer
+ * \return  1 if it was pending, 0 if it was not started or if it has expired, then its function
+ *          has been called or it is being called by the CPU of the timer
+ */
+extern int ktimer_stop (ktimer_t *timer);
+
+/**
+ * \brief   Tell if a timer is pending
+ * \param   timer   the timer
+ * \return  1 if it is started and not yet expired, 0 otherwise
+ */
+extern int ktimer_pending (ktimer_t *timer);
+
+/**
+ * \brief   Call the functions of the expired timers of the current CPU, then program its timer
+ *          device for the next date. It is called by the timer ISR (see tick_event()).
+ */
+extern void ktimer_event (void);
+
+/**
+ * \brief   Cycle counter extended to 64 bits, clock() gives the 32 lower bits and wraps.
+ *          The wraps are counted at each call, and a kernel timer calls it every 2^30 cycles,
+ *          thus none is missed. It is the time base of clock_gettime() (see SYSCALL_CLOCK64).
+ * \return  the number of cycles since the reset
+ */
+extern unsigned long long ktimer_clock64 (void);
+
+#endif//_KTIMER_H_
+
+/*------------------------------------------------------------------------------------------------*\
+   Editor config (vim/emacs): tabs are 4 spaces, max line length is 100 characters
+   vim: set ts=4 sw=4 sts=4 et tw=100:
+   -*- mode: c; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil; fill-column: 100 -*-
+\*------------------------------------------------------------------------------------------------*/
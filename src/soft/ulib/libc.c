@@ -34,6 +34,78 @@ void delay (unsigned nbcycles)
     while (clock () < expected_time);           // wait for expected time
 }
 
+/**
+ * \brief   64 bits division by a 32 bits divisor, without the helper functions of libgcc
+ * \param   n       dividend
+ * \param   d       divisor, not 0
+ * \param   rem     if not NULL, the remainder is written there
+ * \return  the quotient
+ */
+static unsigned long long udiv64 (unsigned long long n, unsigned d, unsigned *rem)
+{
+    unsigned long long q = 0, r = 0;
+    for (int bit = 0; bit < 64; bit++) {                    // long division, from the MSB
+        r = (r << 1) | (n >> 63);
+        n <<= 1;
+        q <<= 1;
+        if (r >= d) {
+            r -= d;
+            q |= 1;
+        }
+    }
+    if (rem) *rem = (unsigned)r;
+    return q;
+}
+
+/**
+ * \brief   convert nanoseconds (less than a second) to cycles of clock()
+ */
+static unsigned nsec_to_clock (long nsec)
+{
+    return (unsigned)udiv64 ((unsigned long long)nsec * CLOCKS_PER_SEC, 1000000000, NULL);
+}
+
+int nanosleep (const struct timespec *req, struct timespec *rem)
+{
+    if ((req->tv_sec < 0) || (req->tv_nsec < 0) || (req->tv_nsec > 999999999)) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (long sec = req->tv_sec; sec; sec--)                // one second at once, the kernel
+        syscall_fct (CLOCKS_PER_SEC, 0, 0, 0, SYSCALL_NANOSLEEP); // dates are within 2^31 cycles
+    syscall_fct (nsec_to_clock (req->tv_nsec), 0, 0, 0, SYSCALL_NANOSLEEP);
+    if (rem) {                                              // a sleep is never interrupted
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
+    return 0;
+}
+
+int usleep (unsigned usec)
+{
+    struct timespec req = { usec / 1000000, (usec % 1000000) * 1000 };
+    return nanosleep (&req, NULL);
+}
+
+int clock_gettime (int clockid, struct timespec *tp)
+{
+    if (clockid != CLOCK_MONOTONIC) {
+        errno = EINVAL;
+        return -1;
+    }
+    unsigned long long now;                                 // 64 bits, it does not wrap
+    syscall_fct ((int)&now, 0, 0, 0, SYSCALL_CLOCK64);
+    unsigned cycles;                                        // cycles of the current second
+    tp->tv_sec  = (long)udiv64 (now, CLOCKS_PER_SEC, &cycles);
+    tp->tv_nsec = (long)udiv64 ((unsigned long long)cycles * 1000000000, CLOCKS_PER_SEC, NULL);
+    return 0;
+}
+
+unsigned timespec_to_clock (const struct timespec *tp)
+{
+    return (unsigned)tp->tv_sec * CLOCKS_PER_SEC + nsec_to_clock (tp->tv_nsec); // modulo 2^32
+}
+
 int read(int fd, void *buf, int count)
 {
     return syscall_fct( fd, (int)buf, count, 0, SYSCALL_READ);
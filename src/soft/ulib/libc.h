@@ -47,6 +47,17 @@
 
 #define O_FILE          __usermem.o_file
 
+#define CLOCKS_PER_SEC  (__usermem.clock_freq) /* clock() frequency, from the device tree */
+#define CLOCK_MONOTONIC 1           /* the only clock of clock_gettime(), cycles since the reset */
+
+/**
+ * \brief   time in seconds and nanoseconds, as in POSIX
+ */
+struct timespec {
+    long tv_sec;                    ///< seconds
+    long tv_nsec;                   ///< nanoseconds, from 0 to 999999999
+};
+
 /**
  * \brief   finds the error message corresponding to the current value of the global variable 
  *          errno and writes it, followed by a newline (errno is thread safe)
@@ -66,6 +77,40 @@ extern void exit (int status);
  */
 extern void delay (unsigned nbcycles);
 
+/**
+ * \brief     sleep for at least req, the thread waits in the kernel, thus the CPU runs the others
+ * \param     req   time to sleep
+ * \param     rem   if not NULL, the remaining time is written (0 since sleeps are not interrupted)
+ * \return    0 on success, -1 with errno EINVAL if tv_nsec is out of range
+ */
+extern int nanosleep (const struct timespec *req, struct timespec *rem);
+
+/**
+ * \brief     sleep for at least usec microseconds, same as nanosleep()
+ * \param     usec  number of microseconds
+ * \return    0
+ */
+extern int usleep (unsigned usec);
+
+/**
+ * \brief     get the time of a clock, there is only CLOCK_MONOTONIC, the cycles since the reset
+ *            counted on 64 bits by the kernel, thus it does not wrap as clock(),
+ *            it is the time base of the absolute dates of the timed waits (e.g. timedlock)
+ * \param     clockid   must be CLOCK_MONOTONIC
+ * \param     tp        the time is written there
+ * \return    0 on success, -1 with errno EINVAL if the clock is unknown
+ */
+extern int clock_gettime (int clockid, struct timespec *tp);
+
+/**
+ * \brief     convert an absolute time of CLOCK_MONOTONIC to a date in cycles (as clock())
+ *            The kernel compares the dates modulo 2^32, thus a deadline of a timed wait must stay
+ *            within 2^31 cycles of the current time (about 42 s at 50 MHz)
+ * \param     tp    the time
+ * \return    the date in cycles, modulo 2^32 as clock()
+ */
+extern unsigned timespec_to_clock (const struct timespec *tp);
+
 /**
  * \brief     reads in at most count characters from fd and stores them into buf.
  * \param     fd    normally it is the file descriptor, but now it is just the tty number
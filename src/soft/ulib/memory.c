@@ -8,25 +8,105 @@
   \author   Franck Wajsburt
   \brief    User memory allocator
 
+  Blocks
+
+    * The heap is a sequence of contiguous blocks, aligned on a cache line, each block begins
+      with a block_info_t (the boundary tag) with its size, its state (full or free) and the
+      state of the previous block. A free block also ends with its size (the footer), thus
+      free() finds both neighbours of a block in constant time, and it merges the free ones,
+      there are never two contiguous free blocks.
+    * The free blocks are in size-segregated free lists (the bins), hence malloc() does not
+      browse the heap. Their size in cache lines (lines) selects where they are:
+      - lines < SMALL_BINS: in Heap.bin[lines], all blocks of a bin have the same size, and the
+        bit lines of Heap.binmap tells if the bin is not empty,
+      - lines >= SMALL_BINS: in Heap.tree, a bitwise trie on the size: at depth d, the bit
+        TREE_BITS-1-d of the size selects the child, the blocks of the same size are chained to
+        the one which is in the tree. Its depth is at most TREE_BITS, whatever the heap history.
+
+    void * malloc (size_t size)
+      * the size with its block_info is rounded up to a cache line
+      * the first non empty small bin large enough is taken (an exact fit if possible), else
+        the best fit of the tree, that is the smallest block large enough.
+      * If the block is larger than needed, it is cut and the remaining space goes to its bin.
+
+    void free (void * ptr)
+      * The block is merged with its next and previous blocks if they are free (they are removed
+        from their bins first), then the resulting block goes to its bin.
+
+  Heap growth
+
+    * The last line of the heap is the tail tag (Heap.end), a full block of size 0, thus the
+      last block has always a next one, and the tail tag tells if the last block is free.
+    * When there is no free block large enough, malloc() extends the heap with sbrk() by a chunk
+      (or more if needed), the chunk size is doubled at each extension from CHUNK_MIN up to
+      CHUNK_MAX, thus a large heap is obtained with few syscalls. The new space is a free block
+      merged with the last block if it is free.
+    * When free() makes a last free block larger than two chunks, the heap is reduced with a
+      negative sbrk(), but a chunk is kept to not call sbrk() again at the next malloc().
+
+  Thread caches
+
+    * The heap is shared by all the threads of the application, it is protected by HeapLock.
+    * Each thread has a cache of small blocks (up to CACHE_CLASSES cache lines), pointed by its
+      tls, thus most of the malloc() and free() of small objects do not take HeapLock at all.
+      The cached blocks stay full for the heap, they are chained by their first word.
+    * When the list of a size is empty, malloc() takes a single block of CACHE_BATCH times the
+      size from the heap, then it cuts it into CACHE_BATCH full blocks.
+      When the list is longer than CACHE_MAX, free() gives CACHE_BATCH blocks back to the heap.
+    * A block can be freed by another thread than the one which has allocated it, it goes to
+      the cache of the thread that frees it. pthread_exit() empties the cache of the thread.
+    * The tls of the thread is found from its stack slot by __tls() (see common/usermem.h).
+
 \*------------------------------------------------------------------------------------------------*/
 
 #include <libc.h>
+#include <pthread.h>
 
 //------------------------------------------------------------------------------- private definition
 
 static size_t CacheLineSize;    // cache line size set by malloc_init
 
-typedef struct block_info_s {   // small structure always put at the beginning of each blocks
+#define SMALL_BINS  32          // bin[i] has the free blocks of i cache lines (bin[0] is unused)
+#define TREE_BITS   23          // number of bits of the size field, thus the max depth of the tree
+#define CHUNK_MIN   (4*PAGE_SIZE)   // first heap extension, the chunk size is doubled at each one
+#define CHUNK_MAX   (64*PAGE_SIZE)  // up to this limit
+#define CACHE_CLASSES   8       // a thread caches the blocks of 1 to CACHE_CLASSES cache lines
+#define CACHE_BATCH     8       // number of blocks moved at once between a cache and the heap
+#define CACHE_MAX       (2*CACHE_BATCH) // max number of cached blocks of a size
+
+typedef struct block_info_s {   // boundary tag always put at the beginning of each blocks
     unsigned full:1;            // 1 full, 0 free (means empty)
+    unsigned prevfull:1;        // 1 if the previous block is full or if there is none
     unsigned magic:7;           // MAGIC_HEAP : magic number to check the corruption
-    unsigned size:24;           // Number of block_info to the next block_info
+    unsigned size:23;           // Number of block_info to the next block_info
 } block_info_t;
 
+typedef struct free_block_s {   // free block, its last word is its size (the footer)
+    block_info_t info;          // boundary tag
+    list_t list;                // element of a small bin, or of the blocks of a tree node size
+    struct free_block_s *child[2];  // tree only: children for the current bit of the size at 0/1
+    struct free_block_s *parent;    // tree only: parent node, NULL for the root
+    int intree;                 // tree only: 1 if it is a node, 0 if it is chained to a node
+} free_block_t;
+
 static struct heap_s {          // user Heap
     block_info_t *beg;          // Heap beginning
-    block_info_t *end;          // Heap end
+    block_info_t *end;          // Heap end, tail tag: full block of size 0 (after the last one)
+    int *brk;                   // first address above the heap, given by sbrk()
+    size_t chunk;               // number of bytes of the next heap extension
+    unsigned line;              // number of block_info in a cache line
+    unsigned binmap;            // bit i is 1 if bin[i] is not empty
+    list_t bin[SMALL_BINS];     // small free blocks, by size in cache lines
+    free_block_t *tree;         // large free blocks, bitwise trie on their size
 } Heap;
 
+static pthread_mutex_t HeapLock = PTHREAD_MUTEX_INITIALIZER;    // Heap is shared by the threads
+
+typedef struct malloc_cache_s { // thread cache, allocated in the heap by the first malloc()
+    block_info_t *head[CACHE_CLASSES];  // head[i] chains the full blocks of i+1 cache lines
+    unsigned count[CACHE_CLASSES];      // number of blocks in head[i]
+} malloc_cache_t;
+
 // C Macros to align a pointer p to the current cache line address or the next one
 // For example, let the CacheLineSize is 0x10 Bytes (4 int), then
 // if p = 0x76543214 then LINE_FLOOR(p) = 0x76543210 and LINE_CEIL(p) = 0x76543220
@@ -35,39 +115,376 @@ static struct heap_s {          // user Heap
 #define LINE_CEIL(p)    (block_info_t *)CEIL((size_t)(p),CacheLineSize)
 #define BINFO_SZ        sizeof(block_info_t)
 
-static void* try_malloc (size_t size)
+/**
+ * \brief   replace a node of the tree by another one, or detach it if new is NULL
+ * \param   old     node to replace, its children are not changed
+ * \param   new     node that takes its place with respect to its parent, or NULL
+ */
+static void tree_link (free_block_t *old, free_block_t *new)
 {
-    size = CEIL (size+BINFO_SZ, CacheLineSize);             // true required size in bytes
-    size = size / sizeof (block_info_t);                    // in the heap size is in block_info_t
-    block_info_t *oldnext, *newnext, *new;
-    for (new = Heap.beg;                                    // from the beginning of the Heap
-        (new < Heap.end) && (new->full||(new->size<size));  // while end not reached and no space
-        new += new->size) {}
+    free_block_t *parent = old->parent;
+    if (parent == NULL)                                     // old is the root
+        Heap.tree = new;
+    else
+        parent->child[parent->child[1] == old] = new;
+    if (new)
+        new->parent = parent;
+}
+
+static void tree_insert (free_block_t *blk)
+{
+    free_block_t **link = &Heap.tree;                       // where blk will be linked
+    free_block_t *parent = NULL;
+    blk->child[0] = blk->child[1] = NULL;
+    blk->intree = 1;
+    list_init (&blk->list);                                 // no block of the same size yet
+    for (int bit = TREE_BITS - 1; *link; bit--) {           // from the MSB, at most TREE_BITS
+        free_block_t *node = *link;
+        if (node->info.size == blk->info.size) {            // same size, chained to the node
+            blk->intree = 0;
+            list_addlast (&node->list, &blk->list);
+            return;
+        }
+        parent = node;
+        link = &node->child[(blk->info.size >> bit) & 1];   // the bit of the depth selects
+    }
+    blk->parent = parent;
+    *link = blk;
+}
+
+static void tree_remove (free_block_t *blk)
+{
+    free_block_t *new;
+    if (!blk->intree) {                                     // chained to a node of the same size
+        list_unlink (&blk->list);
+        return;
+    }
+    if (!list_isempty (&blk->list)) {                       // a block of the same size takes its
+        new = list_item (blk->list.next, free_block_t, list);   // place in the tree
+        list_unlink (&blk->list);                           // new is now the head of the chain
+        new->intree = 1;
+    } else if (blk->child[0] || blk->child[1]) {            // any leaf of its subtree takes its
+        new = blk;                                          // place, its size has the same prefix
+        while (new->child[0] || new->child[1])
+            new = (new->child[1]) ? new->child[1] : new->child[0];
+        tree_link (new, NULL);                              // detach the leaf
+    } else {                                                // blk is a leaf
+        tree_link (blk, NULL);
+        return;
+    }
+    new->child[0] = blk->child[0];
+    new->child[1] = blk->child[1];
+    for (int i = 0; i < 2; i++)
+        if (new->child[i])
+            new->child[i]->parent = new;
+    tree_link (blk, new);
+}
+
+/**
+ * \brief   find the best fit of the tree, the smallest block larger than or equal to size
+ *          On the path of size, the right subtrees not taken have larger sizes, the smallest
+ *          size of a subtree is on its leftmost path, thus the deepest one is browsed only.
+ * \param   size    size in block_info
+ * \return  the block found (still in the tree) or NULL
+ */
+static free_block_t * tree_find (unsigned size)
+{
+    free_block_t *best = NULL;                              // best fit so far
+    free_block_t *right = NULL;                             // deepest right subtree not taken
+    unsigned rest = ~0;                                     // space lost by best
+    free_block_t *node = Heap.tree;
+    for (int bit = TREE_BITS - 1; node; bit--) {            // follow the path of size
+        if ((node->info.size >= size) && (node->info.size - size < rest)) {
+            best = node;
+            rest = node->info.size - size;
+            if (rest == 0)                                  // exact fit
+                return best;
+        }
+        free_block_t *node1 = node->child[1];
+        node = node->child[(size >> bit) & 1];
+        if (node1 && (node1 != node))
+            right = node1;
+    }
+    for (node = right; node; node = (node->child[0]) ? node->child[0] : node->child[1]) {
+        if (node->info.size - size < rest) {                // all are larger than size
+            best = node;
+            rest = node->info.size - size;
+        }
+    }
+    return best;
+}
+
+static void bin_insert (free_block_t *blk)
+{
+    unsigned lines = blk->info.size / Heap.line;
+    if (lines >= SMALL_BINS) {
+        tree_insert (blk);
+        return;
+    }
+    list_addfirst (&Heap.bin[lines], &blk->list);
+    Heap.binmap |= 1 << lines;
+}
 
-    if (new >= Heap.end) return NULL;                       // end reached without finding space
+static void bin_remove (free_block_t *blk)
+{
+    unsigned lines = blk->info.size / Heap.line;
+    if (lines >= SMALL_BINS) {
+        tree_remove (blk);
+        return;
+    }
+    list_unlink (&blk->list);
+    if (list_isempty (&Heap.bin[lines]))
+        Heap.binmap &= ~(1 << lines);
+}
 
+/**
+ * \brief   get a free block large enough, it is removed from its bin
+ * \param   size    size in block_info
+ * \return  the block or NULL if there is none
+ */
+static block_info_t * bin_get (unsigned size)
+{
+    unsigned lines = size / Heap.line;
+    free_block_t *blk = NULL;
+    if (lines < SMALL_BINS) {                               // first non empty small bin
+        for (unsigned map = Heap.binmap >> lines; map; map >>= 1, lines++) {
+            if (map & 1) {
+                blk = list_item (list_first (&Heap.bin[lines]), free_block_t, list);
+                break;
+            }
+        }
+    }
+    if (blk == NULL)                                        // none, thus the tree
+        blk = tree_find (size);
+    if (blk)
+        bin_remove (blk);
+    return (block_info_t *) blk;
+}
+
+/**
+ * \brief   make a free block (header and footer) and put it in its bin
+ * \param   blk     address of the block
+ * \param   size    size in block_info
+ * \param   prevfull state of the previous block
+ */
+static void block_put (block_info_t *blk, unsigned size, unsigned prevfull)
+{
+    blk->full = 0;                                          // that is free space
+    blk->prevfull = prevfull;
+    blk->magic = MAGIC_HEAP;                                // to try detect Heap corruption
+    blk->size = size;
+    *(unsigned *)(blk + size - 1) = size;                   // footer, read by free() of the next
+    bin_insert ((free_block_t *) blk);
+}
+
+/**
+ * \brief   free a full block, it is merged with its neighbours if they are free
+ * \param   info    the block
+ * \return  the resulting free block
+ */
+static block_info_t * block_free (block_info_t *info)
+{
+    unsigned size = info->size;
+    block_info_t *next = info + size;
+    if (!next->full) {                                      // merge with the next block if free
+        bin_remove ((free_block_t *) next);
+        size += next->size;
+    }
+    if (!info->prevfull) {                                  // merge with the previous block if free
+        info -= *(unsigned *)(info - 1);                    // its size is in its footer
+        bin_remove ((free_block_t *) info);
+        size += info->size;
+    }
+    block_put (info, size, info->prevfull);                 // the previous one is full
+    (info + size)->prevfull = 0;                            // there is always a next one
+    return info;
+}
+
+/**
+ * \brief   place the tail tag of the heap below brk
+ * \param   brk     first address above the heap
+ */
+static void heap_tail (int *brk)
+{
+    Heap.brk = brk;
+    Heap.end = LINE_FLOOR (brk) - Heap.line;                // the last line
+    Heap.end->full = 1;                                     // never merged
+    Heap.end->magic = MAGIC_HEAP;
+    Heap.end->size = 0;                                     // end of the browsing
+}
+
+/**
+ * \brief   extend the heap by a chunk or more, the new space is free
+ * \param   size    number of block_info needed
+ * \return  1 on success, 0 if the kernel refuses
+ */
+static int heap_grow (unsigned size)
+{
+    size_t need = CEIL (size * BINFO_SZ, PAGE_SIZE);        // the old tail gives a line more
+    size_t incr = (need > Heap.chunk) ? need : Heap.chunk;
+    int *brk = sbrk (incr);
+    if ((brk == (int *)-1) && (incr > need))                // too large, at least what is needed
+        brk = sbrk (incr = need);
+    if (brk == (int *)-1)
+        return 0;
+    if (Heap.chunk < CHUNK_MAX)                             // geometric growth
+        Heap.chunk *= 2;
+
+    block_info_t *blk = Heap.end;                           // the old tail tag becomes a full block
+    unsigned prevfull = blk->prevfull;                      // with the new space
+    heap_tail (brk);
+    blk->prevfull = prevfull;
+    blk->size = Heap.end - blk;
+    Heap.end->prevfull = 1;
+    block_free (blk);                                       // merged with the last block if free
+    return 1;
+}
+
+/**
+ * \brief   give the end of the heap back to the kernel if the last block is a large free one
+ * \param   blk     last free block
+ */
+static void heap_trim (block_info_t *blk)
+{
+    size_t tail = (char *)Heap.brk - (char *)blk;           // free space at the end of the heap
+    if (tail <= 2 * Heap.chunk)                             // not enough to bother the kernel
+        return;
+    int release = FLOOR (tail - Heap.chunk, PAGE_SIZE);     // a chunk is kept for the next malloc
+    int *brk = sbrk (-release);
+    if (brk == (int *)-1)
+        return;
+    bin_remove ((free_block_t *) blk);                      // its size changes
+    heap_tail (brk);
+    Heap.end->prevfull = 0;
+    block_put (blk, Heap.end - blk, 1);
+}
+
+/**
+ * \brief   allocate a full block, HeapLock is held
+ * \param   size    size in block_info
+ * \return  the block or NULL if there is no space anymore
+ */
+static block_info_t * heap_alloc (unsigned size)
+{
+    block_info_t *new = bin_get (size);                     // search for a block
+    if ((new == NULL) && heap_grow (size))                  // if none, extend the heap
+        new = bin_get (size);                               // and try again
+    if (new == NULL)                                        // if no free space
+        return NULL;
+    if (new->size > size) {                                 // if we need to cut the found block
+        block_put (new + size, new->size - size, 1);        // the remaining space is free
+        new->size = size;                                   // new size of current block
+    } else                                                  // else the next block (or the tail)
+        (new + size)->prevfull = 1;                         // has a full previous one
     new->full = 1;                                          // space found, we put the block
-    oldnext = new + new->size;                              // next block address before the cut
-    newnext = LINE_CEIL(new+size);                          // find the new next block
+    return new;
+}
 
-    if (newnext != oldnext) {                               // if we need to cut the find block
-        new->size = newnext - new;                          // new size of current block
-        new->magic = MAGIC_HEAP;                            // to try detect Heap corruption
-        newnext->size = oldnext - newnext;                  // new size of remaining space
-        newnext->full = 0;                                  // that is free space
-        newnext->magic = MAGIC_HEAP;                        // to try detect Heap corruption
+/**
+ * \brief   free a full block, HeapLock is held
+ * \param   info    the block
+ */
+static void heap_free (block_info_t *info)
+{
+    info = block_free (info);                               // merged with its free neighbours
+    if (info + info->size == Heap.end)                      // it is the last block
+        heap_trim (info);
+}
+
+/**
+ * \brief   get the cache of the current thread
+ * \param   create  1 to allocate the cache if the thread has none yet
+ * \return  the cache, or NULL if there is none
+ */
+static malloc_cache_t * cache_get (int create)
+{
+    _tls_t *tls = __tls ();
+    if ((tls->tls_mcache == NULL) && create) {
+        pthread_mutex_lock (&HeapLock);
+        size_t size = CEIL (sizeof(malloc_cache_t) + BINFO_SZ, CacheLineSize) / BINFO_SZ;
+        block_info_t *blk = heap_alloc (size);
+        pthread_mutex_unlock (&HeapLock);
+        if (blk) {
+            malloc_cache_t *cache = (malloc_cache_t *)(blk + 1);
+            for (int i = 0; i < CACHE_CLASSES; i++) {
+                cache->head[i] = NULL;
+                cache->count[i] = 0;
+            }
+            tls->tls_mcache = cache;
+        }
     }
-    return (void *)(new + 1);                               // the allocated block after block_info
+    return tls->tls_mcache;
 }
 
-static void merge (block_info_t * ptr)
+/**
+ * \brief   add a full block to a thread cache
+ * \param   cache   the thread cache
+ * \param   blk     the block of lines cache lines
+ * \param   lines   its size in cache lines, in [1,CACHE_CLASSES]
+ */
+static void cache_push (malloc_cache_t *cache, block_info_t *blk, unsigned lines)
 {
-    for (; ptr != Heap.end; ptr += ptr->size)               // try to merge all free blocks from ptr
-        if (ptr->full == 0)                                 // if current block is free
-            for (block_info_t * next = ptr + ptr->size;     // find next one
-                ((next != Heap.end) && (next->full == 0));  // while not end found a free block
-                next = ptr + ptr->size)                     // go to next block
-                ptr->size += next->size;                    // merge current block with first free
+    *(block_info_t **)(blk + 1) = cache->head[lines-1];     // chained by the first word
+    cache->head[lines-1] = blk;
+    cache->count[lines-1]++;
+}
+
+/**
+ * \brief   remove a full block from a thread cache
+ * \param   cache   the thread cache
+ * \param   lines   size in cache lines, in [1,CACHE_CLASSES]
+ * \return  the block, or NULL if there is none of that size
+ */
+static block_info_t * cache_pop (malloc_cache_t *cache, unsigned lines)
+{
+    block_info_t *blk = cache->head[lines-1];
+    if (blk) {
+        cache->head[lines-1] = *(block_info_t **)(blk + 1);
+        cache->count[lines-1]--;
+    }
+    return blk;
+}
+
+/**
+ * \brief   fill a thread cache with CACHE_BATCH blocks of a size, taken at once in the heap,
+ *          or with a single block if the heap has not enough space
+ * \param   cache   the thread cache
+ * \param   lines   size in cache lines, in [1,CACHE_CLASSES]
+ */
+static void cache_fill (malloc_cache_t *cache, unsigned lines)
+{
+    unsigned size = lines * Heap.line;                      // size of a block in block_info
+    unsigned n = CACHE_BATCH;
+    pthread_mutex_lock (&HeapLock);
+    block_info_t *blk = heap_alloc (n * size);
+    if (blk == NULL)
+        blk = heap_alloc (size * (n = 1));
+    pthread_mutex_unlock (&HeapLock);
+    if (blk == NULL)
+        return;
+    for (unsigned i = n; i--; ) {                           // cut into n full blocks, the first
+        block_info_t *b = blk + i * size;                   // one keeps the state of its previous
+        b->full = 1;                                        // block, it is popped first
+        b->prevfull = (i == 0) ? blk->prevfull : 1;
+        b->magic = MAGIC_HEAP;
+        b->size = size;
+        cache_push (cache, b, lines);
+    }
+}
+
+/**
+ * \brief   give blocks of a size of a thread cache back to the heap
+ * \param   cache   the thread cache
+ * \param   lines   size in cache lines, in [1,CACHE_CLASSES]
+ * \param   n       max number of blocks
+ */
+static void cache_drain (malloc_cache_t *cache, unsigned lines, unsigned n)
+{
+    block_info_t *blk;
+    pthread_mutex_lock (&HeapLock);
+    while (n-- && (blk = cache_pop (cache, lines)))
+        heap_free (blk);
+    pthread_mutex_unlock (&HeapLock);
 }
 
 //-------------------------------------------------------------------------------- public definition
@@ -84,23 +501,42 @@ void malloc_init (void *beg)
     int *end = sbrk (4* PAGE_SIZE);                         // try to get 4 pages (16ko)
 
     if (end == (int *)-1) exit (2);                         // if impossible exit the app
-    Heap.beg = LINE_FLOOR (beg);                            // address of the first BLOCK
-    Heap.end = LINE_FLOOR (end);                            // address of the boundary
-    Heap.beg->full = 0;                                     // empty at the begining
-    Heap.beg->magic = MAGIC_HEAP;                           // to try detect Heap corruption
-    Heap.beg->size = Heap.end - Heap.beg;                   // size of free space
-    CacheLineSize = cachelinesize();                        // ask the kernel for cache line size
+    Heap.beg = LINE_CEIL (beg);                             // address of the first BLOCK
+    Heap.line = CacheLineSize / BINFO_SZ;                   // cache line size in block_info
+    Heap.chunk = CHUNK_MIN;                                 // size of the next extension
+    heap_tail (end);                                        // address of the boundary
+    Heap.end->prevfull = 0;
+    for (int i = 0; i < SMALL_BINS; i++)                    // all bins are empty
+        list_init (&Heap.bin[i]);
+    block_put (Heap.beg, Heap.end - Heap.beg, 1);           // a single free block at the begining
 }
 
 void * malloc (size_t size)
 {
-    block_info_t *ptr = try_malloc (size);                  // Search for a block
-    if (ptr == NULL) {                                      // if no free space
-        merge (Heap.beg);                                   // merge all free blocks from beginning
-        ptr = try_malloc (size);                            // try again to find a block
+    if (size >= (1 << TREE_BITS) * BINFO_SZ - CacheLineSize) {  // larger than the size field
+        errno = ENOMEM;
+        return NULL;
     }
-    if (ptr == NULL) errno = ENOMEM;
-    return ptr;                                             // return what you have found
+    size = CEIL (size+BINFO_SZ, CacheLineSize);             // true required size in bytes
+    size = size / sizeof (block_info_t);                    // in the heap size is in block_info_t
+
+    block_info_t *new = NULL;
+    unsigned lines = size / Heap.line;
+    malloc_cache_t *cache = (lines <= CACHE_CLASSES) ? cache_get (1) : NULL;
+    if (cache) {                                            // small block, from the thread cache
+        if (cache->count[lines-1] == 0)                     // without HeapLock most of the time
+            cache_fill (cache, lines);
+        new = cache_pop (cache, lines);
+    } else {                                                // large block (or no thread cache)
+        pthread_mutex_lock (&HeapLock);
+        new = heap_alloc (size);
+        pthread_mutex_unlock (&HeapLock);
+    }
+    if (new == NULL) {                                      // if no free space
+        errno = ENOMEM;
+        return NULL;
+    }
+    return (void *)(new + 1);                               // the allocated block after block_info
 }
 
 void *calloc(size_t n, size_t size)
@@ -129,12 +565,37 @@ void free (void *ptr)
     block_info_t *info = (block_info_t *)ptr - 1;           // block_info is just before ptr
     if (!ptr || !info->full || (info->magic != MAGIC_HEAP)) // pt NULL OR segment free OR not MAGIC
         exit(1);                                            // memory corrupted
-    info->full = 0;                                         // erase the full flag
+
+    unsigned lines = info->size / Heap.line;
+    malloc_cache_t *cache = (lines <= CACHE_CLASSES) ? cache_get (0) : NULL;
+    if (cache) {                                            // small block, to the thread cache
+        cache_push (cache, info, lines);
+        if (cache->count[lines-1] > CACHE_MAX)              // too many, some go back to the heap
+            cache_drain (cache, lines, CACHE_BATCH);
+        return;
+    }
+    pthread_mutex_lock (&HeapLock);
+    heap_free (info);
+    pthread_mutex_unlock (&HeapLock);
+}
+
+void malloc_cache_flush (void)
+{
+    malloc_cache_t *cache = cache_get (0);
+    if (cache == NULL)                                      // the thread has never allocated
+        return;
+    for (unsigned lines = 1; lines <= CACHE_CLASSES; lines++)
+        cache_drain (cache, lines, cache->count[lines-1]);
+    pthread_mutex_lock (&HeapLock);
+    heap_free ((block_info_t *)cache - 1);                  // the cache itself
+    pthread_mutex_unlock (&HeapLock);
+    __tls ()->tls_mcache = NULL;
 }
 
 void malloc_print (int level)
 {
     block_info_t *ptr;
+    pthread_mutex_lock (&HeapLock);                         // the cached blocks are seen full
     fprintf (0, "------------ %p ------------\n", Heap.beg);
     for (ptr = Heap.beg; ptr < Heap.end; ptr += ptr->size){ // browse all blocks
         fprintf (0, " %p %d %s  [ %x\t- %x\t] = %d\n",
@@ -146,6 +607,7 @@ void malloc_print (int level)
         while (ptr->size == 0);
     }
     fprintf (0, "------------ %p ------------\n", Heap.end);
+    pthread_mutex_unlock (&HeapLock);
 }
 
 /*------------------------------------------------------------------------------------------------*\
@@ -33,7 +33,9 @@ extern void malloc_print (int level);
 extern void malloc_init (void *start);
 
 /**
- * \brief   Try to allocate an object large enough, if none, merge free segments and try again.
+ * \brief   Allocate an object from the free lists (best fit), without browsing the heap.
+ *          If there is none large enough, the heap is extended with sbrk().
+ *          A small object is taken from the cache of the calling thread, thus without lock.
  * \param   size  number of bytes asked
  * \return  A pointer of the allocated object or NULL if there is not place anymore.
  */
@@ -49,10 +51,18 @@ extern void * calloc(size_t n, size_t size);
 
 /**
  * \brief   free an allocated object with  malloc(), object is not erased.
+ *          It is merged with its neighbours if they are free, unless it is a small object,
+ *          which goes to the cache of the calling thread.
  * \param   ptr previously allocated object pointer
  */
 extern void  free(void *ptr);    
 
+/**
+ * \brief   give the objects of the cache of the calling thread back to the heap,
+ *          called by pthread_exit(), the thread must not call malloc() afterwards
+ */
+extern void malloc_cache_flush (void);
+
 /**
  * \brief   Duplicates a string in memory using the standardd allocator.
  * \param   str   The null-terminated string to duplicate.
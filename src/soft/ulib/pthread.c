@@ -13,6 +13,7 @@
 
 #include <libc.h>
 #include <pthread.h>
+#include <hal/cpu/atomic.h>
 
 
 //--------------------------------------------------------------------------------------------------
@@ -32,9 +33,73 @@ static void thread_start (void *(*fun) (void *), void *arg)
     pthread_exit(retval);      // otherwise, if fun ends, ask the kernel to exit the thread
 }
 
+/**
+ * \brief pthread_attr_s is the hidden thread attribute, allocated by pthread_attr_init()
+ */
+struct pthread_attr_s {
+    int sched_priority;        // priority of the new thread, -1 to inherit the creator's one
+};
+
 int pthread_create (pthread_t * thread, pthread_attr_t * attr, void *(*fun) (void *), void *arg)
 {
-    return syscall_fct ((int)thread, (int)fun, (int)arg, (int)thread_start, SYSCALL_THREAD_CREATE);
+    int err = syscall_fct ((int)thread, (int)fun, (int)arg, (int)thread_start,
+                           SYSCALL_THREAD_CREATE);
+    if (!err && attr && *attr && ((*attr)->sched_priority >= 0)) // explicit priority
+        err = syscall_fct ((int)*thread, (*attr)->sched_priority, 0, 0, SYSCALL_SCHED_SETPARAM);
+    return err;
+}
+
+int pthread_attr_init (pthread_attr_t * attr)
+{
+    *attr = malloc (sizeof (struct pthread_attr_s));
+    if (*attr == NULL) return ENOMEM;
+    (*attr)->sched_priority = -1;                           // inherited by default
+    return SUCCESS;
+}
+
+int pthread_attr_destroy (pthread_attr_t * attr)
+{
+    free (*attr);
+    *attr = NULL;
+    return SUCCESS;
+}
+
+int pthread_attr_setschedparam (pthread_attr_t * attr, const struct sched_param *param)
+{
+    if ((param->sched_priority < sched_get_priority_min (SCHED_OTHER))
+    ||  (param->sched_priority > sched_get_priority_max (SCHED_OTHER)))
+        return EINVAL;
+    (*attr)->sched_priority = param->sched_priority;
+    return SUCCESS;
+}
+
+int pthread_attr_getschedparam (pthread_attr_t * attr, struct sched_param *param)
+{
+    param->sched_priority = (*attr)->sched_priority;
+    return SUCCESS;
+}
+
+int pthread_setschedparam (pthread_t thread, int policy, const struct sched_param *param)
+{
+    if (policy != SCHED_OTHER) return EINVAL;
+    return syscall_fct ((int)thread, param->sched_priority, 0, 0, SYSCALL_SCHED_SETPARAM);
+}
+
+int pthread_getschedparam (pthread_t thread, int *policy, struct sched_param *param)
+{
+    *policy = SCHED_OTHER;
+    param->sched_priority = syscall_fct ((int)thread, 0, 0, 0, SYSCALL_SCHED_GETPARAM);
+    return SUCCESS;
+}
+
+int sched_get_priority_min (int policy)
+{
+    return (policy == SCHED_OTHER) ? 0 : -1;
+}
+
+int sched_get_priority_max (int policy)
+{
+    return (policy == SCHED_OTHER) ? 31 : -1;               // SCHED_PRIO_NB-1 in kernel/kthread.h
 }
 
 int pthread_yield (void)
@@ -44,6 +109,7 @@ int pthread_yield (void)
 
 void pthread_exit (void *retval)
 {
+    malloc_cache_flush ();                                  // its cached blocks go to the heap
     syscall_fct ((int)retval, 0, 0, 0, SYSCALL_THREAD_EXIT);
 }
 
@@ -63,24 +129,87 @@ void pthread_join (pthread_t thread, void **retval)
 //--------------------------------------------------------------------------------------------------
 
 
+/**
+ * \brief   identifier of the calling thread, that is the number of its user stack plus 1,
+ *          since the stacks are slots of USTACK_SIZE below __usermem.ustack_beg (kernel/kmemuser.c)
+ * \return  a number > 0, different for each thread alive
+ */
+static int pthread_self_id (void)
+{
+    int here;                                               // a variable in the current stack
+    return 1 + ((char *)__usermem.ustack_beg - (char *)&here) / USTACK_SIZE;
+}
+
 int pthread_mutex_init (pthread_mutex_t * mutex, pthread_mutexattr_t * attr)
 {
-    return syscall_fct ((int)mutex, 0, 0, 0, SYSCALL_MUTEX_INIT);
+    mutex->lock = 0;                                        // free
+    mutex->owner = 0;
+    return SUCCESS;
 }
 
 int pthread_mutex_destroy (pthread_mutex_t * mutex)
 {
-    return syscall_fct ((int)mutex, 0, 0, 0, SYSCALL_MUTEX_DESTROY);
+    if (mutex->lock) return EBUSY;                          // try to destroy a locked mutex
+    return SUCCESS;
+}
+
+/**
+ * lock, it is the mutex of "Futexes are tricky" (U. Drepper), with a spin before waiting.
+ * 1) fast path: 0 -> 1, the mutex is free, it is taken with a single atomic_cas()
+ * 2) spin: the owner is maybe running on another CPU and will release the mutex soon, then a few
+ *    tries are done by reading the lock only (thus in the cache) until it seems free. There is no
+ *    spin when a single CPU runs the threads (__usermem.ncpus), the owner is not running then.
+ * 3) slow path: the lock is set to 2 to tell the unlock that there may be waiting threads, and
+ *    the thread waits in the kernel while the lock is 2 (SYSCALL_FUTEX_WAIT checks it).
+ *    When the mutex is taken, the lock stays to 2 since other threads can wait, at worst there
+ *    will be a useless SYSCALL_FUTEX_WAKE.
+ * When abstime is not NULL, the wait ends at this deadline.
+ */
+static int pthread_mutex_acquire (pthread_mutex_t * mutex, const struct timespec * abstime)
+{
+    int self = pthread_self_id ();
+    if (mutex->owner == self) return EDEADLK;               // try to lock several times
+
+    int c = atomic_cas (&mutex->lock, 0, 1);                // 1) fast path
+    int spin = (__usermem.ncpus > 1) ? PTHREAD_MUTEX_SPIN : 0;
+    for (; c && spin; spin--)                               // 2) spin
+        if (*(volatile int *)&mutex->lock == 0)             // seems free
+            c = atomic_cas (&mutex->lock, 0, 1);            // try again
+
+    if (c) {                                                // 3) slow path
+        int timed = (abstime != NULL);
+        unsigned deadline = (timed) ? timespec_to_clock (abstime) : 0;
+        if (c != 2)                                         // tell there is a waiting thread
+            c = atomic_xchg (&mutex->lock, 2);
+        while (c) {                                         // until the lock was 0
+            int err = syscall_fct ((int)&mutex->lock, 2, deadline, timed, SYSCALL_FUTEX_WAIT);
+            if (err == ETIMEDOUT)
+                return ETIMEDOUT;
+            c = atomic_xchg (&mutex->lock, 2);
+        }
+    }
+    mutex->owner = self;                                    // set the ownership
+    return SUCCESS;
 }
 
 int pthread_mutex_lock (pthread_mutex_t * mutex)
 {
-    return syscall_fct ((int)mutex, 0, 0, 0, SYSCALL_MUTEX_LOCK);
+    return pthread_mutex_acquire (mutex, NULL);
+}
+
+int pthread_mutex_timedlock (pthread_mutex_t * mutex, const struct timespec * abstime)
+{
+    return pthread_mutex_acquire (mutex, abstime);
 }
 
 int pthread_mutex_unlock (pthread_mutex_t * mutex)
 {
-    return syscall_fct ((int)mutex, 0, 0, 0, SYSCALL_MUTEX_UNLOCK);
+    if (mutex->lock == 0) return EINVAL;                    // unlock an unlocked mutex
+    if (mutex->owner != pthread_self_id ()) return EPERM;   // the thread does not own the mutex
+    mutex->owner = 0;
+    if (atomic_xchg (&mutex->lock, 0) == 2)                 // there may be waiting threads
+        syscall_fct ((int)&mutex->lock, 1, 0, 0, SYSCALL_FUTEX_WAKE);
+    return SUCCESS;
 }
 
 
@@ -103,3 +232,95 @@ int pthread_barrier_wait (pthread_barrier_t * barrier)
 {
     return syscall_fct ((int)barrier, 0, 0, 0, SYSCALL_BARRIER_WAIT);
 }
+
+int pthread_barrier_timedwait (pthread_barrier_t * barrier, const struct timespec * abstime)
+{
+    unsigned deadline = timespec_to_clock (abstime);
+    return syscall_fct ((int)barrier, deadline, 0, 0, SYSCALL_BARRIER_TIMED);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Condition variable API
+//--------------------------------------------------------------------------------------------------
+
+
+int pthread_cond_init (pthread_cond_t * cond, pthread_condattr_t * attr)
+{
+    return syscall_fct ((int)cond, 0, 0, 0, SYSCALL_COND_INIT);
+}
+
+int pthread_cond_destroy (pthread_cond_t * cond)
+{
+    return syscall_fct ((int)cond, 0, 0, 0, SYSCALL_COND_DESTROY);
+}
+
+/**
+ * The kernel releases the mutex after the thread is in the waiting list of the condition, then
+ * the mutex is taken again here, whatever the result of the wait (as POSIX asks for).
+ */
+static int pthread_cond_sleep (pthread_cond_t * cond, pthread_mutex_t * mutex,
+                               const struct timespec * abstime)
+{
+    if (*cond == NULL) return EINVAL;                       // unitialized cond
+    if (mutex->owner != pthread_self_id ()) return EPERM;   // the thread must own the mutex
+
+    int timed = (abstime != NULL);
+    unsigned deadline = (timed) ? timespec_to_clock (abstime) : 0;
+    mutex->owner = 0;                                       // released by the kernel
+    int err = syscall_fct ((int)cond, (int)&mutex->lock, deadline, timed, SYSCALL_COND_WAIT);
+    pthread_mutex_lock (mutex);                             // take the mutex again
+    return err;
+}
+
+int pthread_cond_wait (pthread_cond_t * cond, pthread_mutex_t * mutex)
+{
+    return pthread_cond_sleep (cond, mutex, NULL);
+}
+
+int pthread_cond_timedwait (pthread_cond_t * cond, pthread_mutex_t * mutex,
+                            const struct timespec * abstime)
+{
+    return pthread_cond_sleep (cond, mutex, abstime);
+}
+
+int pthread_cond_signal (pthread_cond_t * cond)
+{
+    return syscall_fct ((int)cond, 0, 0, 0, SYSCALL_COND_SIGNAL);
+}
+
+int pthread_cond_broadcast (pthread_cond_t * cond)
+{
+    return syscall_fct ((int)cond, 1, 0, 0, SYSCALL_COND_SIGNAL);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+// Reader-writer lock API
+//--------------------------------------------------------------------------------------------------
+
+
+int pthread_rwlock_init (pthread_rwlock_t * rwlock, pthread_rwlockattr_t * attr)
+{
+    return syscall_fct ((int)rwlock, 0, 0, 0, SYSCALL_RWLOCK_INIT);
+}
+
+int pthread_rwlock_destroy (pthread_rwlock_t * rwlock)
+{
+    return syscall_fct ((int)rwlock, 0, 0, 0, SYSCALL_RWLOCK_DESTROY);
+}
+
+int pthread_rwlock_rdlock (pthread_rwlock_t * rwlock)
+{
+    return syscall_fct ((int)rwlock, 0, 0, 0, SYSCALL_RWLOCK_RDLOCK);
+}
+
+int pthread_rwlock_wrlock (pthread_rwlock_t * rwlock)
+{
+    return syscall_fct ((int)rwlock, 0, 0, 0, SYSCALL_RWLOCK_WRLOCK);
+}
+
+int pthread_rwlock_unlock (pthread_rwlock_t * rwlock)
+{
+    return syscall_fct ((int)rwlock, 0, 0, 0, SYSCALL_RWLOCK_UNLOCK);
+}
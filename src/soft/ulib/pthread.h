@@ -30,6 +30,18 @@ typedef struct pthread_s * pthread_t;
  */
 typedef struct pthread_attr_s * pthread_attr_t;
 
+/**
+ * \brief   scheduling parameters of a thread
+ *          The scheduler elects the READY thread of the highest priority, round robin for the same
+ *          priority. A thread waiting for an I/O gets a boost for one quantum when it is notified.
+ *          A new thread inherits the priority of its creator, 16 for the main thread.
+ */
+struct sched_param {
+    int sched_priority;     ///< from sched_get_priority_min() to sched_get_priority_max()
+};
+
+#define SCHED_OTHER         0   /* the only policy, fixed priorities with round robin */
+
 /**
  * \brief   asks the kernel via a syscall to start a new thread by invoking fun(arg)
  *          fun() can stop the thread by calling thread_exit(value)
@@ -43,6 +55,64 @@ typedef struct pthread_attr_s * pthread_attr_t;
  */
 extern int pthread_create (pthread_t *thread, pthread_attr_t *attr, void *(*fun)(void*), void *arg);
 
+/**
+ * \brief   initialize a thread attribute with the default values (inherited priority)
+ * \param   attr    pointer to the attribute
+ * \return  0 on success, ENOMEM if there is not enough memory
+ */
+extern int pthread_attr_init (pthread_attr_t *attr);
+
+/**
+ * \brief   destroy a thread attribute, the threads created with it are not concerned
+ * \param   attr    pointer to the attribute
+ * \return  0 on success
+ */
+extern int pthread_attr_destroy (pthread_attr_t *attr);
+
+/**
+ * \brief   set the priority of the threads created with this attribute, instead of inheriting it
+ *          Note that the priority is set just after the creation, thus the new thread may run
+ *          a little while with the priority of its creator.
+ * \param   attr    pointer to the attribute
+ * \param   param   scheduling parameters
+ * \return  0 on success, EINVAL if the priority is out of range
+ */
+extern int pthread_attr_setschedparam (pthread_attr_t *attr, const struct sched_param *param);
+
+/**
+ * \brief   get the priority of the threads created with this attribute
+ * \param   attr    pointer to the attribute
+ * \param   param   scheduling parameters, sched_priority is -1 when the priority is inherited
+ * \return  0 on success
+ */
+extern int pthread_attr_getschedparam (pthread_attr_t *attr, struct sched_param *param);
+
+/**
+ * \brief   set the priority of a thread, it takes effect at the next tick at the latest
+ * \param   thread  the thread to change, NULL for the calling thread
+ * \param   policy  must be SCHED_OTHER
+ * \param   param   scheduling parameters
+ * \return  0 on success, EINVAL if the policy or the priority is wrong
+ */
+extern int pthread_setschedparam (pthread_t thread, int policy, const struct sched_param *param);
+
+/**
+ * \brief   get the priority of a thread
+ * \param   thread  the thread, NULL for the calling thread
+ * \param   policy  pointer to the policy, always SCHED_OTHER
+ * \param   param   scheduling parameters
+ * \return  0 on success
+ */
+extern int pthread_getschedparam (pthread_t thread, int *policy, struct sched_param *param);
+
+/**
+ * \brief   lowest and highest priorities of a scheduling policy
+ * \param   policy  must be SCHED_OTHER
+ * \return  the priority (0 and 31 since the kernel has 32 priorities), -1 for a wrong policy
+ */
+extern int sched_get_priority_min (int policy);
+extern int sched_get_priority_max (int policy);
+
 /**
  * \brief   Causes the current thread to give up the CPU in order to give it to another
  */
@@ -72,10 +142,18 @@ void sched_dump(void);
 //--------------------------------------------------------------------------------------------------
 
 
+#define PTHREAD_MUTEX_SPIN  100     ///< tries before waiting in the kernel, if several CPUs
+
 /**
- * \brief   hidden mutex type
+ * \brief   mutex type, it is a futex in the user memory, thus an uncontended lock or unlock is an
+ *          atomic operation without any syscall, the kernel is asked to wait only on contention
  */
-typedef struct pthread_mutex_s * pthread_mutex_t;
+typedef struct pthread_mutex_s {
+    int lock;                       ///< 0 free, 1 locked, 2 locked and maybe waiting threads
+    int owner;                      ///< identifier of the owner thread (error checking), 0 if none
+} pthread_mutex_t;
+
+#define PTHREAD_MUTEX_INITIALIZER   { 0, 0 }
 
 /**
  * \brief   hidden mutex attribute type
@@ -100,6 +178,15 @@ extern int pthread_mutex_init (pthread_mutex_t * mutex, pthread_mutexattr_t * at
  */
 extern int pthread_mutex_lock (pthread_mutex_t * mutex);
 
+/**
+ * \brief   lock the referenced mutex, as pthread_mutex_lock() but the calling thread blocks until
+ *          the absolute time abstime at most, the thread sleeps meanwhile
+ * \param   mutex a pointer referencing a mutex
+ * \param   abstime deadline, it is a time of CLOCK_MONOTONIC (see clock_gettime())
+ * \return  0 on success, ETIMEDOUT if the mutex is not got before abstime
+ */
+extern int pthread_mutex_timedlock (pthread_mutex_t * mutex, const struct timespec * abstime);
+
 /**
  * \brief   unlock the referenced mutex
  *          If the mutex does not exist or is not locked or has been locked by another, 
@@ -158,6 +245,15 @@ int pthread_barrier_init (pthread_barrier_t * barrier, pthread_barrierattr_t *at
  */
 extern int pthread_barrier_wait (pthread_barrier_t * barrier);
 
+/**
+ * \brief   wait to the referenced barrier, as pthread_barrier_wait() but until the absolute time
+ *          abstime at most, then the thread leaves the barrier (it is not a POSIX function)
+ * \param   barrier a pointer referencing a barrier
+ * \param   abstime deadline, it is a time of CLOCK_MONOTONIC (see clock_gettime())
+ * \return  SUCCESS, ETIMEDOUT if the other threads do not arrive before abstime
+ */
+extern int pthread_barrier_timedwait (pthread_barrier_t * barrier, const struct timespec * abstime);
+
 /**
  * \brief   destroy the referenced barrier
  *          If a thread is waiting at the barrier, then the destruction is not done, it is an error
@@ -170,4 +266,122 @@ extern int pthread_barrier_wait (pthread_barrier_t * barrier);
  */
 extern int pthread_barrier_destroy (pthread_barrier_t * barrier);
 
+
+
+//--------------------------------------------------------------------------------------------------
+// Condition variable API
+//--------------------------------------------------------------------------------------------------
+
+
+/**
+ * \brief   hidden condition variable type, the user do not know what is in the structure
+ */
+typedef struct pthread_cond_s * pthread_cond_t;
+
+/**
+ * \brief   hidden condition variable attribute type
+ */
+typedef struct pthread_condattr_s * pthread_condattr_t;
+
+/**
+ * \brief   creates a new condition variable and initializes cond with it (side effect)
+ * \param   cond a pointer referencing the new condition variable
+ * \param   attr a pointer to the attribute of the new condition variable (NULL for default)
+ * \return  SUCCESS or ENOMEM
+ */
+extern int pthread_cond_init (pthread_cond_t * cond, pthread_condattr_t * attr);
+
+/**
+ * \brief   destroy the referenced condition variable
+ * \param   cond a pointer referencing a condition variable
+ * \return  SUCCESS, EINVAL if it does not exist, EBUSY if threads are waiting
+ */
+extern int pthread_cond_destroy (pthread_cond_t * cond);
+
+/**
+ * \brief   release the mutex and wait for a signal on the condition variable, atomically.
+ *          The thread sleeps in the kernel, then it takes the mutex again before returning.
+ * \param   cond a pointer referencing a condition variable
+ * \param   mutex a pointer referencing a mutex owned by the calling thread
+ * \return  SUCCESS, EINVAL if cond does not exist, EPERM if the mutex is not owned
+ */
+extern int pthread_cond_wait (pthread_cond_t * cond, pthread_mutex_t * mutex);
+
+/**
+ * \brief   same as pthread_cond_wait() but until the absolute time abstime at most
+ * \param   cond a pointer referencing a condition variable
+ * \param   mutex a pointer referencing a mutex owned by the calling thread
+ * \param   abstime deadline, it is a time of CLOCK_MONOTONIC (see clock_gettime())
+ * \return  SUCCESS, ETIMEDOUT if there is no signal before abstime, EINVAL, EPERM
+ */
+extern int pthread_cond_timedwait (pthread_cond_t * cond, pthread_mutex_t * mutex,
+                                   const struct timespec * abstime);
+
+/**
+ * \brief   wake the first thread waiting on the condition variable, if any
+ * \param   cond a pointer referencing a condition variable
+ * \return  SUCCESS or EINVAL
+ */
+extern int pthread_cond_signal (pthread_cond_t * cond);
+
+/**
+ * \brief   wake all the threads waiting on the condition variable
+ * \param   cond a pointer referencing a condition variable
+ * \return  SUCCESS or EINVAL
+ */
+extern int pthread_cond_broadcast (pthread_cond_t * cond);
+
+
+//--------------------------------------------------------------------------------------------------
+// Reader-writer lock API
+//--------------------------------------------------------------------------------------------------
+
+
+/**
+ * \brief   hidden reader-writer lock type, the user do not know what is in the structure
+ */
+typedef struct pthread_rwlock_s * pthread_rwlock_t;
+
+/**
+ * \brief   hidden reader-writer lock attribute type
+ */
+typedef struct pthread_rwlockattr_s * pthread_rwlockattr_t;
+
+/**
+ * \brief   creates a new reader-writer lock and initializes rwlock with it (side effect)
+ * \param   rwlock a pointer referencing the new rwlock
+ * \param   attr a pointer to the attribute of the new rwlock (NULL for default)
+ * \return  SUCCESS or ENOMEM
+ */
+extern int pthread_rwlock_init (pthread_rwlock_t * rwlock, pthread_rwlockattr_t * attr);
+
+/**
+ * \brief   destroy the referenced rwlock
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL if it does not exist, EBUSY if it is held
+ */
+extern int pthread_rwlock_destroy (pthread_rwlock_t * rwlock);
+
+/**
+ * \brief   lock for reading, the readers hold the rwlock together. The thread sleeps while a
+ *          writer holds it or waits for it (thus the writers are not starved)
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL, EDEADLK if the calling thread holds it for writing
+ */
+extern int pthread_rwlock_rdlock (pthread_rwlock_t * rwlock);
+
+/**
+ * \brief   lock for writing, the writer is alone. The thread sleeps while the rwlock is held.
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL, EDEADLK if the calling thread holds it for writing
+ */
+extern int pthread_rwlock_wrlock (pthread_rwlock_t * rwlock);
+
+/**
+ * \brief   unlock the rwlock held for reading or writing
+ * \param   rwlock a pointer referencing a rwlock
+ * \return  SUCCESS, EINVAL, EPERM if it is not held
+ */
+extern int pthread_rwlock_unlock (pthread_rwlock_t * rwlock);
+
 #endif//_PTHREAD_H_